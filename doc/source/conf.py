@@ -177,4 +177,9 @@ man_pages = [('saddlesum-cli',
               "Shows information about SaddleSum's ETD databases",
               'Aleksandar Stojmirovic',
               1),
+             ('saddlesum-build-etd',
+              'saddlesum-build-etd',
+              "Compiles GMT files into SaddleSum's ETD databases",
+              'Aleksandar Stojmirovic',
+              1),
              ]
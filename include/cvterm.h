@@ -40,6 +40,14 @@ extern "C" {
 
 #include <inttypes.h>
 #include "miscutils.h"
+#include "dbindex.h"
+
+/* ETD file and namespace block magic numbers */
+#define EXTERMDB_MAGIC 1644632861U
+#define EXTERMDB_V2_MAGIC 2837470219U
+#define KEGGTERMDB_MAGIC 2264738403U
+#define GOTERMDB_MAGIC 2187050528U
+#define PLAINTERMDB_MAGIC 2419174921U  /* terms without URLs */
 
 /* Basic cvterm object interface */
 struct _CVTerm_s;
@@ -78,6 +86,7 @@ typedef struct _KEGGTerm_s {
 } KEGGTerm;
 
 CVTerm *CVTerm_init(CVTerm *);
+CVTerm *ETDTerm_init(CVTerm *);
 CVTerm *GOTerm_init(CVTerm *);
 CVTerm *KEGGTerm_init(CVTerm *);
 
@@ -90,6 +99,8 @@ struct _CVTermDb_s;
         uint32_t num_terms;                                               \
         void (*delete) (struct _CVTermDb_s *);                            \
         CVTerm * (*get_term_from_index) (struct _CVTermDb_s *, uint32_t); \
+        const char * (*get_namespace_from_index) (struct _CVTermDb_s *,   \
+                                                  uint32_t);              \
         CVTerm * (*get_term_from_term_id) (struct _CVTermDb_s *, char *); \
         int (*get_index_from_term_id) (struct _CVTermDb_s *, char *);  \
         int (*insert_term) (struct _CVTermDb_s *, const char *,           \
@@ -99,11 +110,50 @@ typedef struct _CVTermDb_s {
 	CVTermDb_HEAD
 } CVTermDb;
 
+/* Creates every term object and the term ID lookup tables, which ETD
+   databases otherwise build on first request. Afterwards, the lookup
+   functions only read term_db and can be called from several threads. */
+void CVTermDb_make_all_terms(CVTermDb *term_db);
+
+
+/* Directory entry of a version 2 ETD file: one per top-level block. Index
+   sections follow the blocks and store in magic the number of the section
+   they index. */
+typedef struct _ETDSection_s {
+        char tag[8];        /* NCBIGENE, TERMDBNS or an index tag */
+        uint64_t offset;    /* absolute position of the block in the file */
+        uint64_t size;      /* block length in bytes */
+        uint32_t magic;     /* block magic (namespace type) */
+        uint32_t num_items; /* genes, terms or index keys */
+        uint64_t num_hits;  /* term-gene mappings in the block */
+} ETDSection;
+
+
+/* Term table of a loaded ETD namespace, stored by column. The arrays
+   point into the file image, with the parents and edge types of all terms
+   in CSR form. The string offsets and link offsets are computed when the
+   namespace is first used, and term objects are created from the table
+   only when requested. */
+typedef struct _ETDNamespace_s {
+        CVTerm *(*term_init) (CVTerm *);  /* NULL if not loaded */
+        uint32_t num_edgetypes;
+        uint32_t *flags;
+        uint32_t *num_parents;
+        size_t num_links;
+        uint32_t *parent_terms;      /* all links of the namespace */
+        uint32_t *parent_edgetypes;
+        /* decoded on first use */
+        char **edgetypes;
+        uint32_t *term_id_offsets;   /* into the term ID buffer */
+        uint32_t *desc_offsets;      /* into the description buffer */
+        size_t *link_offsets;        /* first link of each term */
+} ETDNamespace;
+
 
 typedef struct _ETDTermDb_s {
 	CVTermDb_HEAD
         uint32_t max_terms;
-        CVTerm **terms;
+        CVTerm **terms;  /* NULL until a term is requested */
         char *db_name;
         uint32_t num_namespaces;
         uint32_t *num_ns_terms;
@@ -114,6 +164,16 @@ typedef struct _ETDTermDb_s {
         char **edgetype_bufs;
         char **metadata_bufs;
         struct hashtable *termid2index;
+        uint32_t version;
+        uint32_t num_sections;
+        ETDSection *sections;  /* genes first, then namespaces (v2 only) */
+        StrIndex **termid_indexes;  /* per namespace, NULL if not indexed */
+        uint32_t *ns_offsets;  /* index of the first term of each namespace */
+        ETDNamespace *ns_data;
+        Arena term_arena;  /* term objects of loaded namespaces */
+        uint8_t term_ids_indexed;  /* term IDs of all loaded namespaces
+                                      are in termid2index or indexed */
+        BinReader *reader;  /* owner of the buffers read from file */
 } ETDTermDb;
 
 #ifdef __cplusplus
@@ -0,0 +1,121 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+#ifndef _DBINDEX_H
+#define _DBINDEX_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "miscutils.h"
+
+/* Lookup tables stored in database files. Keys are kept in ascending order
+   so that a lookup is a binary search over arrays used in place from the
+   file image, and nothing needs to be hashed or allocated per key when a
+   database is loaded.
+
+   Packed layout (little-endian):
+       IntIndex: n, keys[n], values[n]
+       StrIndex: n, key_offsets[n], values[n], size of pool, pool
+   String keys are NUL-terminated and key_offsets point into the pool. */
+
+typedef struct _IntIndex_s {
+        uint32_t num_keys;
+        uint32_t *keys;
+        uint32_t *values;
+} IntIndex;
+
+typedef struct _StrIndex_s {
+        uint32_t num_keys;
+        uint32_t *key_offsets;
+        uint32_t *values;
+        char *pool;
+} StrIndex;
+
+/* Packing: for duplicate keys the value given first is kept. Key sizes for
+   StrIndex_pack may be NULL, otherwise they give the number of pool bytes
+   to store for each key (at least strlen + 1). */
+char *IntIndex_pack(const uint32_t *keys, const uint32_t *values, uint32_t n,
+                    uint32_t *num_keys, uint64_t *size);
+char *StrIndex_pack(char **keys, const uint32_t *key_sizes,
+                    const uint32_t *values, uint32_t n,
+                    uint32_t *num_keys, uint64_t *size);
+
+IntIndex *IntIndex_load(BinReader *reader);
+StrIndex *StrIndex_load(BinReader *reader);
+void IntIndex_delete(IntIndex *index, BinReader *reader);
+void StrIndex_delete(StrIndex *index, BinReader *reader);
+
+int IntIndex_search(const IntIndex *index, uint32_t key, uint32_t *value);
+const char *StrIndex_search(const StrIndex *index, const char *key, uint32_t *value);
+
+/* Lookup tables built in memory when a database file has no indexes. They
+   use open addressing with linear probing and are kept at most half full.
+   Keys are not copied: StrTable keys must stay valid for the lifetime of
+   the table, and each slot also holds the hash of its key so that most
+   probes compare a single integer. IntTable reserves key 0 for empty
+   slots. As with the packed indexes, the value inserted first is kept for
+   duplicate keys. */
+
+typedef struct _IntTable_s {
+        uint32_t num_keys;
+        uint32_t mask;
+        uint32_t *keys;
+        uint32_t *values;
+} IntTable;
+
+typedef struct _StrTable_s {
+        uint32_t num_keys;
+        uint32_t mask;
+        uint32_t *hashes;
+        uint32_t *values;
+        const char **keys;
+} StrTable;
+
+IntTable *IntTable_init(uint32_t capacity);
+StrTable *StrTable_init(uint32_t capacity);
+void IntTable_delete(IntTable *table);
+void StrTable_delete(StrTable *table);
+
+int IntTable_insert(IntTable *table, uint32_t key, uint32_t value);
+int StrTable_insert(StrTable *table, const char *key, uint32_t value);
+int IntTable_search(const IntTable *table, uint32_t key, uint32_t *value);
+const char *StrTable_search(const StrTable *table, const char *key, uint32_t *value);
+void StrTable_renumber_values(StrTable *table, const uint32_t *new_index);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !_DBINDEX_H */
@@ -44,6 +44,24 @@ extern "C" {
 #define INIT_MAX_ENTITIES 256
 #define INIT_MAX_TERMS 64
 
+/* Memory-lean builds (SADDLESUM_LEAN_WEIGHTS) store weights in single
+   precision. Scores and the background distribution are still computed
+   in double precision. */
+#ifdef SADDLESUM_LEAN_WEIGHTS
+typedef float weight_t;
+#else
+typedef double weight_t;
+#endif
+
+/* Number of weight columns of a matrix scored together */
+#ifndef SCORE_BLOCK_SIZE
+#define SCORE_BLOCK_SIZE 8
+#endif
+
+/* Entities with weights are marked in a bitset */
+#define USED_INDEX(used_indices, i) (((used_indices)[(i) >> 3] >> ((i) & 7)) & 1)
+#define SET_USED_INDEX(used_indices, i) ((used_indices)[(i) >> 3] |= 1 << ((i) & 7))
+
 typedef enum {TEXT, TAB} OutputType;
 
 typedef enum {
@@ -75,9 +93,11 @@ typedef struct _TermHit_s {
 
 typedef struct _EnrichContext_s {
         const char *db_name;
+        const char *weights_column;  /* matrix column, set by EnrichMatrix */
         uint32_t num_terms;
         uint32_t num_used_terms;
 	uint32_t min_term_size;
+        uint32_t max_term_size;
         uint32_t num_entities;
         uint32_t num_raw_weights;
         uint32_t num_valid_ids;
@@ -98,19 +118,31 @@ typedef struct _EnrichContext_s {
         uint32_t rank_cutoff;
 	double weight_cutoff;
         uint8_t use_all_weights;
+        const char *platform_map_file;  /* set after init to cache ID mapping */
+        uint32_t max_warnings;  /* set after init to store fewer warnings */
+        uint32_t num_warnings;
         EntityWarning *first_warning;
         EntityWarning *last_warning;
-        double *weights;
+        Arena warning_arena;
+        weight_t *weights;
         uint8_t *used_indices;
         uint32_t num_term_hits;
         uint32_t max_term_hits;
         TermHit *term_hits;
-        char **input_symbols;
+        const char **input_symbols;  /* borrowed from input_reader or entity db */
+        BinReader *input_reader;
+        char *input_tail;
+        uint8_t *term_mask;       /* terms scored, NULL if all */
+        uint8_t *namespace_mask;  /* terms not excluded by namespace, NULL if all */
+        uint8_t *used_sets;
+        uint32_t *visit_sets;
+        uint32_t num_visit_sets;
 } EnrichContext;
 
 
 EnrichContext *EnrichContext_init(const char *db_name,
 				  uint32_t min_term_size,
+				  uint32_t max_term_size,
                                   double Evalue_cutoff,
                                   double effective_db_size,
                                   EnrichStats statistics_type,
@@ -123,9 +155,82 @@ EnrichContext *EnrichContext_init(const char *db_name,
 
 void EnrichContext_delete(EnrichContext *cntxt);
 
+void EnrichContext_select_terms(EnrichContext *cntxt, CVTermDb *term_db,
+                                const char **excluded_namespaces, int num_excluded,
+                                char **term_ids, int num_term_ids);
+
 void EnrichResults_load_weights(EnrichContext *cntxt, const char *weights_filename,
 				EntityDb *entity_db, TermMappingDb *mapping_db);
 
+/* A weights file read before the entity database is available, so that
+   both can be loaded at the same time. Text files are parsed, but their
+   symbols are mapped only when the weights are set, which also deletes
+   the object. The file image is then kept by the context, whose input
+   symbols point into it. A weights matrix has a header line naming its
+   columns, after which each line holds a symbol and a weight for every
+   column; only the selected columns are parsed. */
+struct _WeightsChunk_s;
+
+typedef struct _EnrichWeights_s {
+        const char *filename;
+        BinReader *reader;  /* NULL if the file could not be opened */
+        uint8_t binary;
+        uint8_t mapped;
+        uint8_t matrix;
+        uint32_t num_fields;  /* weight fields per line */
+        uint32_t num_columns;  /* selected fields */
+        int32_t *field_columns;  /* selected column of each field, or -1 */
+        char **column_names;
+        uint32_t first_line;
+        struct _WeightsChunk_s *chunks;
+        uint32_t num_chunks;
+        char *tail;
+} EnrichWeights;
+
+EnrichWeights *EnrichWeights_read(const char *weights_filename);
+
+EnrichWeights *EnrichWeights_read_matrix(const char *weights_filename,
+                                         const char **columns, uint32_t num_columns);
+
+void EnrichResults_set_weights(EnrichContext *cntxt, EnrichWeights *weights,
+                               EntityDb *entity_db, TermMappingDb *mapping_db);
+
+#define MATRIX_NO_ENTITY UINT32_MAX
+
+/* The rows of a weights matrix that are accepted, including the repeated
+   ones, or warned about. Symbols are mapped once, for all columns, in the
+   context passed to EnrichResults_set_matrix(). Each column is then scored
+   in its own context, which borrows the term selection of that one. There,
+   missing (NA) weights are skipped, as if their rows were absent from the
+   file, so that the first row with a weight in the column is used for
+   each entity, and the warnings and duplicates are those of the rows
+   left. */
+typedef struct _EnrichMatrix_s {
+        uint32_t num_columns;
+        char **column_names;
+        uint32_t num_rows;
+        uint32_t max_rows;
+        uint32_t *row_entities;  /* MATRIX_NO_ENTITY if only warned about */
+        const char **row_symbols;
+        uint32_t *row_lines;
+        uint8_t *row_warned;
+        weight_t *values;  /* num_rows x num_columns */
+        EntityWarning *warnings;  /* of the warned rows, in order */
+        uint32_t num_warnings;
+        uint32_t max_warnings;
+        uint32_t *num_raw_weights;  /* non-missing weights of each column */
+} EnrichMatrix;
+
+EnrichMatrix *EnrichResults_set_matrix(EnrichContext *cntxt, EnrichWeights *weights,
+                                       EntityDb *entity_db, TermMappingDb *mapping_db);
+
+EnrichContext *EnrichMatrix_column_context(EnrichMatrix *matrix, EnrichContext *cntxt,
+                                           uint32_t column);
+
+void EnrichMatrix_delete_column_context(EnrichContext *column_cntxt);
+
+void EnrichMatrix_delete(EnrichMatrix *matrix);
+
 void EnrichResults_process_weights(EnrichContext *cntxt);
 
 void EnrichResults_calc_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
@@ -134,6 +239,9 @@ void EnrichResults_calc_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 void EnrichResults_calc_single_pvalue(EnrichContext *cntxt, CVTermDb *term_db,
                                       TermMappingDb *mapping_db, uint32_t term_index);
 
+void EnrichResults_calc_pvalues_multi(EnrichContext **cntxts, uint32_t num_cntxts,
+                                      CVTermDb *term_db, TermMappingDb *mapping_db);
+
 void EnrichResults_print_all_text(EnrichContext *cntxt, FILE *fp,
                                   uint8_t print_warnings,
                                   uint8_t print_unknown_ids);
@@ -141,20 +249,39 @@ void EnrichResults_print_all_text(EnrichContext *cntxt, FILE *fp,
 void EnrichResults_print_all_tabsep(EnrichContext *cntxt, FILE *fp, CVTermDb *term_db,
                                     TermMappingDb *mapping_db);
 
+void EnrichResults_print_long_heading(FILE *fp);
+
+void EnrichResults_print_long(EnrichContext *cntxt, FILE *fp);
+
 
 
 int GMT_enrichment_context(const char *gmt_filename, const char *namespace, EntityDb **entity_db,
                            CVTermDb **term_db, TermMappingDb **mapping_db);
 
+int GMT_enrichment_context_multi(const char **namespaces, const char **gmt_filenames,
+                                 int num_files, EntityDb **entity_db,
+                                 CVTermDb **term_db, TermMappingDb **mapping_db);
+
 int ETD_enrichment_context(const char *etd_filename, EntityDb **entity_db_,
 			   CVTermDb **term_db_, TermMappingDb **mapping_db_,
                            const char **excluded_namespaces, int num_excluded);
 
+void TermMappingDb_reorder_entities(TermMappingDb *mapping_db, EntityDb *entity_db);
+
 void ETDTermDb_print_info(const char *etd_filename, FILE *fp, OutputType output_type);
 
 void ETDTermDb_print_namespaces(const char *etd_filename, FILE *fp_out,
                                 OutputType output_type);
 
+void ETDTermDb_print_genes(const char *etd_filename, FILE *fp, OutputType output_type);
+
+void ETDTermDb_write_v2(const char *etd_filename, const char *out_filename);
+
+void ETDTermDb_build(const char *out_filename, const char *db_name,
+                     const char *gene_info_filename, uint32_t tax_id,
+                     const char **namespaces, const char **gmt_filenames,
+                     int num_files);
+
 void EnrichResults_print_term_text(EnrichContext *cntxt, FILE *fp, EntityDb *entity_db,
                                    TermMappingDb *mapping_db);
 
@@ -40,6 +40,9 @@ extern "C" {
 #include <inttypes.h>
 #include <stdio.h>
 #include "miscutils.h"
+#include "dbindex.h"
+
+#define NCBIGENE_MAGIC 1200900292U  /* from ncbi_gene.py */
 
 /* Basic entity object interface */
 struct _Entity_s;
@@ -67,22 +70,42 @@ typedef enum {UNKNOWN_ID,
               DUPLICATE_ID} EntityWarning_code_type;
 
 
+/* Warnings refer to identifiers instead of holding messages, which are
+   formatted only when printed. For conflicts, aliases points to the
+   num_aliases NUL-terminated names involved, starting with the identifier
+   itself, owned by the entity database. For duplicates, line is that of
+   the ignored weight. */
 typedef struct _EntityWarning_s {
 	struct _EntityWarning_s *next;
-	char *msg;
+        const char *symbol;
+        const char *aliases;
+        uint32_t num_aliases;
+        uint32_t line;
         int code;
 } EntityWarning;
 
+void EntityWarning_format(const EntityWarning *warning, PrintBuf *pbuf);
+
 
-/* Basic entity database object interface */
+/* Basic entity database object interface. map_symbol returns nonzero and
+   fills in the warning if the symbol raises one. It must not modify the
+   database, since weights files are mapped from several threads. The
+   num_loaded entities read from a database file are identified by the
+   fingerprint of their IDs and symbols in file order (zero if there is no
+   such file) and loaded_index returns the current index of the i-th one. */
 struct _EntityDb_s;
 
 #define EntityDb_HEAD                                                              \
         uint32_t num_entities;                                                     \
         void (*delete) (struct _EntityDb_s *);                                     \
-        EntityWarning *(*map_symbol) (struct _EntityDb_s *, char *, uint32_t *);   \
+        int (*map_symbol) (struct _EntityDb_s *, char *, uint32_t *,               \
+                           EntityWarning *);                                       \
         Entity * (*get_entity_from_index) (struct _EntityDb_s *, uint32_t);        \
-        uint32_t (*insert_item) (struct _EntityDb_s *, const char *, const char *);
+        uint32_t (*insert_item) (struct _EntityDb_s *, const char *, const char *);  \
+        void (*renumber) (struct _EntityDb_s *, const uint32_t *);                 \
+        uint64_t fingerprint;                                                      \
+        uint32_t num_loaded;                                                       \
+        uint32_t (*loaded_index) (struct _EntityDb_s *, uint32_t);
 
 
 typedef struct _EntityDb_s {
@@ -99,7 +122,8 @@ typedef struct _NCBIGenesDb_s {
         uint32_t *gene_ids;
         char **symbols;
         char **descriptions;
-        /* buffers: symbols_buf and desc_buf can grow, others can't */
+        /* buffers: symbols_buf and desc_buf can grow, others can't. Except
+           for symbols_buf, they initially point into the file image. */
         char *metadata_buf;
         uint32_t symbols_buf_size;
         uint32_t symbols_buf_len;
@@ -109,12 +133,26 @@ typedef struct _NCBIGenesDb_s {
         char *desc_buf;
         char *conflicts1_buf;
         char *conflicts2_buf;
-        struct hashtable *geneid2index;
-        struct hashtable *alias2index;
-        struct hashtable *conflicts;
+        struct hashtable *alias2index;  /* items inserted after loading */
+        /* Prebuilt indexes from the database file or, if it has none,
+           tables built on loading, with keys in the file image. Either
+           way index_map translates their values after renumbering. */
+        IntIndex *geneid_index;
+        StrIndex *alias_index;
+        StrIndex *conflict_index;
+        IntTable *geneid_table;
+        StrTable *alias_table;
+        StrTable *conflict_table;
+        uint32_t num_indexed;
+        uint32_t *index_map;
+        BinReader *reader;  /* owner of the buffers read from file */
 } NCBIGenesDb;
 
-NCBIGenesDb *NCBIGenesDb_init(FILE *fp);
+NCBIGenesDb *NCBIGenesDb_init(BinReader *reader, IntIndex *geneid_index,
+                              StrIndex *alias_index, StrIndex *conflict_index);
+uint32_t NCBIGenesDb_skip(BinReader *reader);
+void NCBIGenesDb_pack_indexes(BinReader *reader, char **packed,
+                              uint32_t *num_keys, uint64_t *sizes);
 
 
 #ifdef __cplusplus
@@ -51,6 +51,26 @@ FSFile_proc_code_type FSFile_next_field(FILE *fp, char fs, char *buf,
 FSFile_proc_code_type SSFile_next_field(FILE *fp, char *buf, 
 					uint32_t max_chars);
 
+/* Text files read by lines through a block buffer. A line is returned
+   without its newline, terminated in place, and stays valid (and may be
+   modified) until the next call. Lines have no length limit. */
+typedef struct _LineReader_s {
+        FILE *fp;
+        char *buf;
+        size_t size;
+        size_t pos;  /* start of the next line */
+        size_t len;  /* end of the data read */
+        int eof;
+} LineReader;
+
+LineReader *LineReader_init(FILE *fp);
+void LineReader_delete(LineReader *reader);
+char *LineReader_next(LineReader *reader, size_t *len);
+
+char *FSFile_split_field(char **cur, char *end, char fs);
+char *SSFile_split_field(char **cur, char *end);
+double FSFile_strtod(const char *s, char **endptr);
+
 #ifdef __cplusplus
 }
 #endif
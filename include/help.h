@@ -7,6 +7,11 @@
 "\n" \
 " saddlesum [options] <weights_file> [<namespace>:]<term_db> [<namespace>:<term_db> ...]\n" \
 "\n" \
+"   To analyze many weights files against the same databases, use the batch\n" \
+"   form (see -B):\n" \
+"\n" \
+" saddlesum [options] -B <manifest_file> [<namespace>:]<term_db> [<namespace>:<term_db> ...]\n" \
+"\n" \
 "OPTIONS\n" \
 "\n" \
 "  Arguments\n" \
@@ -14,7 +19,11 @@
 "   <weights_file>\n" \
 "\n" \
 "           Tab-delimited file with entity ids and weights. If <weights_file>\n" \
-"           is specified as -, use standard input.\n" \
+"           is specified as -, use standard input. For ETD databases, the file\n" \
+"           may also contain binary weights aligned to the genes of the\n" \
+"           database (see saddlesum-show-etd -G). The weights are read while\n" \
+"           the term databases are loaded, so that a program piping them in\n" \
+"           does not wait for the databases.\n" \
 "\n" \
 "   <namespace>:<term_db>\n" \
 "\n" \
@@ -45,6 +54,12 @@
 "           (default = 2). Only entites with supplied weights count towards\n" \
 "           the term size.\n" \
 "\n" \
+"   -M <max_term_size>\n" \
+"\n" \
+"           Set the maximum number of entities for a term to be considered\n" \
+"           (default = no limit). As for -m, only entities with supplied\n" \
+"           weights count towards the term size.\n" \
+"\n" \
 "   -e <Evalue_cutoff>\n" \
 "\n" \
 "           Set the largest E-value for a term to be considered significant\n" \
@@ -92,17 +107,29 @@
 "\n" \
 "   -x <namespace>\n" \
 "\n" \
-"           Exclude <namespace> from ETD database. Each ETD database may\n" \
-"           contain multiple namespaces. This option allows specific\n" \
-"           namespaces to be totally excluded from consideration. It affects\n" \
-"           the effective database and hence the term E-values. More than one\n" \
-"           namespace can be excluded by using this option multiple times.\n" \
+"           Exclude <namespace> from consideration. Each ETD database may\n" \
+"           contain multiple namespaces, while each GMT database is given a\n" \
+"           namespace label on the command line. Excluded ETD namespaces are\n" \
+"           not loaded at all. It affects the effective database and hence\n" \
+"           the term E-values. More than one namespace can be excluded by\n" \
+"           using this option multiple times.\n" \
 "\n" \
 "           Note\n" \
 "\n" \
 "           Use saddlesum-show-etd program to discover the names of all\n" \
 "           namespaces present in an ETD file.\n" \
 "\n" \
+"   -i <term_list_file>\n" \
+"\n" \
+"           Consider only the terms whose IDs are listed in\n" \
+"           <term_list_file>, separated by whitespace. Listed IDs not found\n" \
+"           in the term databases are ignored, but the file must list at least\n" \
+"           one ID. Like -x, this option affects the effective database and\n" \
+"           hence the term E-values. Unlike -x, it does not change the\n" \
+"           statistical background: the weights of entities mapping to any\n" \
+"           term of the namespaces considered are used, as without this\n" \
+"           option.\n" \
+"\n" \
 "   -T <term_id>\n" \
 "\n" \
 "           Compute statistics only for the term with ID <term_id> and display\n" \
@@ -156,11 +183,67 @@
 "   The weight processing options are applied in this order: -t, then -r or -w\n" \
 "   and finally -d.\n" \
 "\n" \
+"  Weights matrix options\n" \
+"\n" \
+"   -X\n" \
+"\n" \
+"           Read <weights_file> as a weights matrix and compute the enrichment\n" \
+"           of each of its columns against the same term databases. The first\n" \
+"           line of the matrix is a header with the column names, optionally\n" \
+"           preceded by a label for the identifier column. Each following line\n" \
+"           holds an entity id and one weight per column, separated by tabs or\n" \
+"           spaces. A weight given as NA is treated as missing for that column\n" \
+"           only, as if its line were absent, so that the results for each\n" \
+"           column are those for a weights file holding only its non-missing\n" \
+"           weights. In particular, if an entity is listed more than once, each\n" \
+"           column uses the first of its lines that gives it a weight. Results\n" \
+"           for all columns are printed one after another, each labeled by its\n" \
+"           column name. The columns are scored in blocks, so that analyzing\n" \
+"           many columns takes much less time than running saddlesum on each of\n" \
+"           them separately. Binary weights files cannot be read as matrices\n" \
+"           and are rejected with an error.\n" \
+"\n" \
+"   -C <column>\n" \
+"\n" \
+"           Analyze only the column <column> of the weights matrix. The option\n" \
+"           can be repeated to select several columns, which are then analyzed\n" \
+"           in the order given (default: all columns). Requires -X.\n" \
+"\n" \
+"   Note\n" \
+"\n" \
+"   The statistical and weight processing options apply to each column\n" \
+"   separately.\n" \
+"\n" \
+"  Database options\n" \
+"\n" \
+"   -L\n" \
+"\n" \
+"           Renumber the database entities after loading so that entities\n" \
+"           annotated by the same terms are stored next to each other. This\n" \
+"           improves memory locality when computing term scores for large\n" \
+"           databases. The results are not affected, apart from possible\n" \
+"           differences in the last digits of floating point scores.\n" \
+"\n" \
+"   -P <map_file>\n" \
+"\n" \
+"           Keep the resolution of weights file identifiers to database genes,\n" \
+"           together with the resulting warnings, in the platform map\n" \
+"           <map_file>. If the map was saved for the same database and the same\n" \
+"           identifiers listed in the same order, the rows of the weights file\n" \
+"           are resolved by their position instead of by looking up each\n" \
+"           identifier. Otherwise, the identifiers are looked up as usual and\n" \
+"           the map is written anew. This speeds up the analysis of many\n" \
+"           weights files from the same platform, such as the samples of a\n" \
+"           microarray series, without changing the results. The option has no\n" \
+"           effect unless all genes come from an ETD database.\n" \
+"\n" \
 "  Output options\n" \
 "\n" \
 "   -O <output_file>\n" \
 "\n" \
-"           Output results to <output_file> instead of to the standard output.\n" \
+"           Output results to <output_file> instead of to the standard\n" \
+"           output. With -X, a %s in <output_file> is replaced by each column\n" \
+"           name to write the results of every column to a separate file.\n" \
 "\n" \
 "   -F <output_format>\n" \
 "\n" \
@@ -174,6 +257,12 @@
 "                        sections are separated by heading lines starting with\n" \
 "                        # character.\n" \
 "\n" \
+"                long\n" \
+"                        print the significant terms of all columns of a\n" \
+"                        weights matrix as a single tab-delimited table, with\n" \
+"                        the column name in the first field. Available only\n" \
+"                        with -X and without -T.\n" \
+"\n" \
 "   -W\n" \
 "\n" \
 "           Print warnings about entity identifiers from the <weights_file>.\n" \
@@ -183,10 +272,45 @@
 "           Print ids from <weights_file> that are not present in the term\n" \
 "           databases.\n" \
 "\n" \
+"   -N <max_warnings>\n" \
+"\n" \
+"           List at most <max_warnings> warnings and unknown ids, in the order\n" \
+"           they occur in <weights_file>, and only note how many more there\n" \
+"           are. The counts in the results header are not affected. This saves\n" \
+"           memory for weights files with very many unknown ids (default: no\n" \
+"           limit).\n" \
+"\n" \
 "   Note\n" \
 "\n" \
 "   Options -W and -U apply only to text output. Tab-delimited ouput always\n" \
 "   contains sections containing warnings and unknown ids.\n" \
+"\n" \
+"  Batch options\n" \
+"\n" \
+"   -B <manifest_file>\n" \
+"\n" \
+"           Load the term databases once and analyze all weights files listed\n" \
+"           in <manifest_file>. Each line of the manifest gives a weights\n" \
+"           file, the file to write its results to and, optionally, options\n" \
+"           for that analysis only, separated by spaces or tabs. A field\n" \
+"           containing spaces can be enclosed in quotes. Empty lines and lines\n" \
+"           starting with # are skipped. For example:\n" \
+"\n" \
+"              # weights file     output file      options\n" \
+"              sample1.tab        sample1.txt\n" \
+"              sample2.tab        sample2.txt      -Ftab -e 1\n" \
+"              series.tab         series_%s.txt    -X -x \"GO cellular component\"\n" \
+"\n" \
+"           The options given on the command line apply to every analysis, and\n" \
+"           those on a manifest line are applied after them. All options\n" \
+"           except -h, -V, -L and -O can be given on manifest lines, where the\n" \
+"           output file field takes the place of -O. Namespaces excluded by -x\n" \
+"           on a manifest line are loaded but skipped by that analysis, so\n" \
+"           they still count among the total database terms.\n" \
+"\n" \
+"           Several analyses are run at the same time. The manifest is checked\n" \
+"           before the databases are loaded, but an error in any analysis,\n" \
+"           such as a malformed weights file, stops the whole batch.\n" \
 "\n" 
 
 
@@ -226,6 +350,13 @@
 "           Specify -Ftab to obtain only the list of namespaces, without any\n" \
 "           other text.\n" \
 "\n" \
+"   -G\n" \
+"\n" \
+"           List the Gene IDs and symbols of all genes in the database, in the\n" \
+"           order expected in binary weights files, preceded by the\n" \
+"           fingerprint of the list. Genes without a Gene ID are listed with\n" \
+"           ID 0.\n" \
+"\n" \
 "   -O <output_file>\n" \
 "\n" \
 "           Output results to <output_file> instead of to the standard output.\n" \
@@ -241,6 +372,87 @@
 "                        print results as a tab-delimited file. Different\n" \
 "                        sections are separated by heading lines starting with\n" \
 "                        # character.\n" \
+"\n" \
+"  Conversion options\n" \
+"\n" \
+"   -C <etd_v2_file>\n" \
+"\n" \
+"           Write a copy of <term_db> in version 2 of the ETD format to\n" \
+"           <etd_v2_file> and exit. Version 2 files contain a directory of\n" \
+"           all gene and namespace blocks, which allows excluded namespaces\n" \
+"           to be skipped without reading them and the database info to be\n" \
+"           shown without loading the database. They also contain sorted\n" \
+"           indexes of gene IDs, symbols and term IDs that are used in place\n" \
+"           instead of building hash tables at startup. Both versions are\n" \
+"           accepted wherever an ETD file is expected.\n" \
 "\n" 
 
 
+
+
+#define HELP_BUILD_ETD "" \
+"SYNOPSIS\n" \
+"\n" \
+" saddlesum-build-etd [options] <etd_file> <namespace>:<gmt_file> [<namespace>:<gmt_file> ...]\n" \
+"\n" \
+"OPTIONS\n" \
+"\n" \
+"  Arguments\n" \
+"\n" \
+"   <etd_file>\n" \
+"\n" \
+"           The database to create, in version 2 of the ETD format.\n" \
+"\n" \
+"   <namespace>:<gmt_file>\n" \
+"\n" \
+"           A term database in GMT format and the namespace label of its\n" \
+"           terms. Terms from files with the same label are placed in the\n" \
+"           same namespace. Term IDs repeated within a namespace or across\n" \
+"           files are kept only once, as when the GMT files are given\n" \
+"           directly to saddlesum.\n" \
+"\n" \
+"  Generic options\n" \
+"\n" \
+"   -h\n" \
+"\n" \
+"           Print a description of all command line options.\n" \
+"\n" \
+"   -V\n" \
+"\n" \
+"           Print the version number and exit. The version number always\n" \
+"           matches that of the qmbpmn-tools.\n" \
+"\n" \
+"  Database options\n" \
+"\n" \
+"   -n <db_name>\n" \
+"\n" \
+"           Set the database name printed in the results (default: the name\n" \
+"           of <etd_file>).\n" \
+"\n" \
+"   -g <gene_info_file>\n" \
+"\n" \
+"           Resolve the gene names in GMT files using the NCBI Gene gene_info\n" \
+"           file <gene_info_file>. A name is first looked up as a Gene ID and\n" \
+"           then as an official symbol or synonym. Synonyms shared by several\n" \
+"           genes, or equal to the symbol of another gene, are not used for\n" \
+"           lookup but stored as conflicts, so that saddlesum can report them\n" \
+"           when they appear in weights files. Names not found in\n" \
+"           <gene_info_file> are added as genes without IDs and reported in a\n" \
+"           warning.\n" \
+"\n" \
+"           Without this option, every distinct name in the GMT files becomes\n" \
+"           a gene without an ID, which is looked up only by that name.\n" \
+"\n" \
+"   -t <tax_id>\n" \
+"\n" \
+"           Use only the genes of the NCBI Taxonomy ID <tax_id> from\n" \
+"           <gene_info_file>, which otherwise must contain genes of a single\n" \
+"           organism. Without -g, the ID is only recorded in the database.\n" \
+"\n" \
+"   Note\n" \
+"\n" \
+"   GMT terms carry no hierarchy or URLs, and genes listed twice for a term\n" \
+"   are stored once. Otherwise, enrichment results for a database built\n" \
+"   without -g match those obtained from the GMT files themselves, while the\n" \
+"   database loads much faster.\n" \
+"\n"
@@ -51,11 +51,30 @@ void *malloc_(size_t size);
 void *realloc_(void *ptr, size_t size);
 char *strdup_(const char *s);
 
+/* Allocation of many small objects that are freed together. Memory comes
+   zeroed from chunks that are released by Arena_delete. */
+typedef struct _Arena_s {
+        char *chunk;  /* most recent chunk, linked to the previous ones */
+        size_t used;
+        size_t size;
+} Arena;
+
+void Arena_init(Arena *arena);
+void *Arena_alloc(Arena *arena, size_t size);
+char *Arena_strdup(Arena *arena, const char *s);
+void Arena_delete(Arena *arena);
+
 /* Hash functions to be used with hashtable */
+struct hashtable;
 unsigned int hash_from_string(void *str);
 int str_equal(void *str1, void *str2);
 unsigned int hash_from_int(void *i_);
 int int_equal(void *i_, void *j_);
+void hashtable_renumber_values(struct hashtable *h, const uint32_t *new_index);
+
+/* 64-bit FNV-1a hash, continued over several buffers from FNV64_OFFSET */
+#define FNV64_OFFSET UINT64_C(14695981039346656037)
+uint64_t fnv64_update(uint64_t hash, const void *buf, size_t n);
 
 /* Printing into buffers that can grow */
 typedef struct _PrintBuf_s {
@@ -74,8 +93,55 @@ void fread_(void *ptr, size_t size, size_t nmemb, FILE *stream);
 void fread_uint32(uint32_t *ptr, size_t nmemb, FILE *stream);
 char *fread_buf(FILE *stream, uint32_t *n);
 void fskip_buf(FILE *stream);
+void fwrite_(const void *ptr, size_t size, size_t nmemb, FILE *stream);
+void fwrite_uint32(const uint32_t *ptr, size_t nmemb, FILE *stream);
+void fwrite_uint64(const uint64_t *ptr, size_t nmemb, FILE *stream);
+void fwrite_buf(const char *buf, uint32_t n, FILE *stream);
 void strbuf2array(char **dest, char *buf, int n);
 
+/* Input file, possibly gzip compressed (detected from the first byte).
+   Compressed data are inflated by a separate thread that feeds a pipe, so
+   that decompression overlaps with parsing; either way fp is read with the
+   usual stdio functions. The file name "-" stands for the standard input. */
+typedef struct _InFile_s {
+        FILE *fp;
+        FILE *src;
+        void *inflater;
+} InFile;
+
+InFile *InFile_open(const char *filename);
+void InFile_close(InFile *in);
+
+/* Binary file image for sequential reading. The file is mapped into memory
+   (or read into memory where mapping is not available or the file is
+   compressed), so that string
+   buffers can be used in place instead of being copied. Integers are stored
+   as little-endian. Objects that keep pointers into the image must retain
+   it and release it when they are deleted. */
+typedef struct _BinReader_s {
+        char *data;
+        size_t size;
+        size_t pos;
+        uint8_t mapped;
+        int refcount;
+} BinReader;
+
+void copy_le_uint32(uint32_t *ptr, const void *src, size_t nmemb);
+BinReader *BinReader_open(const char *filename);
+void BinReader_retain(BinReader *reader);
+void BinReader_release(BinReader *reader);
+void BinReader_read(BinReader *reader, void *ptr, size_t n);
+void BinReader_read_uint32(BinReader *reader, uint32_t *ptr, size_t nmemb);
+void BinReader_read_uint64(BinReader *reader, uint64_t *ptr, size_t nmemb);
+void BinReader_read_double(BinReader *reader, double *ptr, size_t nmemb);
+void BinReader_read_float(BinReader *reader, float *ptr, size_t nmemb);
+uint32_t *BinReader_uint32_array(BinReader *reader, size_t nmemb);
+void BinReader_seek(BinReader *reader, uint64_t pos);
+char *BinReader_buf(BinReader *reader, uint32_t *n);
+void BinReader_skip(BinReader *reader, size_t n);
+void BinReader_skip_buf(BinReader *reader);
+void BinReader_free(BinReader *reader, void *ptr);
+
 #ifdef __cplusplus
 }
 #endif
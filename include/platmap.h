@@ -0,0 +1,91 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+
+#ifndef _PLATMAP_H
+#define _PLATMAP_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stdint.h>
+#include "miscutils.h"
+
+/* Platform maps record how the rows of a weights file were resolved to the
+   genes of an ETD database, so that later weights files listing the same
+   identifiers in the same order can be mapped by position. A map is valid
+   for a single database, identified by its gene fingerprint, and a single
+   ordered list of identifiers, identified by a hash of the identifiers.
+
+   Packed layout (little-endian):
+       "SSPLTMAP", version, num_rows, db fingerprint, rows hash,
+       genes[num_rows], codes[num_rows] (one byte each)
+   Genes are given in the order of the database file (PLATFORM_MAP_NONE
+   for unmapped rows). A code is 0 for rows without a warning and otherwise
+   the warning code plus one. */
+
+#define PLATFORM_MAP_NONE UINT32_MAX
+
+typedef struct _PlatformMap_s {
+        uint32_t num_rows;
+        uint64_t fingerprint;
+        uint64_t rows_hash;
+        uint32_t *genes;
+        uint8_t *codes;
+        BinReader *reader;
+} PlatformMap;
+
+/* Continues the hash of the identifiers with that of the next row */
+uint64_t PlatformMap_hash_row(uint64_t rows_hash, uint64_t row_hash);
+
+/* An empty map to fill in */
+PlatformMap *PlatformMap_init(uint32_t num_rows, uint64_t fingerprint,
+                              uint64_t rows_hash);
+
+/* Returns NULL if the file does not exist or was made for other
+   identifiers or another database with num_genes genes */
+PlatformMap *PlatformMap_read(const char *filename, uint32_t num_rows,
+                              uint64_t fingerprint, uint64_t rows_hash,
+                              uint32_t num_genes);
+
+/* The map is written next to filename and then renamed, so that a map
+   being written is never read. Returns 0 on failure. */
+int PlatformMap_write(const PlatformMap *map, const char *filename);
+
+void PlatformMap_delete(PlatformMap *map);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !_PLATMAP_H */
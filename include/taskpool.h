@@ -0,0 +1,57 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+#ifndef _TASKPOOL_H
+#define _TASKPOOL_H
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include <stddef.h>
+
+/* Runs func on each of num_tasks task records (the i-th starting at
+   tasks + i * task_size) using up to max_threads threads, including the
+   calling one, and returns when all are done. Tasks are handed out in
+   order, so longer ones should come first. Without thread support
+   (SADDLESUM_NO_THREADS) the tasks are run in order by the caller. */
+void run_tasks(void (*func) (void *), void *tasks, size_t task_size,
+               size_t num_tasks, int max_threads);
+
+/* Number of threads worth using for loading data */
+int num_worker_threads(void);
+
+#ifdef __cplusplus
+}
+#endif
+#endif /* !_TASKPOOL_H */
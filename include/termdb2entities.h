@@ -39,7 +39,24 @@ extern "C" {
 
 #include <inttypes.h>
 
-/* Basic interface for a collection of mappings from terms to sets of entities */
+/* Offsets into the array of hits. Compile with -DSADDLESUM_LARGE_DB to
+   support more than 2^32-1 term-entity associations in total. */
+#ifdef SADDLESUM_LARGE_DB
+typedef uint64_t TermOffset;
+#define TERM_OFFSET_MAX UINT64_MAX
+#else
+typedef uint32_t TermOffset;
+#define TERM_OFFSET_MAX UINT32_MAX
+#endif
+
+/* Basic interface for a collection of mappings from terms to sets of entities.
+   The mappings are stored in CSR form: hits of the term i are
+   hits[offsets[i]] ... hits[offsets[i+1]-1]. Use TermMappingDb_get_mapping()
+   for reading; reset/get_next_mapping are kept only for compatibility.
+
+   After TermMappingDb_deduplicate(), the CSR spans describe num_sets unique
+   entity sets and term2set maps each term to its set. Before that (or if
+   there were no duplicates), term2set is NULL and sets are terms. */
 struct _TermMappingDb_s;
 
 #define TermMappingDb_HEAD                                              \
@@ -51,17 +68,52 @@ struct _TermMappingDb_s;
         void (*insert_new_mapping) (struct _TermMappingDb_s *);         \
         void (*insert_hit) (struct _TermMappingDb_s *, uint32_t);       \
         uint32_t *hits;                                                 \
-        uint32_t num_hits;                                              \
-        uint32_t max_hits;                                              \
-        uint32_t *offsets;                                              \
+        TermOffset num_hits;                                            \
+        TermOffset max_hits;                                            \
+        TermOffset *offsets;                                            \
         uint32_t max_mappings;                                          \
-        uint32_t current_term;
+        uint32_t current_term;                                          \
+        uint32_t *term2set;                                             \
+        uint32_t num_sets;
 
 typedef struct _TermMappingDb_s {
 	TermMappingDb_HEAD
 } TermMappingDb;
 
 TermMappingDb *TermMappingDb_init(void);
+uint32_t *TermMappingDb_append_mappings(TermMappingDb *mapping_db,
+                                        const uint32_t *counts, uint32_t num_terms);
+void TermMappingDb_deduplicate(TermMappingDb *mapping_db);
+
+/* Index of the entity set of the term with index term_index */
+static inline
+uint32_t TermMappingDb_set_index(const TermMappingDb *mapping_db, uint32_t term_index)
+{
+        return mapping_db->term2set == NULL ? term_index : mapping_db->term2set[term_index];
+}
+
+/* Sets *hits to the first hit of the set with index set_index and returns
+   the number of hits */
+static inline
+uint32_t TermMappingDb_get_set(const TermMappingDb *mapping_db,
+                               uint32_t set_index, const uint32_t **hits)
+{
+        const TermOffset *offsets = mapping_db->offsets + set_index;
+        *hits = mapping_db->hits + offsets[0];
+        return (uint32_t) (offsets[1] - offsets[0]);
+}
+
+/* Stateless access to the hits of the term with index term_index: sets
+   *hits to the first hit and returns their number. Unlike get_next_mapping,
+   it does not touch current_term and can be used by concurrent readers. */
+static inline
+uint32_t TermMappingDb_get_mapping(const TermMappingDb *mapping_db,
+                                   uint32_t term_index, const uint32_t **hits)
+{
+        return TermMappingDb_get_set(mapping_db,
+                                     TermMappingDb_set_index(mapping_db, term_index),
+                                     hits);
+}
 
 
 #ifdef __cplusplus
@@ -91,7 +91,6 @@ void ETDTerm_delete_data(CVTerm *term_)
                 free(term->parents);
                 free(term->edgetypes);
         }
-        free(term);
 }
 
 
@@ -116,6 +115,22 @@ uint32_t ETDTerm_get_parents(CVTerm *term_, CVTerm ***parents,
 }
 
 
+CVTerm *ETDTerm_init(CVTerm *term_)
+{
+        ETDTerm *term = (ETDTerm *) term_;
+        if (term == NULL) {
+                term = calloc_(1, sizeof(ETDTerm));
+                term->delete = ETDTerm_delete_all;
+        }
+        else {
+                term->delete = ETDTerm_delete_data;
+        }
+        term->get_parents = ETDTerm_get_parents;
+        term->print_url = NULL;
+        return (CVTerm *) term;
+}
+
+
 static
 void GOTerm_print_url(CVTerm *term_, PrintBuf *pbuf)
 {
@@ -179,4 +194,13 @@ CVTerm *KEGGTerm_init(CVTerm *term_)
 }
 
 
-
+void CVTermDb_make_all_terms(CVTermDb *term_db)
+{
+        char no_id[1] = "";
+        uint32_t i;
+        for (i=0; i < term_db->num_terms; i++) {
+                (void) term_db->get_term_from_index(term_db, i);
+        }
+        /* any lookup completes the term ID tables */
+        (void) term_db->get_index_from_term_id(term_db, no_id);
+}
@@ -0,0 +1,494 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "miscutils.h"
+#include "dbindex.h"
+
+#define TABLE_MIN_SLOTS 16
+#define TABLE_HASH_MULT 2654435761U  /* spreads keys over the slots */
+
+typedef struct _IntItem_s {
+        uint32_t key;
+        uint32_t value;
+        uint32_t pos;
+} IntItem;
+
+typedef struct _StrItem_s {
+        const char *key;
+        uint32_t size;
+        uint32_t value;
+        uint32_t pos;
+} StrItem;
+
+
+/* Equal keys are ordered by their position in the input, so that the first
+   of them starts its run */
+static
+int IntItem_compare(const void *a_, const void *b_)
+{
+        const IntItem *a = (const IntItem *) a_;
+        const IntItem *b = (const IntItem *) b_;
+        if (a->key != b->key) {
+                return (a->key < b->key) ? -1 : 1;
+        }
+        return (a->pos < b->pos) ? -1 : (a->pos > b->pos);
+}
+
+
+static
+int StrItem_compare(const void *a_, const void *b_)
+{
+        const StrItem *a = (const StrItem *) a_;
+        const StrItem *b = (const StrItem *) b_;
+        int c = strcmp(a->key, b->key);
+        if (c) {
+                return c;
+        }
+        return (a->pos < b->pos) ? -1 : (a->pos > b->pos);
+}
+
+
+static
+char *put_uint32(char *dest, uint32_t x)
+{
+        dest[0] = x & 0xFF;
+        dest[1] = (x >> 8) & 0xFF;
+        dest[2] = (x >> 16) & 0xFF;
+        dest[3] = (x >> 24) & 0xFF;
+        return dest + 4;
+}
+
+
+char *IntIndex_pack(const uint32_t *keys, const uint32_t *values, uint32_t n,
+                    uint32_t *num_keys, uint64_t *size)
+{
+        IntItem *items = malloc_(((size_t) n + 1) * sizeof(IntItem));
+        char *packed;
+        char *cur;
+        uint32_t m;
+        uint32_t i;
+
+        for (i=0; i < n; i++) {
+                items[i].key = keys[i];
+                items[i].value = values[i];
+                items[i].pos = i;
+        }
+        qsort(items, n, sizeof(IntItem), IntItem_compare);
+        for (m=0, i=0; i < n; i++) {
+                if (i > 0 && items[i-1].key == items[i].key) {
+                        continue;
+                }
+                items[m++] = items[i];
+        }
+
+        *num_keys = m;
+        *size = sizeof(uint32_t) * (1 + 2 * (uint64_t) m);
+        packed = malloc_(*size);
+        cur = put_uint32(packed, m);
+        for (i=0; i < m; i++) {
+                cur = put_uint32(cur, items[i].key);
+        }
+        for (i=0; i < m; i++) {
+                cur = put_uint32(cur, items[i].value);
+        }
+        free(items);
+        return packed;
+}
+
+
+char *StrIndex_pack(char **keys, const uint32_t *key_sizes,
+                    const uint32_t *values, uint32_t n,
+                    uint32_t *num_keys, uint64_t *size)
+{
+        StrItem *items = malloc_(((size_t) n + 1) * sizeof(StrItem));
+        uint64_t pool_size = 0;
+        char *packed;
+        char *cur;
+        uint32_t offset;
+        uint32_t m;
+        uint32_t i;
+
+        for (i=0; i < n; i++) {
+                items[i].key = keys[i];
+                items[i].size = (key_sizes == NULL) ? strlen(keys[i]) + 1 : key_sizes[i];
+                items[i].value = values[i];
+                items[i].pos = i;
+        }
+        qsort(items, n, sizeof(StrItem), StrItem_compare);
+        for (m=0, i=0; i < n; i++) {
+                if (i > 0 && !strcmp(items[i-1].key, items[i].key)) {
+                        continue;
+                }
+                pool_size += items[i].size;
+                items[m++] = items[i];
+        }
+        if (pool_size > UINT32_MAX) {
+                fprintf(stderr, "Index keys exceed the maximum size.\n");
+                exit(EXIT_FAILURE);
+        }
+
+        *num_keys = m;
+        *size = sizeof(uint32_t) * (2 + 2 * (uint64_t) m) + pool_size;
+        packed = malloc_(*size);
+        cur = put_uint32(packed, m);
+        for (offset=0, i=0; i < m; i++) {
+                cur = put_uint32(cur, offset);
+                offset += items[i].size;
+        }
+        for (i=0; i < m; i++) {
+                cur = put_uint32(cur, items[i].value);
+        }
+        cur = put_uint32(cur, (uint32_t) pool_size);
+        for (i=0; i < m; i++) {
+                memcpy(cur, items[i].key, items[i].size);
+                cur += items[i].size;
+        }
+        free(items);
+        return packed;
+}
+
+
+IntIndex *IntIndex_load(BinReader *reader)
+{
+        IntIndex *index = malloc_(sizeof(IntIndex));
+        BinReader_read_uint32(reader, &index->num_keys, 1);
+        index->keys = BinReader_uint32_array(reader, index->num_keys);
+        index->values = BinReader_uint32_array(reader, index->num_keys);
+        return index;
+}
+
+
+StrIndex *StrIndex_load(BinReader *reader)
+{
+        StrIndex *index = malloc_(sizeof(StrIndex));
+        uint32_t pool_size;
+        uint32_t i;
+
+        BinReader_read_uint32(reader, &index->num_keys, 1);
+        index->key_offsets = BinReader_uint32_array(reader, index->num_keys);
+        index->values = BinReader_uint32_array(reader, index->num_keys);
+        index->pool = BinReader_buf(reader, &pool_size);
+
+        /* every key must be a terminated string inside the pool */
+        if (index->num_keys > 0
+            && (pool_size == 0 || index->pool[pool_size - 1] != '\0')) {
+                fprintf(stderr, "Invalid database index.\n");
+                exit(EXIT_FAILURE);
+        }
+        for (i=0; i < index->num_keys; i++) {
+                if (index->key_offsets[i] >= pool_size) {
+                        fprintf(stderr, "Invalid database index.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
+        return index;
+}
+
+
+void IntIndex_delete(IntIndex *index, BinReader *reader)
+{
+        if (index == NULL) {
+                return;
+        }
+        BinReader_free(reader, index->keys);
+        BinReader_free(reader, index->values);
+        free(index);
+}
+
+
+void StrIndex_delete(StrIndex *index, BinReader *reader)
+{
+        if (index == NULL) {
+                return;
+        }
+        BinReader_free(reader, index->key_offsets);
+        BinReader_free(reader, index->values);
+        free(index);
+}
+
+
+int IntIndex_search(const IntIndex *index, uint32_t key, uint32_t *value)
+{
+        uint32_t lo = 0;
+        uint32_t hi = index->num_keys;
+        uint32_t mid;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                if (index->keys[mid] < key) {
+                        lo = mid + 1;
+                }
+                else {
+                        hi = mid;
+                }
+        }
+        if (lo < index->num_keys && index->keys[lo] == key) {
+                *value = index->values[lo];
+                return 1;
+        }
+        return 0;
+}
+
+
+/* Returns the stored copy of the key, or NULL if it is not found */
+const char *StrIndex_search(const StrIndex *index, const char *key, uint32_t *value)
+{
+        uint32_t lo = 0;
+        uint32_t hi = index->num_keys;
+        uint32_t mid;
+        const char *cur;
+        int c;
+
+        while (lo < hi) {
+                mid = lo + (hi - lo) / 2;
+                cur = index->pool + index->key_offsets[mid];
+                c = strcmp(cur, key);
+                if (c == 0) {
+                        *value = index->values[mid];
+                        return cur;
+                }
+                if (c < 0) {
+                        lo = mid + 1;
+                }
+                else {
+                        hi = mid;
+                }
+        }
+        return NULL;
+}
+
+
+/* In-memory tables */
+static
+uint32_t table_slot(uint32_t h, uint32_t mask)
+{
+        h *= TABLE_HASH_MULT;
+        return (h ^ (h >> 16)) & mask;
+}
+
+
+static
+uint32_t table_num_slots(uint32_t capacity)
+{
+        uint32_t n = TABLE_MIN_SLOTS;
+        while (n / 2 < capacity) {
+                if (n > UINT32_MAX / 2) {
+                        fprintf(stderr, "Too many keys for a lookup table.\n");
+                        exit(EXIT_FAILURE);
+                }
+                n *= 2;
+        }
+        return n;
+}
+
+
+IntTable *IntTable_init(uint32_t capacity)
+{
+        IntTable *table = malloc_(sizeof(IntTable));
+        uint32_t n = table_num_slots(capacity);
+        table->num_keys = 0;
+        table->mask = n - 1;
+        table->keys = calloc_(n, sizeof(uint32_t));
+        table->values = malloc_(n * sizeof(uint32_t));
+        return table;
+}
+
+
+StrTable *StrTable_init(uint32_t capacity)
+{
+        StrTable *table = malloc_(sizeof(StrTable));
+        uint32_t n = table_num_slots(capacity);
+        table->num_keys = 0;
+        table->mask = n - 1;
+        table->hashes = malloc_(n * sizeof(uint32_t));
+        table->values = malloc_(n * sizeof(uint32_t));
+        table->keys = calloc_(n, sizeof(char *));
+        return table;
+}
+
+
+void IntTable_delete(IntTable *table)
+{
+        if (table == NULL) {
+                return;
+        }
+        free(table->keys);
+        free(table->values);
+        free(table);
+}
+
+
+void StrTable_delete(StrTable *table)
+{
+        if (table == NULL) {
+                return;
+        }
+        free(table->hashes);
+        free(table->values);
+        free(table->keys);
+        free(table);
+}
+
+
+/* Moves all keys into a table with twice as many slots */
+static
+void IntTable_grow(IntTable *table)
+{
+        IntTable *new_table = IntTable_init(table->mask + 1);
+        uint32_t i;
+        for (i=0; i <= table->mask; i++) {
+                if (table->keys[i] != 0) {
+                        IntTable_insert(new_table, table->keys[i], table->values[i]);
+                }
+        }
+        free(table->keys);
+        free(table->values);
+        *table = *new_table;
+        free(new_table);
+}
+
+
+static
+void StrTable_grow(StrTable *table)
+{
+        StrTable *new_table = StrTable_init(table->mask + 1);
+        uint32_t i;
+        for (i=0; i <= table->mask; i++) {
+                if (table->keys[i] != NULL) {
+                        StrTable_insert(new_table, table->keys[i], table->values[i]);
+                }
+        }
+        free(table->hashes);
+        free(table->values);
+        free(table->keys);
+        *table = *new_table;
+        free(new_table);
+}
+
+
+/* Returns 1 if the key was inserted and 0 if it was already present */
+int IntTable_insert(IntTable *table, uint32_t key, uint32_t value)
+{
+        uint32_t i;
+        if (key == 0) {
+                fprintf(stderr, "Invalid key for a lookup table.\n");
+                exit(EXIT_FAILURE);
+        }
+        if (2 * (table->num_keys + 1) > table->mask + 1) {
+                IntTable_grow(table);
+        }
+        i = table_slot(key, table->mask);
+        while (table->keys[i] != 0) {
+                if (table->keys[i] == key) {
+                        return 0;
+                }
+                i = (i + 1) & table->mask;
+        }
+        table->keys[i] = key;
+        table->values[i] = value;
+        table->num_keys++;
+        return 1;
+}
+
+
+int StrTable_insert(StrTable *table, const char *key, uint32_t value)
+{
+        uint32_t h;
+        uint32_t i;
+        if (2 * (table->num_keys + 1) > table->mask + 1) {
+                StrTable_grow(table);
+        }
+        h = hash_from_string((void *) key);
+        i = table_slot(h, table->mask);
+        while (table->keys[i] != NULL) {
+                if (table->hashes[i] == h && !strcmp(table->keys[i], key)) {
+                        return 0;
+                }
+                i = (i + 1) & table->mask;
+        }
+        table->hashes[i] = h;
+        table->values[i] = value;
+        table->keys[i] = key;
+        table->num_keys++;
+        return 1;
+}
+
+
+int IntTable_search(const IntTable *table, uint32_t key, uint32_t *value)
+{
+        uint32_t i = table_slot(key, table->mask);
+        if (key == 0) {
+                return 0;
+        }
+        while (table->keys[i] != 0) {
+                if (table->keys[i] == key) {
+                        *value = table->values[i];
+                        return 1;
+                }
+                i = (i + 1) & table->mask;
+        }
+        return 0;
+}
+
+
+/* Returns the stored key, or NULL if it is not found */
+const char *StrTable_search(const StrTable *table, const char *key, uint32_t *value)
+{
+        uint32_t h = hash_from_string((void *) key);
+        uint32_t i = table_slot(h, table->mask);
+        while (table->keys[i] != NULL) {
+                if (table->hashes[i] == h && !strcmp(table->keys[i], key)) {
+                        *value = table->values[i];
+                        return table->keys[i];
+                }
+                i = (i + 1) & table->mask;
+        }
+        return NULL;
+}
+
+
+/* Replaces each value v by new_index[v] */
+void StrTable_renumber_values(StrTable *table, const uint32_t *new_index)
+{
+        uint32_t i;
+        for (i=0; i <= table->mask; i++) {
+                if (table->keys[i] != NULL) {
+                        table->values[i] = new_index[table->values[i]];
+                }
+        }
+}
@@ -42,11 +42,19 @@
 #include "enrich.h"
 #include "saddlesum.h"
 #include "hypergeom.h"
+#include "taskpool.h"
+#include "platmap.h"
 
-#ifndef WEIGHTS_MAX_FIELD_WIDTH
-#define WEIGHTS_MAX_FIELD_WIDTH 128
+/* Weights files are split into chunks of about this size, which are
+   parsed concurrently */
+#ifndef WEIGHTS_CHUNK_SIZE
+#define WEIGHTS_CHUNK_SIZE (1 << 20)
 #endif
 
+#define BINARY_WEIGHTS_MAGIC "SSWEIGHT"
+#define BINARY_WEIGHTS_MAGIC_LEN 8
+#define BINARY_WEIGHTS_VERSION 1
+
 #define INITIAL_TERM_HITS 16
 
 #ifndef SADDLESUM_MAX_ITERS
@@ -60,6 +68,7 @@
 
 EnrichContext *EnrichContext_init(const char *db_name,
 				  uint32_t min_term_size,
+				  uint32_t max_term_size,
                                   double Evalue_cutoff,
                                   double effective_db_size,
                                   EnrichStats statistics_type,
@@ -74,6 +83,7 @@ EnrichContext *EnrichContext_init(const char *db_name,
         EnrichContext *cntxt = calloc_(1, sizeof(EnrichContext));
         cntxt->db_name = db_name;
         cntxt->min_term_size = min_term_size;
+        cntxt->max_term_size = max_term_size;
         cntxt->Evalue_cutoff = Evalue_cutoff;
         cntxt->effective_db_size = effective_db_size;
         cntxt->statistics_type = statistics_type;
@@ -85,28 +95,25 @@ EnrichContext *EnrichContext_init(const char *db_name,
         cntxt->use_all_weights = use_all_weights;
 	cntxt->term_hits = calloc_(INITIAL_TERM_HITS, sizeof(TermHit));
 	cntxt->max_term_hits = INITIAL_TERM_HITS;
+        cntxt->max_warnings = UINT32_MAX;
+        Arena_init(&cntxt->warning_arena);
         return cntxt;
 }
 
 void EnrichContext_delete(EnrichContext *cntxt)
 {
-        int i;
-        while (cntxt->first_warning != NULL) {
-                cntxt->last_warning = cntxt->first_warning;
-                cntxt->first_warning = cntxt->first_warning->next;
-                free(cntxt->last_warning->msg);
-                free(cntxt->last_warning);
-        }
+        Arena_delete(&cntxt->warning_arena);
         cntxt->first_warning = NULL;
         cntxt->last_warning = NULL;
 
         if (cntxt->weights != NULL) {
-                for (i=0; i < cntxt->num_entities; i++) {
-                        if (cntxt->input_symbols[i] != NULL) {
-                                free(cntxt->input_symbols[i]);
-                        }
-                }
                 free(cntxt->input_symbols);
+                if (cntxt->input_reader != NULL) {
+                        BinReader_release(cntxt->input_reader);
+                        cntxt->input_reader = NULL;
+                }
+                free(cntxt->input_tail);
+                cntxt->input_tail = NULL;
                 free(cntxt->weights);
                 free(cntxt->used_indices);
                 cntxt->weights = NULL;
@@ -116,21 +123,102 @@ void EnrichContext_delete(EnrichContext *cntxt)
                 free(cntxt->term_hits);
                 cntxt->term_hits = NULL;
         }
+        free(cntxt->term_mask);
+        free(cntxt->namespace_mask);
+        free(cntxt->used_sets);
+        free(cntxt->visit_sets);
         free(cntxt);
 }
 
 
+/* Restricts the terms considered by subsequent calls to
+   EnrichResults_calc_pvalues() without reloading the databases. Terms from
+   the excluded namespaces are skipped and, if term_ids is not NULL, only
+   the terms it lists are kept (IDs not present in term_db are ignored), so
+   that an empty list keeps no terms. Skipped terms do not count towards the
+   effective database size. The weights used as the background are those of
+   the entities of all terms in the namespaces not excluded, whether listed
+   or not. */
+void EnrichContext_select_terms(EnrichContext *cntxt, CVTermDb *term_db,
+                                const char **excluded_namespaces, int num_excluded,
+                                char **term_ids, int num_term_ids)
+{
+        const char *namespace;
+        const char *last_namespace = NULL;
+        int excluded = 0;
+        uint32_t i;
+        int term_index;
+        int j;
+
+        free(cntxt->term_mask);
+        free(cntxt->namespace_mask);
+        cntxt->term_mask = NULL;
+        cntxt->namespace_mask = NULL;
+
+        if (num_excluded > 0) {
+                cntxt->namespace_mask = malloc_((term_db->num_terms + 1) * sizeof(uint8_t));
+                /* Terms of a namespace are usually consecutive, so namespace
+                   names are compared with the excluded ones only when they
+                   change */
+                for (i=0; i < term_db->num_terms; i++) {
+                        namespace = term_db->get_namespace_from_index(term_db, i);
+                        if (namespace != last_namespace) {
+                                last_namespace = namespace;
+                                excluded = 0;
+                                for (j=0; namespace != NULL && j < num_excluded; j++) {
+                                        if (!strcmp(namespace, excluded_namespaces[j])) {
+                                                excluded = 1;
+                                                break;
+                                        }
+                                }
+                        }
+                        cntxt->namespace_mask[i] = !excluded;
+                }
+        }
+        if (term_ids == NULL) {
+                if (cntxt->namespace_mask != NULL) {
+                        cntxt->term_mask = malloc_((term_db->num_terms + 1) * sizeof(uint8_t));
+                        memcpy(cntxt->term_mask, cntxt->namespace_mask, term_db->num_terms);
+                }
+                return;
+        }
+
+        cntxt->term_mask = calloc_(term_db->num_terms + 1, sizeof(uint8_t));
+        for (j=0; j < num_term_ids; j++) {
+                term_index = term_db->get_index_from_term_id(term_db, term_ids[j]);
+                if (term_index >= 0 && (cntxt->namespace_mask == NULL
+                                        || cntxt->namespace_mask[term_index])) {
+                        cntxt->term_mask[term_index] = 1;
+                }
+        }
+}
+
+
+/* Warnings are counted in full but only the first max_warnings are kept,
+   in the context arena. Identifiers from the weights file are copied,
+   while conflict aliases stay in the entity database. */
 static
-void EnrichResults_add_warning(EnrichContext *cntxt, EntityWarning *warning)
+void EnrichResults_add_warning(EnrichContext *cntxt, const EntityWarning *warning)
 {
+        EntityWarning *stored;
+
         if (warning != NULL) {
-                if (cntxt->first_warning == NULL) {
-                        cntxt->first_warning = warning;
-                        cntxt->last_warning = warning;
-                }
-                else {
-                        cntxt->last_warning->next = warning;
-                        cntxt->last_warning = warning;
+                if (cntxt->num_warnings < cntxt->max_warnings) {
+                        stored = Arena_alloc(&cntxt->warning_arena, sizeof(EntityWarning));
+                        *stored = *warning;
+                        stored->next = NULL;
+                        if (stored->symbol != stored->aliases) {
+                                stored->symbol = Arena_strdup(&cntxt->warning_arena,
+                                                              stored->symbol);
+                        }
+                        if (cntxt->first_warning == NULL) {
+                                cntxt->first_warning = stored;
+                        }
+                        else {
+                                cntxt->last_warning->next = stored;
+                        }
+                        cntxt->last_warning = stored;
+                        cntxt->num_warnings++;
                 }
                 switch (warning->code) {
                 case UNKNOWN_ID:
@@ -171,11 +259,63 @@ static int TermHit_compare (const void * M1, const void * M2)
 
         if (!retval) {
                 retval = (th1->Evalue > th2->Evalue) - (th1->Evalue < th2->Evalue);
-                retval = retval ? retval : (th1 > th2) - (th1 < th2);
+                retval = retval ? retval : (th1->term_index > th2->term_index) - (th1->term_index < th2->term_index);
         }
         return retval;
 }
 
+static inline
+int term_size_ok(const EnrichContext *cntxt, uint32_t num_used_hits)
+{
+        return num_used_hits >= cntxt->min_term_size
+                && (cntxt->max_term_size == 0 || num_used_hits <= cntxt->max_term_size);
+}
+
+/* Scoring kernels over a single term span. They only read the context and
+   the span, so the compiler can inline them into the term loops. */
+static inline
+double wsum_score(const weight_t *weights, const uint8_t *used_indices,
+                  const uint32_t *hits, uint32_t num_hits, uint32_t *num_used_hits)
+{
+        const uint32_t *end_hits = hits + num_hits;
+        double score = 0.0;
+        uint32_t n = 0;
+        for (; hits < end_hits; hits++) {
+                score += weights[*hits];
+                n += USED_INDEX(used_indices, *hits);
+        }
+        *num_used_hits = n;
+        return score;
+}
+
+static inline
+uint32_t hgem_score(const weight_t *weights, const uint8_t *used_indices,
+                    const uint32_t *hits, uint32_t num_hits, uint32_t *num_used_hits)
+{
+        const uint32_t *end_hits = hits + num_hits;
+        uint32_t k = 0;
+        uint32_t n = 0;
+        for (; hits < end_hits; hits++) {
+                k += (weights[*hits] > 0.0);
+                n += USED_INDEX(used_indices, *hits);
+        }
+        *num_used_hits = n;
+        return k;
+}
+
+static inline
+uint32_t count_used_hits(const uint8_t *used_indices, const uint32_t *hits,
+                         uint32_t num_hits)
+{
+        const uint32_t *end_hits = hits + num_hits;
+        uint32_t n = 0;
+        for (; hits < end_hits; hits++) {
+                n += USED_INDEX(used_indices, *hits);
+        }
+        return n;
+}
+
+
 static void EnrichResults_insert_term_hit(EnrichContext *cntxt, uint32_t term_index,
 					  double score, uint32_t num_entities, double Pvalue)
 {
@@ -193,111 +333,1032 @@ static void EnrichResults_insert_term_hit(EnrichContext *cntxt, uint32_t term_in
 	term_hit->Pvalue = Pvalue;
 }
 
-void EnrichResults_load_weights(EnrichContext *cntxt, const char *weights_filename,
-				EntityDb *entity_db, TermMappingDb *mapping_db)
+/* Per-set results of a scoring pass. Terms sharing an entity set (see
+   TermMappingDb_deduplicate) are scored once and the results are copied to
+   each of them in term order. */
+typedef struct {
+        double *score;
+        double *Pvalue;
+        uint32_t *num_used_hits;
+} SetScores;
+
+static void SetScores_init(SetScores *set_scores, uint32_t num_sets)
 {
+        set_scores->score = malloc_((num_sets + 1) * sizeof(double));
+        set_scores->Pvalue = malloc_((num_sets + 1) * sizeof(double));
+        set_scores->num_used_hits = malloc_((num_sets + 1) * sizeof(uint32_t));
+}
 
-	unsigned int line_num = 1;
-        uint32_t entity_index;
-        double wght;
+static void SetScores_insert_term_hits(EnrichContext *cntxt, TermMappingDb *mapping_db,
+                                       SetScores *set_scores)
+{
+        uint32_t term_index;
+        uint32_t set_index;
+
+        for (term_index=0; term_index < mapping_db->num_mappings; term_index++) {
+                set_index = TermMappingDb_set_index(mapping_db, term_index);
+                if (!cntxt->used_sets[set_index]
+                    || (cntxt->term_mask != NULL && !cntxt->term_mask[term_index])) {
+                        continue;
+                }
+                if (set_scores->Pvalue[set_index] <= cntxt->Pvalue_cutoff) {
+                        EnrichResults_insert_term_hit(cntxt, term_index,
+                                                      set_scores->score[set_index],
+                                                      set_scores->num_used_hits[set_index],
+                                                      set_scores->Pvalue[set_index]);
+                }
+        }
+        free(set_scores->score);
+        free(set_scores->Pvalue);
+        free(set_scores->num_used_hits);
+}
+
+
+/* Sets selected_sets[i] to 1 for entity sets of terms in the namespaces
+   not excluded, 0 otherwise. A term list does not restrict them, so that
+   it does not change the background of the terms it keeps. */
+static void EnrichResults_select_sets(EnrichContext *cntxt, TermMappingDb *mapping_db,
+                                      uint8_t *selected_sets)
+{
+        uint32_t term_index;
+
+        if (cntxt->namespace_mask == NULL) {
+                memset(selected_sets, 1, mapping_db->num_sets);
+                return;
+        }
+        memset(selected_sets, 0, mapping_db->num_sets);
+        for (term_index=0; term_index < mapping_db->num_mappings; term_index++) {
+                if (cntxt->namespace_mask[term_index]) {
+                        selected_sets[TermMappingDb_set_index(mapping_db, term_index)] = 1;
+                }
+        }
+}
+
+
+/* A part of a weights file consisting of whole lines. Lines with fields
+   are parsed and their symbols mapped to entities independently of other
+   chunks. Blank lines are skipped and not counted. Symbols are kept as
+   offsets from the start of the chunk, since the file image is retained
+   anyway. The code of each line is 0 if its symbol raised no warning and
+   the warning code plus one otherwise; only conflicts, which carry
+   aliases, keep their warnings, in line order. Symbols are mapped while
+   parsing only if the entity database is already known. Lines of a
+   weights matrix hold num_fields weights, of which the selected
+   num_columns are stored for each line. */
+typedef struct _WeightsChunk_s {
+        char *start;
+        char *end;  /* just past the last newline */
+        EntityDb *entity_db;
+        uint32_t num_fields;
+        uint32_t num_columns;
+        const int32_t *field_columns;  /* NULL for a single weight */
+        uint64_t *row_hashes;  /* for platform maps */
+        uint32_t num_lines;
+        uint32_t max_lines;
+        uint32_t *symbols;
+        weight_t *weights;
+        uint32_t *indices;
+        uint8_t *codes;
+        uint32_t num_warnings;
+        uint32_t max_warnings;
+        EntityWarning *warnings;
+        int error_field;  /* format error on the line after the parsed ones */
+        char *bad_weight;
+} WeightsChunk;
+
+
+static
+void WeightsChunk_delete(WeightsChunk *chunk)
+{
+        free(chunk->symbols);
+        free(chunk->weights);
+        free(chunk->indices);
+        free(chunk->codes);
+        free(chunk->warnings);
+        free(chunk->row_hashes);
+}
+
+
+/* Room for the next warning, which is kept by incrementing num_warnings */
+static
+EntityWarning *WeightsChunk_next_warning(WeightsChunk *chunk)
+{
+        if (chunk->num_warnings >= chunk->max_warnings) {
+                chunk->max_warnings = 2 * chunk->max_warnings + 64;
+                chunk->warnings = realloc_(chunk->warnings,
+                                           chunk->max_warnings * sizeof(EntityWarning));
+        }
+        return chunk->warnings + chunk->num_warnings;
+}
+
+
+#define WeightsChunk_symbol(chunk, k) ((chunk)->start + (chunk)->symbols[k])
+
+
+static
+void WeightsChunk_map_line(WeightsChunk *chunk, uint32_t k)
+{
+        EntityDb *entity_db = chunk->entity_db;
+        EntityWarning warning;
+
+        if (entity_db->map_symbol(entity_db, WeightsChunk_symbol(chunk, k),
+                                  chunk->indices + k, &warning)) {
+                chunk->codes[k] = warning.code + 1;
+                if (warning.code != UNKNOWN_ID) {
+                        *WeightsChunk_next_warning(chunk) = warning;
+                        chunk->num_warnings++;
+                }
+        }
+        else {
+                chunk->codes[k] = 0;
+        }
+}
+
+
+static
+void WeightsChunk_map(void *chunk_)
+{
+        WeightsChunk *chunk = (WeightsChunk *) chunk_;
+        uint32_t k;
+
+        for (k=0; k < chunk->num_lines; k++) {
+                WeightsChunk_map_line(chunk, k);
+        }
+}
+
+
+static
+void WeightsChunk_hash(void *chunk_)
+{
+        WeightsChunk *chunk = (WeightsChunk *) chunk_;
+        uint32_t k;
+
+        chunk->row_hashes = malloc_((chunk->num_lines + 1) * sizeof(uint64_t));
+        for (k=0; k < chunk->num_lines; k++) {
+                chunk->row_hashes[k] = fnv64_update(FNV64_OFFSET,
+                                                    WeightsChunk_symbol(chunk, k),
+                                                    strlen(WeightsChunk_symbol(chunk, k)));
+        }
+}
+
+
+/* Parses the weight fields of line k after its symbol into the selected
+   columns. Returns 0 on a format error, which is recorded in the chunk.
+   Matrix weights given as NA are missing and stored as NaN.
+
+   Fields are numbered from 1 for the symbol, so that weight f is field
+   f + 2. As for two-column files before, a line that ends early is
+   reported at its last field (#1 for a symbol alone) and a line with
+   extra fields at its last weight (#2 for one weight). */
+static
+int WeightsChunk_parse_fields(WeightsChunk *chunk, uint32_t k, char *cur, char *eol)
+{
+        weight_t *values = chunk->weights + (size_t) k * chunk->num_columns;
+        char *weight;
         char *endptr;
-        char buf1[WEIGHTS_MAX_FIELD_WIDTH];
-        char buf2[WEIGHTS_MAX_FIELD_WIDTH];
+        int32_t column = 0;
+        uint32_t field;
+        uint32_t f;
+
+        for (f=0; f < chunk->num_fields; f++) {
+                field = f + 2;
+                if (cur == NULL) {
+                        chunk->error_field = field - 1;
+                        return 0;
+                }
+                weight = SSFile_split_field(&cur, eol);
+                if (f + 1 == chunk->num_fields && cur != NULL) {
+                        chunk->error_field = field;
+                        return 0;
+                }
+                if (chunk->field_columns != NULL) {
+                        column = chunk->field_columns[f];
+                        if (column < 0) {
+                                continue;
+                        }
+                }
+                values[column] = FSFile_strtod(weight, &endptr);
+                if (*endptr != '\0') {
+                        if (chunk->field_columns != NULL && !strcmp(weight, "NA")) {
+                                values[column] = NAN;
+                                continue;
+                        }
+                        chunk->error_field = field;
+                        chunk->bad_weight = weight;
+                        return 0;
+                }
+        }
+        return 1;
+}
+
+
+/* Parsing stops at the first format error. The symbols and weights are
+   terminated in place. */
+static
+void WeightsChunk_parse(void *chunk_)
+{
+        WeightsChunk *chunk = (WeightsChunk *) chunk_;
+        char *line;
+        char *eol;
+        char *cur;
+        char *symbol;
+        uint32_t k;
+
+        for (line=chunk->start; line < chunk->end; line=eol+1) {
+                eol = memchr(line, '\n', chunk->end - line);
+                cur = line;
+                symbol = SSFile_split_field(&cur, eol);
+                if (symbol == NULL) {
+                        continue;
+                }
+
+                if (chunk->num_lines >= chunk->max_lines) {
+                        chunk->max_lines = 2 * chunk->max_lines + 1024;
+                        chunk->symbols = realloc_(chunk->symbols,
+                                                  chunk->max_lines * sizeof(uint32_t));
+                        chunk->weights = realloc_(chunk->weights, (size_t) chunk->max_lines
+                                                  * chunk->num_columns * sizeof(weight_t));
+                        chunk->indices = realloc_(chunk->indices,
+                                                  chunk->max_lines * sizeof(uint32_t));
+                        chunk->codes = realloc_(chunk->codes,
+                                                chunk->max_lines * sizeof(uint8_t));
+                }
+                k = chunk->num_lines;
+                if (!WeightsChunk_parse_fields(chunk, k, cur, eol)) {
+                        break;
+                }
+                chunk->symbols[k] = symbol - chunk->start;
+                if (chunk->entity_db != NULL) {
+                        WeightsChunk_map_line(chunk, k);
+                }
+                chunk->num_lines++;
+        }
+}
+
+
+/* Splits the file image into chunks at line boundaries. If the last line
+   has no newline, it is copied into tail with one added, so that every
+   chunk ends with a newline. */
+static
+WeightsChunk *split_weights(char *data, size_t size, EntityDb *entity_db,
+                            char **tail, uint32_t *num_chunks)
+{
+        WeightsChunk *chunks = calloc_(size / WEIGHTS_CHUNK_SIZE + 2,
+                                       sizeof(WeightsChunk));
+        char *start = data;
+        char *end = data + size;
+        char *next;
+        size_t n;
+
+        *tail = NULL;
+        *num_chunks = 0;
+        while (end > data && end[-1] != '\n') {
+                end--;
+        }
+        while (start < end) {
+                next = end;
+                if ((size_t) (end - start) > WEIGHTS_CHUNK_SIZE) {
+                        next = (char *) memchr(start + WEIGHTS_CHUNK_SIZE - 1, '\n',
+                                               end - (start + WEIGHTS_CHUNK_SIZE - 1)) + 1;
+                }
+                chunks[*num_chunks].start = start;
+                chunks[(*num_chunks)++].end = next;
+                start = next;
+        }
+        if (end < data + size) {
+                n = data + size - end;
+                *tail = malloc_(n + 1);
+                memcpy(*tail, end, n);
+                (*tail)[n] = '\n';
+                chunks[*num_chunks].start = *tail;
+                chunks[(*num_chunks)++].end = *tail + n + 1;
+        }
+        for (n=0; n < *num_chunks; n++) {
+                chunks[n].entity_db = entity_db;
+        }
+        return chunks;
+}
+
+
+/* Sets the entities and warnings of all parsed rows from the platform map
+   of their symbols, or maps the symbols and saves a new platform map. The
+   map is keyed by the gene fingerprint, so it applies only to databases
+   whose genes all come from an ETD file. Only unknown identifiers are
+   warned about without a lookup; conflicts are looked up again to find
+   their aliases. */
+static
+void EnrichResults_map_platform(EnrichContext *cntxt, WeightsChunk *chunks,
+                                uint32_t num_chunks, EntityDb *entity_db)
+{
+        PlatformMap *map;
+        WeightsChunk *chunk;
+        uint64_t rows_hash = FNV64_OFFSET;
+        uint32_t num_rows = 0;
+        uint32_t *file_index;
+        uint32_t gene;
+        uint32_t c;
+        uint32_t k;
+        uint32_t r;
+
+        run_tasks(WeightsChunk_hash, chunks, sizeof(WeightsChunk), num_chunks,
+                  num_worker_threads());
+        for (c=0; c < num_chunks; c++) {
+                chunk = chunks + c;
+                if (chunk->error_field) {
+                        /* The file is rejected when the rows are merged */
+                        run_tasks(WeightsChunk_map, chunks, sizeof(WeightsChunk), num_chunks,
+                                  num_worker_threads());
+                        return;
+                }
+                for (k=0; k < chunk->num_lines; k++) {
+                        rows_hash = PlatformMap_hash_row(rows_hash, chunk->row_hashes[k]);
+                }
+                num_rows += chunk->num_lines;
+        }
+
+        map = PlatformMap_read(cntxt->platform_map_file, num_rows, entity_db->fingerprint,
+                               rows_hash, entity_db->num_loaded);
+        if (map != NULL) {
+                r = 0;
+                for (c=0; c < num_chunks; c++) {
+                        chunk = chunks + c;
+                        for (k=0; k < chunk->num_lines; k++, r++) {
+                                if (map->codes[r] == 0) {
+                                        chunk->codes[k] = 0;
+                                        chunk->indices[k] = entity_db->loaded_index(entity_db,
+                                                                                    map->genes[r]);
+                                }
+                                else if (map->codes[r] == UNKNOWN_ID + 1) {
+                                        chunk->codes[k] = UNKNOWN_ID + 1;
+                                }
+                                else {
+                                        WeightsChunk_map_line(chunk, k);
+                                }
+                        }
+                }
+                PlatformMap_delete(map);
+                return;
+        }
+
+        run_tasks(WeightsChunk_map, chunks, sizeof(WeightsChunk), num_chunks,
+                  num_worker_threads());
+        file_index = malloc_((entity_db->num_entities + 1) * sizeof(uint32_t));
+        for (gene=0; gene < entity_db->num_loaded; gene++) {
+                file_index[entity_db->loaded_index(entity_db, gene)] = gene;
+        }
+        map = PlatformMap_init(num_rows, entity_db->fingerprint, rows_hash);
+        r = 0;
+        for (c=0; c < num_chunks; c++) {
+                chunk = chunks + c;
+                for (k=0; k < chunk->num_lines; k++, r++) {
+                        map->codes[r] = chunk->codes[k];
+                        map->genes[r] = PLATFORM_MAP_NONE;
+                        if (chunk->codes[k] == 0
+                            || chunk->codes[k] == RESOLVABLE_CONFLICT + 1) {
+                                map->genes[r] = file_index[chunk->indices[k]];
+                        }
+                }
+        }
+        if (!PlatformMap_write(map, cntxt->platform_map_file)) {
+                fprintf(stderr, "Warning: Could not write platform map %s.\n",
+                        cntxt->platform_map_file);
+        }
+        PlatformMap_delete(map);
+        free(file_index);
+}
+
+
+/* Platform maps are keyed by the gene fingerprint, so they apply only to
+   databases whose genes all come from an ETD file */
+static
+int EnrichContext_uses_platform_map(const EnrichContext *cntxt, const EntityDb *entity_db)
+{
+        return (cntxt->platform_map_file != NULL && entity_db->fingerprint != 0
+                && entity_db->num_entities == entity_db->num_loaded);
+}
+
+
+static
+void EnrichMatrix_add_row(EnrichMatrix *matrix, uint32_t entity_index,
+                          const char *symbol, uint32_t line,
+                          const EntityWarning *warning, const weight_t *values)
+{
+        uint32_t r = matrix->num_rows;
+
+        if (r >= matrix->max_rows) {
+                matrix->max_rows = 2 * matrix->max_rows + 1024;
+                matrix->row_entities = realloc_(matrix->row_entities,
+                                                matrix->max_rows * sizeof(uint32_t));
+                matrix->row_symbols = realloc_(matrix->row_symbols,
+                                               matrix->max_rows * sizeof(char *));
+                matrix->row_lines = realloc_(matrix->row_lines,
+                                             matrix->max_rows * sizeof(uint32_t));
+                matrix->row_warned = realloc_(matrix->row_warned,
+                                              matrix->max_rows * sizeof(uint8_t));
+                matrix->values = realloc_(matrix->values, (size_t) matrix->max_rows
+                                          * matrix->num_columns * sizeof(weight_t));
+        }
+        matrix->row_entities[r] = entity_index;
+        matrix->row_symbols[r] = symbol;
+        matrix->row_lines[r] = line;
+        matrix->row_warned[r] = (warning != NULL);
+        memcpy(matrix->values + (size_t) r * matrix->num_columns, values,
+               matrix->num_columns * sizeof(weight_t));
+        matrix->num_rows++;
+
+        if (warning == NULL) {
+                return;
+        }
+        if (matrix->num_warnings >= matrix->max_warnings) {
+                matrix->max_warnings = 2 * matrix->max_warnings + 64;
+                matrix->warnings = realloc_(matrix->warnings, matrix->max_warnings
+                                            * sizeof(EntityWarning));
+        }
+        matrix->warnings[matrix->num_warnings++] = *warning;
+}
 
-        PrintBuf *pbuf = PrintBuf_init(NULL);;
-	FSFile_proc_code_type retcode;
+
+/* Symbols not mapped while parsing are looked up in parallel once the
+   entity database is known, which is safe because map_symbol does not
+   modify it. The results are then taken in the order of the file, so that
+   the warnings and duplicates are the same as when reading it line by
+   line. The weights of a matrix are added to it, while the context only
+   marks the entities taken by its rows. */
+static
+void EnrichResults_merge_weights(EnrichContext *cntxt, EnrichWeights *weights,
+                                 EntityDb *entity_db, const uint8_t *mapped_indices,
+                                 EnrichMatrix *matrix)
+{
+	unsigned int line_num = weights->first_line;
+        uint32_t entity_index;
+        EntityWarning duplicate;
+        EntityWarning unknown;
         EntityWarning *warning;
+        WeightsChunk *chunks = weights->chunks;
+        WeightsChunk *chunk;
+        uint32_t num_chunks = weights->num_chunks;
+        const weight_t *values;
+        int usable;
+        int duplicated;
+        uint32_t c;
+        uint32_t k;
+        uint32_t w;
+        uint32_t j;
 
-	FILE *fp = stdin;
+        if (!weights->mapped) {
+                for (c=0; c < num_chunks; c++) {
+                        chunks[c].entity_db = entity_db;
+                }
+                if (EnrichContext_uses_platform_map(cntxt, entity_db)) {
+                        EnrichResults_map_platform(cntxt, chunks, num_chunks, entity_db);
+                }
+                else {
+                        run_tasks(WeightsChunk_map, chunks, sizeof(WeightsChunk), num_chunks,
+                                  num_worker_threads());
+                }
+        }
+
+        memset(&duplicate, 0, sizeof(EntityWarning));
+        duplicate.code = DUPLICATE_ID;
+        memset(&unknown, 0, sizeof(EntityWarning));
+        unknown.code = UNKNOWN_ID;
+        for (c=0; c < num_chunks; c++) {
+                chunk = chunks + c;
+                for (k=0, w=0; k < chunk->num_lines; k++) {
+                        warning = NULL;
+                        if (chunk->codes[k] == UNKNOWN_ID + 1) {
+                                unknown.symbol = WeightsChunk_symbol(chunk, k);
+                                warning = &unknown;
+                        }
+                        else if (chunk->codes[k]) {
+                                warning = chunk->warnings + w++;
+                        }
+                        entity_index = chunk->indices[k];
+                        EnrichResults_add_warning(cntxt, warning);
+
+                        usable = 0;
+                        if (warning == NULL || warning->code == RESOLVABLE_CONFLICT) {
+
+                                duplicated = USED_INDEX(cntxt->used_indices, entity_index);
+                                if (duplicated) {
+                                        duplicate.symbol = WeightsChunk_symbol(chunk, k);
+                                        duplicate.line = line_num;
+                                        EnrichResults_add_warning(cntxt, &duplicate);
+                                }
+                                usable = mapped_indices[entity_index];
+                                if (!duplicated && usable) {
+                                        if (matrix == NULL) {
+                                                cntxt->weights[entity_index] = chunk->weights[k];
+                                        }
+                                        SET_USED_INDEX(cntxt->used_indices, entity_index);
+                                        cntxt->num_valid_ids++;
+                                        cntxt->input_symbols[entity_index] =
+                                                WeightsChunk_symbol(chunk, k);
+                                }
+                        }
+
+                        /* A matrix keeps repeated rows, since a column may be
+                           missing from the first one, and warned rows, since
+                           their warnings apply only to the columns they have.
+                           Duplicates are found for each column. */
+                        if (matrix != NULL) {
+                                values = chunk->weights + (size_t) k * chunk->num_columns;
+                                if (usable || warning != NULL) {
+                                        EnrichMatrix_add_row(matrix, usable ? entity_index
+                                                             : MATRIX_NO_ENTITY,
+                                                             WeightsChunk_symbol(chunk, k),
+                                                             line_num, warning, values);
+                                }
+                                for (j=0; j < chunk->num_columns; j++) {
+                                        if (values[j] == values[j]) {
+                                                matrix->num_raw_weights[j]++;
+                                        }
+                                }
+                        }
+
+                        line_num++;
+                        cntxt->num_raw_weights++;
+                }
+                if (chunk->bad_weight != NULL) {
+			fprintf(stderr, "Invalid weight %s (line %d, field #%d).\n",
+				chunk->bad_weight, line_num, chunk->error_field);
+			exit(EXIT_FAILURE);
+                }
+                if (chunk->error_field) {
+			fprintf(stderr, "Invalid weight file format (line %d, field #%d).\n",
+				line_num, chunk->error_field);
+			exit(EXIT_FAILURE);
+                }
+                WeightsChunk_delete(chunk);
+        }
+        free(chunks);
+        cntxt->input_tail = weights->tail;
+        weights->chunks = NULL;
+        weights->tail = NULL;
+}
 
-        uint8_t *mapped_indices;
-	uint32_t term_index;
-	uint32_t *hits;
-	uint32_t *end_hits;
-	uint32_t num_hits;
 
+/* Binary weights files hold a weight for each gene of an ETD database, in
+   the order of the database file, and a bitmap of the genes that have
+   one. They are accepted only for the database they were written for, as
+   identified by the fingerprint of its genes. Symbols are not looked up,
+   so no warnings arise. */
+static
+void EnrichResults_read_binary_weights(EnrichContext *cntxt, BinReader *reader,
+                                       const char *weights_filename,
+                                       EntityDb *entity_db,
+                                       const uint8_t *mapped_indices)
+{
+        uint32_t version;
+        uint32_t value_size;
+        uint64_t fingerprint;
+        uint32_t n;
+        double *weights;
+        float *values;
+        uint8_t *used;
+        uint32_t entity_index;
+        uint32_t i;
+        Entity *entity;
+
+        BinReader_skip(reader, 8);
+        BinReader_read_uint32(reader, &version, 1);
+        BinReader_read_uint32(reader, &value_size, 1);
+        BinReader_read_uint64(reader, &fingerprint, 1);
+        BinReader_read_uint32(reader, &n, 1);
+        BinReader_skip(reader, sizeof(uint32_t));
+        if (version != BINARY_WEIGHTS_VERSION || (value_size != sizeof(double)
+                                                 && value_size != sizeof(float))) {
+                fprintf(stderr, "Invalid binary weights file %s.\n", weights_filename);
+                exit(EXIT_FAILURE);
+        }
+        if (entity_db->fingerprint == 0) {
+                fprintf(stderr, "Binary weights file %s requires an ETD database.\n",
+                        weights_filename);
+                exit(EXIT_FAILURE);
+        }
+        if (fingerprint != entity_db->fingerprint || n != entity_db->num_loaded) {
+                fprintf(stderr, "Binary weights file %s was not made for this"
+                        " database (gene fingerprint %016" PRIx64 ", expected %016"
+                        PRIx64 ").\n", weights_filename, fingerprint,
+                        entity_db->fingerprint);
+                exit(EXIT_FAILURE);
+        }
 
-        if (strcmp(weights_filename, "-")) {
-                fp = fopen(weights_filename, "r");
-                if (fp == NULL) {
-                        fprintf(stderr, "Could not open file %s.", weights_filename);
+        weights = malloc_(((size_t) n + 1) * sizeof(double));
+        if (value_size == sizeof(double)) {
+                BinReader_read_double(reader, weights, n);
+        }
+        else {
+                values = malloc_(((size_t) n + 1) * sizeof(float));
+                BinReader_read_float(reader, values, n);
+                for (i=0; i < n; i++) {
+                        weights[i] = values[i];
+                }
+                free(values);
+        }
+        used = malloc_((size_t) n / 8 + 1);
+        BinReader_read(reader, used, ((size_t) n + 7) / 8);
+
+        for (i=0; i < n; i++) {
+                if (!(used[i >> 3] & (1 << (i & 7)))) {
+                        continue;
+                }
+                cntxt->num_raw_weights++;
+                entity_index = entity_db->loaded_index(entity_db, i);
+                if (!mapped_indices[entity_index]) {
+                        continue;
+                }
+                cntxt->weights[entity_index] = weights[i];
+                SET_USED_INDEX(cntxt->used_indices, entity_index);
+                cntxt->num_valid_ids++;
+                entity = entity_db->get_entity_from_index(entity_db, entity_index);
+                cntxt->input_symbols[entity_index] = entity->symbol;
+                entity->delete(entity);
+        }
+        free(weights);
+        free(used);
+}
+
+
+/* Number of fields of the line ending at eol, without terminating them */
+static
+uint32_t count_fields(const char *line, const char *eol)
+{
+        char *copy = malloc_(eol - line + 1);
+        char *cur = copy;
+        uint32_t n = 0;
+
+        memcpy(copy, line, eol - line);
+        while (cur != NULL && SSFile_split_field(&cur, copy + (eol - line)) != NULL) {
+                n++;
+        }
+        free(copy);
+        return n;
+}
+
+
+/* Next line with fields at or after line, or NULL */
+static
+char *next_nonblank_line(char *line, char *end, char **eol)
+{
+        for (; line < end; line=*eol+1) {
+                *eol = memchr(line, '\n', end - line);
+                if (*eol == NULL) {
+                        *eol = end;
+                }
+                if (count_fields(line, *eol) > 0) {
+                        return line;
+                }
+        }
+        return NULL;
+}
+
+
+/* Reads the header of a weights matrix and selects the columns to parse,
+   all of them if none are given. The header names the weight columns,
+   optionally after a label for the symbols, which is recognized by
+   having as many fields as the first row. Returns the start of the
+   rows. */
+static
+char *EnrichWeights_parse_header(EnrichWeights *weights, const char **columns,
+                                 uint32_t num_columns)
+{
+        char *data = weights->reader->data;
+        char *end = data + weights->reader->size;
+        char *header;
+        char *header_eol;
+        char *row;
+        char *row_eol;
+        char *cur;
+        char **names;
+        uint32_t num_names;
+        uint32_t num_row_fields;
+        uint32_t f;
+        uint32_t j;
+
+        header = next_nonblank_line(data, end, &header_eol);
+        row = (header == NULL || header_eol == end) ? NULL
+                : next_nonblank_line(header_eol + 1, end, &row_eol);
+        if (row == NULL) {
+                fprintf(stderr, "Weights matrix %s has no rows.\n", weights->filename);
+                exit(EXIT_FAILURE);
+        }
+        num_names = count_fields(header, header_eol);
+        num_row_fields = count_fields(row, row_eol);
+        if (num_row_fields < 2 || (num_row_fields != num_names
+                                   && num_row_fields != num_names + 1)) {
+                fprintf(stderr, "The header of weights matrix %s does not match its"
+                        " first row.\n", weights->filename);
+                exit(EXIT_FAILURE);
+        }
+
+        names = malloc_((num_names + 1) * sizeof(char *));
+        cur = header;
+        for (f=0; f < num_names; f++) {
+                names[f] = SSFile_split_field(&cur, header_eol);
+        }
+        weights->num_fields = num_row_fields - 1;
+        if (num_row_fields == num_names) {
+                memmove(names, names + 1, weights->num_fields * sizeof(char *));
+        }
+
+        weights->field_columns = malloc_(weights->num_fields * sizeof(int32_t));
+        if (num_columns == 0) {
+                for (f=0; f < weights->num_fields; f++) {
+                        weights->field_columns[f] = f;
+                }
+                weights->num_columns = weights->num_fields;
+                weights->column_names = names;
+                return header_eol + 1;
+        }
+        weights->column_names = malloc_(num_columns * sizeof(char *));
+        for (f=0; f < weights->num_fields; f++) {
+                weights->field_columns[f] = -1;
+        }
+        for (j=0; j < num_columns; j++) {
+                for (f=0; f < weights->num_fields && strcmp(names[f], columns[j]); f++)
+                        ;
+                if (f == weights->num_fields) {
+                        fprintf(stderr, "Column %s not found in weights matrix %s.\n",
+                                columns[j], weights->filename);
                         exit(EXIT_FAILURE);
                 }
+                if (weights->field_columns[f] >= 0) {
+                        fprintf(stderr, "Column %s selected more than once.\n", columns[j]);
+                        exit(EXIT_FAILURE);
+                }
+                weights->field_columns[f] = j;
+                weights->column_names[j] = names[f];
+        }
+        weights->num_columns = num_columns;
+        free(names);
+        return header_eol + 1;
+}
+
+
+static
+EnrichWeights *EnrichWeights_parse(const char *weights_filename, EntityDb *entity_db,
+                                   uint8_t matrix, const char **columns,
+                                   uint32_t num_columns)
+{
+        EnrichWeights *weights = calloc_(1, sizeof(EnrichWeights));
+        BinReader *reader = BinReader_open(weights_filename);
+        char *rows;
+        uint32_t c;
+
+        weights->filename = weights_filename;
+        weights->reader = reader;
+        weights->matrix = matrix;
+        weights->num_fields = 1;
+        weights->num_columns = 1;
+        weights->first_line = 1;
+        if (reader == NULL) {
+                return weights;
+        }
+        if (reader->size >= BINARY_WEIGHTS_MAGIC_LEN
+            && !memcmp(reader->data, BINARY_WEIGHTS_MAGIC, BINARY_WEIGHTS_MAGIC_LEN)) {
+                weights->binary = 1;
+                return weights;
+        }
+        rows = reader->data;
+        if (matrix) {
+                rows = EnrichWeights_parse_header(weights, columns, num_columns);
+                weights->first_line = 2;
+        }
+        weights->mapped = (entity_db != NULL);
+        weights->chunks = split_weights(rows, reader->data + reader->size - rows, entity_db,
+                                        &weights->tail, &weights->num_chunks);
+        for (c=0; c < weights->num_chunks; c++) {
+                weights->chunks[c].num_fields = weights->num_fields;
+                weights->chunks[c].num_columns = weights->num_columns;
+                weights->chunks[c].field_columns = weights->field_columns;
+        }
+        run_tasks(WeightsChunk_parse, weights->chunks, sizeof(WeightsChunk),
+                  weights->num_chunks, num_worker_threads());
+        return weights;
+}
+
+
+/* The weights file is read as a whole (mapped into memory where possible).
+   Text files are parsed in chunks on several threads; binary files are
+   recognized by their magic string. Errors are reported only when the
+   weights are set. */
+EnrichWeights *EnrichWeights_read(const char *weights_filename)
+{
+        return EnrichWeights_parse(weights_filename, NULL, 0, NULL, 0);
+}
+
+
+/* Reads the given columns of a weights matrix, or all columns if
+   num_columns is 0. Errors in the header are reported immediately. */
+EnrichWeights *EnrichWeights_read_matrix(const char *weights_filename,
+                                         const char **columns, uint32_t num_columns)
+{
+        return EnrichWeights_parse(weights_filename, NULL, 1, columns, num_columns);
+}
+
+
+static
+void EnrichResults_map_weights(EnrichContext *cntxt, EnrichWeights *weights,
+                               EntityDb *entity_db, TermMappingDb *mapping_db,
+                               EnrichMatrix *matrix)
+{
+        uint8_t *mapped_indices;
+        uint8_t *selected_sets;
+	uint32_t set_index;
+	const uint32_t *hits;
+	const uint32_t *end_hits;
+	uint32_t num_hits;
+
+
+        if (weights->reader == NULL) {
+                fprintf(stderr, "Could not open file %s.", weights->filename);
+                exit(EXIT_FAILURE);
         }
 
         cntxt->num_entities = entity_db->num_entities;
-        cntxt->weights = calloc_(entity_db->num_entities, sizeof(double));
-        cntxt->used_indices = calloc_(entity_db->num_entities, sizeof(uint8_t));
+        cntxt->weights = calloc_(entity_db->num_entities, sizeof(weight_t));
+        cntxt->used_indices = calloc_(entity_db->num_entities / 8 + 1, sizeof(uint8_t));
         cntxt->input_symbols = calloc_(entity_db->num_entities, sizeof(char *));
 
         /* For background, we either use all reckognised weights or only those */
         /* weights that have hits mapping onto them. */
         mapped_indices = malloc_(entity_db->num_entities * sizeof(uint8_t));
-        mapping_db->reset(mapping_db);
         if (cntxt->use_all_weights) {
                 memset(mapped_indices, 1, entity_db->num_entities);
         }
         else {
                 memset(mapped_indices, 0, entity_db->num_entities);
-                while (mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits)) {
+                selected_sets = malloc_((mapping_db->num_sets + 1) * sizeof(uint8_t));
+                EnrichResults_select_sets(cntxt, mapping_db, selected_sets);
+                for (set_index=0; set_index < mapping_db->num_sets; set_index++) {
+                        if (!selected_sets[set_index]) {
+                                continue;
+                        }
+                        num_hits = TermMappingDb_get_set(mapping_db, set_index, &hits);
                         for (end_hits=hits+num_hits; hits < end_hits; hits++) {
                                 mapped_indices[*hits] = 1;
                         }
                 }
+                free(selected_sets);
+        }
+
+        if (weights->binary) {
+                EnrichResults_read_binary_weights(cntxt, weights->reader, weights->filename,
+                                                  entity_db, mapped_indices);
+        }
+        else {
+                EnrichResults_merge_weights(cntxt, weights, entity_db, mapped_indices,
+                                            matrix);
         }
+        free(mapped_indices);
+        if (weights->binary) {
+                BinReader_release(weights->reader);
+        }
+        else {
+                cntxt->input_reader = weights->reader;
+        }
+        free(weights->field_columns);
+        free(weights->column_names);
+        free(weights);
+        cntxt->num_unused_entities = cntxt->num_entities - cntxt->num_valid_ids;
+}
 
-	while (END_OF_FILE != (retcode = SSFile_next_field(fp, buf1, WEIGHTS_MAX_FIELD_WIDTH))) {
 
- 		if (retcode != END_OF_FIELD) {
-			fprintf(stderr, "Invalid weight file format (line %d, field #1).\n",
-				line_num);
-			exit(EXIT_FAILURE);
-		}
+void EnrichResults_set_weights(EnrichContext *cntxt, EnrichWeights *weights,
+                               EntityDb *entity_db, TermMappingDb *mapping_db)
+{
+        EnrichResults_map_weights(cntxt, weights, entity_db, mapping_db, NULL);
+}
 
-                warning = entity_db->map_symbol(entity_db, buf1, &entity_index);
-                EnrichResults_add_warning(cntxt, warning);
 
-		retcode = SSFile_next_field(fp, buf2, WEIGHTS_MAX_FIELD_WIDTH);
-		if (retcode != END_OF_LINE) {
-			fprintf(stderr, "Invalid weight file format (line %d, field #2).\n",
-				line_num);
-			exit(EXIT_FAILURE);
-		}
+/* The matrix keeps the column names, which point into the file image
+   retained by cntxt */
+EnrichMatrix *EnrichResults_set_matrix(EnrichContext *cntxt, EnrichWeights *weights,
+                                       EntityDb *entity_db, TermMappingDb *mapping_db)
+{
+        EnrichMatrix *matrix;
 
-                wght = strtod(buf2, &endptr);
-                if (*endptr != '\0') {
-			fprintf(stderr, "Invalid weight %s (line %d, field #2).\n",
-				buf2, line_num);
-			exit(EXIT_FAILURE);
-                }
+        if (weights->binary) {
+                fprintf(stderr, "Binary weights file %s cannot be read as a matrix.\n",
+                        weights->filename);
+                exit(EXIT_FAILURE);
+        }
+        matrix = calloc_(1, sizeof(EnrichMatrix));
+        matrix->num_columns = weights->num_columns;
+        matrix->column_names = weights->column_names;
+        matrix->num_raw_weights = calloc_(matrix->num_columns, sizeof(uint32_t));
+        weights->column_names = NULL;
+        EnrichResults_map_weights(cntxt, weights, entity_db, mapping_db, matrix);
+        return matrix;
+}
 
-                if (warning == NULL || warning->code == RESOLVABLE_CONFLICT) {
 
-                        if (cntxt->used_indices[entity_index]) {
-                                warning = calloc_(1, sizeof(EntityWarning));
-                                PrintBuf_printf(pbuf, 0,
-                                                "Duplicate weight for %s (line %d)"
-                                                " - additional instance IGNORED.",
-                                                buf1, line_num);
-                                warning->msg = strdup_(pbuf->buf);
-                                warning->code = DUPLICATE_ID;
-                                EnrichResults_add_warning(cntxt, warning);
-                        }
-                        else if (mapped_indices[entity_index]) {
-                                cntxt->weights[entity_index] = wght;
-                                cntxt->used_indices[entity_index] = 1;
-                                cntxt->num_valid_ids++;
-                                cntxt->input_symbols[entity_index] = strdup_(buf1);
-                        }
+/* A context for one column of the matrix, with the options of cntxt, from
+   which it also borrows the term masks. The warnings of the rows where the
+   column is not missing are added to it in the order of the file, along
+   with its own duplicates. It must be deleted with
+   EnrichMatrix_delete_column_context() before cntxt is deleted. */
+EnrichContext *EnrichMatrix_column_context(EnrichMatrix *matrix, EnrichContext *cntxt,
+                                           uint32_t column)
+{
+        EnrichContext *column_cntxt = malloc_(sizeof(EnrichContext));
+        const weight_t *values = matrix->values + column;
+        EntityWarning duplicate;
+        uint32_t entity_index;
+        uint32_t r;
+        uint32_t w;
+
+        *column_cntxt = *cntxt;
+        Arena_init(&column_cntxt->warning_arena);
+        column_cntxt->first_warning = NULL;
+        column_cntxt->last_warning = NULL;
+        column_cntxt->num_warnings = 0;
+        column_cntxt->weights_column = matrix->column_names[column];
+        column_cntxt->weights = calloc_(cntxt->num_entities, sizeof(weight_t));
+        column_cntxt->used_indices = calloc_(cntxt->num_entities / 8 + 1, sizeof(uint8_t));
+        column_cntxt->input_symbols = calloc_(cntxt->num_entities, sizeof(char *));
+        column_cntxt->input_reader = NULL;
+        column_cntxt->input_tail = NULL;
+        column_cntxt->term_hits = calloc_(INITIAL_TERM_HITS, sizeof(TermHit));
+        column_cntxt->num_term_hits = 0;
+        column_cntxt->max_term_hits = INITIAL_TERM_HITS;
+        column_cntxt->used_sets = NULL;
+        column_cntxt->visit_sets = NULL;
+        column_cntxt->num_visit_sets = 0;
+
+        memset(&duplicate, 0, sizeof(EntityWarning));
+        duplicate.code = DUPLICATE_ID;
+
+        /* Missing weights are NaN, the only values unequal to themselves */
+        column_cntxt->num_raw_weights = matrix->num_raw_weights[column];
+        column_cntxt->num_unknown_ids = 0;
+        column_cntxt->num_duplicate_ids = 0;
+        column_cntxt->num_conflicting_ids = 0;
+        column_cntxt->num_resolvable_ids = 0;
+        column_cntxt->num_valid_ids = 0;
+        for (r=0, w=0; r < matrix->num_rows; r++, values += matrix->num_columns) {
+                if (*values != *values) {
+                        w += matrix->row_warned[r];
+                        continue;
+                }
+                if (matrix->row_warned[r]) {
+                        EnrichResults_add_warning(column_cntxt, matrix->warnings + w++);
+                }
+                entity_index = matrix->row_entities[r];
+                if (entity_index == MATRIX_NO_ENTITY) {
+                        continue;
                 }
+                if (USED_INDEX(column_cntxt->used_indices, entity_index)) {
+                        duplicate.symbol = matrix->row_symbols[r];
+                        duplicate.line = matrix->row_lines[r];
+                        EnrichResults_add_warning(column_cntxt, &duplicate);
+                        continue;
+                }
+                column_cntxt->weights[entity_index] = *values;
+                SET_USED_INDEX(column_cntxt->used_indices, entity_index);
+                column_cntxt->input_symbols[entity_index] = matrix->row_symbols[r];
+                column_cntxt->num_valid_ids++;
+        }
+        column_cntxt->num_unused_entities = column_cntxt->num_entities
+                - column_cntxt->num_valid_ids;
+        return column_cntxt;
+}
 
-		line_num++;
-                cntxt->num_raw_weights++;
-	}
-        PrintBuf_delete(pbuf);
-        free(mapped_indices);
-        fclose(fp);
-        cntxt->num_unused_entities = cntxt->num_entities - cntxt->num_valid_ids;
+
+void EnrichMatrix_delete_column_context(EnrichContext *column_cntxt)
+{
+        column_cntxt->term_mask = NULL;
+        column_cntxt->namespace_mask = NULL;
+        EnrichContext_delete(column_cntxt);
+}
+
+
+void EnrichMatrix_delete(EnrichMatrix *matrix)
+{
+        free(matrix->column_names);
+        free(matrix->row_entities);
+        free(matrix->values);
+        free(matrix->row_symbols);
+        free(matrix->row_lines);
+        free(matrix->row_warned);
+        free(matrix->warnings);
+        free(matrix->num_raw_weights);
+        free(matrix);
+}
+
+
+/* With the entity database already loaded, symbols are mapped while
+   parsing, unless a platform map is used */
+void EnrichResults_load_weights(EnrichContext *cntxt, const char *weights_filename,
+				EntityDb *entity_db, TermMappingDb *mapping_db)
+{
+        EnrichWeights *weights;
+
+        weights = EnrichWeights_parse(weights_filename,
+                                      EnrichContext_uses_platform_map(cntxt, entity_db)
+                                      ? NULL : entity_db, 0, NULL, 0);
+        EnrichResults_set_weights(cntxt, weights, entity_db, mapping_db);
 }
 
 
@@ -329,7 +1390,7 @@ void EnrichResults_process_weights(EnrichContext *cntxt)
         if (cntxt->cutoff_type == RANK) {
                 used_weights = malloc_(cntxt->num_valid_ids * sizeof(double));
                 for (i=0,j=0; i < cntxt->num_entities; i++) {
-                        if (cntxt->used_indices[i]) {
+                        if (USED_INDEX(cntxt->used_indices, i)) {
                                 used_weights[j++] = cntxt->weights[i];
                         }
                 }
@@ -339,7 +1400,7 @@ void EnrichResults_process_weights(EnrichContext *cntxt)
         }
         if (cntxt->cutoff_type != NONE) {
                 for (i=0,j=0; i < cntxt->num_entities; i++) {
-                        if (cntxt->used_indices[i]) {
+                        if (USED_INDEX(cntxt->used_indices, i)) {
 				if (cntxt->weights[i] < cntxt->weight_cutoff) {
 					cntxt->weights[i] = 0.0;
 				}
@@ -354,7 +1415,7 @@ void EnrichResults_process_weights(EnrichContext *cntxt)
 	/* Discretize weights */
         if (cntxt->discretized_weights) {
                 for (i=0; i < cntxt->num_entities; i++) {
-                        if (cntxt->used_indices[i] && cntxt->weights[i] > 0.0) {
+                        if (USED_INDEX(cntxt->used_indices, i) && cntxt->weights[i] > 0.0) {
                                 cntxt->weights[i] = 1.0;
                         }
 			else {
@@ -366,25 +1427,18 @@ void EnrichResults_process_weights(EnrichContext *cntxt)
 	/* Must count here for non-zero weights since any of previous
 	   transformations could have affected them */
 	for (i=0; i < cntxt->num_entities; i++) {
-		if (cntxt->used_indices[i] && cntxt->weights[i] != 0.0) {
+		if (USED_INDEX(cntxt->used_indices, i) && cntxt->weights[i] != 0.0) {
 			cntxt->num_nonzero_valid_ids++;
 		}
 	}
 }
 
 
-static void EnrichResults_wsum_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
-				       TermMappingDb *mapping_db)
+/* The background distribution of the sum of weights */
+static
+SDDLSUM *EnrichResults_wsum_background(const EnrichContext *cntxt)
 {
-	uint32_t term_index;
-	uint32_t *hits;
-	uint32_t *end_hits;
-	uint32_t num_hits;
-	uint32_t num_used_hits;
-
         SDDLSUM *sddlsum;
-        double score;
-        double Pvalue;
         double *used_weights;
         unsigned int i;
         unsigned int j;
@@ -392,7 +1446,7 @@ static void EnrichResults_wsum_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 	/* Copy used weights to obtain background distribution */
 	used_weights = malloc_(cntxt->num_valid_ids * sizeof(double));
 	for (i=0,j=0; i < cntxt->num_entities; i++) {
-		if (cntxt->used_indices[i]) {
+		if (USED_INDEX(cntxt->used_indices, i)) {
 			used_weights[j++] = cntxt->weights[i];
 		}
 	}
@@ -402,29 +1456,43 @@ static void EnrichResults_wsum_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 		exit(EXIT_FAILURE);
 	}
 	free(used_weights);
+        return sddlsum;
+}
+
+
+static void EnrichResults_wsum_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
+				       TermMappingDb *mapping_db)
+{
+	uint32_t set_index;
+	uint32_t k;
+	SetScores set_scores;
+	const uint32_t *hits;
+	uint32_t num_hits;
+	uint32_t num_used_hits;
+
+        SDDLSUM *sddlsum;
+        double score;
+        double Pvalue;
+
+	sddlsum = EnrichResults_wsum_background(cntxt);
 
 	/* SADDLESUM - main loop */
-	mapping_db->reset(mapping_db);
-	while (mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits)) {
-		score = 0.0;
-		for (num_used_hits=0, end_hits=hits+num_hits; hits < end_hits; hits++) {
-			score += cntxt->weights[*hits];
-			num_used_hits += cntxt->used_indices[*hits];
-		}
-		if (num_used_hits < cntxt->min_term_size) {
-			continue;
-		}
+	SetScores_init(&set_scores, mapping_db->num_sets);
+	for (k=0; k < cntxt->num_visit_sets; k++) {
+		set_index = cntxt->visit_sets[k];
+		num_hits = TermMappingDb_get_set(mapping_db, set_index, &hits);
+		score = wsum_score(cntxt->weights, cntxt->used_indices, hits, num_hits,
+				   &num_used_hits);
+		set_scores.score[set_index] = score;
+		set_scores.num_used_hits[set_index] = num_used_hits;
 		Pvalue = SADDLE_SUM_pvalue(sddlsum, score, num_used_hits,
 					   cntxt->Pvalue_cutoff,
 					   SADDLESUM_MAX_ITERS,
 					   SADDLESUM_TOLERANCE);
-
-		if (Pvalue <= cntxt->Pvalue_cutoff) {
-			EnrichResults_insert_term_hit(cntxt, term_index,
-						      score, num_used_hits, Pvalue);
-		}
+		set_scores.Pvalue[set_index] = Pvalue;
 	}
 	SADDLE_SUM_del(sddlsum);
+	SetScores_insert_term_hits(cntxt, mapping_db, &set_scores);
 }
 
 
@@ -432,40 +1500,20 @@ static
 void EnrichResults_wsum_single_pvalue(EnrichContext *cntxt, CVTermDb *term_db,
                                       TermMappingDb *mapping_db, uint32_t term_index)
 {
-	uint32_t *hits;
-	uint32_t *end_hits;
+	const uint32_t *hits;
 	uint32_t num_hits;
 	uint32_t num_used_hits;
 
         SDDLSUM *sddlsum;
         double score;
         double Pvalue = -1.0;
-        double *used_weights;
-        unsigned int i;
-        unsigned int j;
 
-	/* Copy used weights to obtain background distribution */
-	used_weights = malloc_(cntxt->num_valid_ids * sizeof(double));
-	for (i=0,j=0; i < cntxt->num_entities; i++) {
-		if (cntxt->used_indices[i]) {
-			used_weights[j++] = cntxt->weights[i];
-		}
-	}
-	sddlsum = SADDLE_SUM_init(used_weights, cntxt->num_valid_ids);
-	if (sddlsum == NULL) {
-		fprintf(stderr, "Could not allocate saddlesum context.\n");
-		exit(EXIT_FAILURE);
-	}
-	free(used_weights);
+	sddlsum = EnrichResults_wsum_background(cntxt);
 
-	mapping_db->current_term = term_index;
-	(void) mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits);
-        score = 0.0;
-        for (num_used_hits=0, end_hits=hits+num_hits; hits < end_hits; hits++) {
-                score += cntxt->weights[*hits];
-                num_used_hits += cntxt->used_indices[*hits];
-        }
-        if (num_used_hits >= cntxt->min_term_size) {
+	num_hits = TermMappingDb_get_mapping(mapping_db, term_index, &hits);
+        score = wsum_score(cntxt->weights, cntxt->used_indices, hits, num_hits,
+                           &num_used_hits);
+        if (term_size_ok(cntxt, num_used_hits)) {
                 Pvalue = SADDLE_SUM_pvalue(sddlsum, score, num_used_hits,
                                            cntxt->Pvalue_cutoff,
                                            SADDLESUM_MAX_ITERS,
@@ -480,9 +1528,10 @@ static
 void EnrichResults_hgem_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 				       TermMappingDb *mapping_db)
 {
-	uint32_t term_index;
-	uint32_t *hits;
-	uint32_t *end_hits;
+	uint32_t set_index;
+	uint32_t k;
+	SetScores set_scores;
+	const uint32_t *hits;
 	uint32_t num_hits;
 	uint32_t num_used_hits;
 
@@ -492,24 +1541,19 @@ void EnrichResults_hgem_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 
 	hgeom = HypergeomStats_init(cntxt->num_valid_ids, cntxt->num_nonzero_valid_ids);
 	/* FISHER_EXACT - main loop */
-	mapping_db->reset(mapping_db);
-	while (mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits)) {
-		i = 0;
-		for (num_used_hits=0, end_hits=hits+num_hits; hits < end_hits; hits++) {
-			i += (cntxt->weights[*hits] > 0.0);
-			num_used_hits += cntxt->used_indices[*hits];
-		}
-		if (num_used_hits < cntxt->min_term_size) {
-			continue;
-		}
+	SetScores_init(&set_scores, mapping_db->num_sets);
+	for (k=0; k < cntxt->num_visit_sets; k++) {
+		set_index = cntxt->visit_sets[k];
+		num_hits = TermMappingDb_get_set(mapping_db, set_index, &hits);
+		i = hgem_score(cntxt->weights, cntxt->used_indices, hits, num_hits,
+			       &num_used_hits);
+		set_scores.score[set_index] = (double) i;
+		set_scores.num_used_hits[set_index] = num_used_hits;
 		Pvalue = HypergeomStats_pvalue(hgeom, i, num_used_hits);
-
-		if (Pvalue <= cntxt->Pvalue_cutoff) {
-			EnrichResults_insert_term_hit(cntxt, term_index,
-						      (double) i, num_used_hits, Pvalue);
-		}
+		set_scores.Pvalue[set_index] = Pvalue;
 	}
 	HypergeomStats_del(hgeom);
+	SetScores_insert_term_hits(cntxt, mapping_db, &set_scores);
 }
 
 
@@ -517,8 +1561,7 @@ static
 void EnrichResults_hgem_single_pvalue(EnrichContext *cntxt, CVTermDb *term_db,
                                       TermMappingDb *mapping_db, uint32_t term_index)
 {
-	uint32_t *hits;
-	uint32_t *end_hits;
+	const uint32_t *hits;
 	uint32_t num_hits;
 	uint32_t num_used_hits;
         double Pvalue = -1.0;
@@ -526,14 +1569,10 @@ void EnrichResults_hgem_single_pvalue(EnrichContext *cntxt, CVTermDb *term_db,
         HypergeomStats *hgeom;
 
 	hgeom = HypergeomStats_init(cntxt->num_valid_ids, cntxt->num_nonzero_valid_ids);
-	mapping_db->current_term = term_index;
-        (void) mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits);
-        i = 0;
-        for (num_used_hits=0, end_hits=hits+num_hits; hits < end_hits; hits++) {
-                i += (cntxt->weights[*hits] > 0.0);
-                num_used_hits += cntxt->used_indices[*hits];
-        }
-        if (num_used_hits >= cntxt->min_term_size) {
+	num_hits = TermMappingDb_get_mapping(mapping_db, term_index, &hits);
+        i = hgem_score(cntxt->weights, cntxt->used_indices, hits, num_hits,
+                       &num_used_hits);
+        if (term_size_ok(cntxt, num_used_hits)) {
                 Pvalue = HypergeomStats_pvalue(hgeom, i, num_used_hits);
         }
         EnrichResults_insert_term_hit(cntxt, term_index, (double) i, num_used_hits, Pvalue);
@@ -546,24 +1585,42 @@ void EnrichResults_count_used_terms(EnrichContext *cntxt, CVTermDb *term_db,
                                     TermMappingDb *mapping_db)
 {
 	/* Get effective sample size and hence a Pvalue_cutoff */
-	/* Here we need to do one more scan of term mappings to count the terms
-	   that are relevant */
+	/* Select the entity sets to score. Term filters and total set sizes
+	   are checked first, since they need no access to the hits, and only
+	   the remaining sets are scanned to count the used hits. A term is
+	   used if it passes the filters and its set is used. */
 
 	uint32_t term_index;
-	uint32_t *hits;
-	uint32_t *end_hits;
+	uint32_t set_index;
+	const uint32_t *hits;
 	uint32_t num_hits;
-	uint32_t num_used_hits;
+	uint32_t num_sets = mapping_db->num_sets;
+	uint8_t *used_sets;
+
 	cntxt->num_terms = term_db->num_terms;
-	mapping_db->reset(mapping_db);
-	while (mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits)) {
-		for (num_used_hits=0, end_hits=hits+num_hits; hits < end_hits; hits++) {
-			if (cntxt->used_indices[*hits]) {
-				num_used_hits++;
-			}
+	cntxt->num_used_terms = 0;
+	used_sets = realloc_(cntxt->used_sets, (num_sets + 1) * sizeof(uint8_t));
+	cntxt->used_sets = used_sets;
+	cntxt->visit_sets = realloc_(cntxt->visit_sets, (num_sets + 1) * sizeof(uint32_t));
+	cntxt->num_visit_sets = 0;
+
+	EnrichResults_select_sets(cntxt, mapping_db, used_sets);
+	for (set_index=0; set_index < num_sets; set_index++) {
+		if (!used_sets[set_index]) {
+			continue;
 		}
-		if (num_used_hits >= cntxt->min_term_size) {
-			cntxt->num_used_terms++;
+		num_hits = TermMappingDb_get_set(mapping_db, set_index, &hits);
+		used_sets[set_index] = (num_hits >= cntxt->min_term_size
+					&& term_size_ok(cntxt, count_used_hits(cntxt->used_indices,
+									       hits, num_hits)));
+		if (used_sets[set_index]) {
+			cntxt->visit_sets[cntxt->num_visit_sets++] = set_index;
+		}
+	}
+	for (term_index=0; term_index < mapping_db->num_mappings; term_index++) {
+		if (cntxt->term_mask == NULL || cntxt->term_mask[term_index]) {
+			cntxt->num_used_terms += used_sets[TermMappingDb_set_index(mapping_db,
+										   term_index)];
 		}
 	}
 	if (cntxt->effective_db_size <= 0.0) {
@@ -573,12 +1630,30 @@ void EnrichResults_count_used_terms(EnrichContext *cntxt, CVTermDb *term_db,
 }
 
 
-void EnrichResults_calc_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
-				TermMappingDb *mapping_db)
+/* Terms are resolved here rather than while scoring, since ETD term
+   objects are created on first use */
+static
+void EnrichResults_finish_term_hits(EnrichContext *cntxt, CVTermDb *term_db)
 {
         TermHit *term_hits;
         TermHit *end_term_hits;
 
+	/* Update term_hit data */
+        term_hits = cntxt->term_hits;
+        end_term_hits = cntxt->term_hits + cntxt->num_term_hits;
+        for (; term_hits < end_term_hits; term_hits++) {
+                term_hits->term = term_db->get_term_from_index(term_db, term_hits->term_index);
+                term_hits->Evalue = term_hits->Pvalue * cntxt->effective_db_size;
+        }
+
+	/* Sort term_hits */
+        qsort(cntxt->term_hits, cntxt->num_term_hits, sizeof(TermHit), TermHit_compare);
+}
+
+
+void EnrichResults_calc_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
+				TermMappingDb *mapping_db)
+{
         EnrichResults_count_used_terms(cntxt, term_db, mapping_db);
 
 	/* Main run */
@@ -590,17 +1665,176 @@ void EnrichResults_calc_pvalues(EnrichContext *cntxt, CVTermDb *term_db,
 		EnrichResults_hgem_pvalues(cntxt, term_db, mapping_db);
                 break;
         }
+        EnrichResults_finish_term_hits(cntxt, term_db);
+}
 
-	/* Update term_hit data */
-        term_hits = cntxt->term_hits;
-        end_term_hits = cntxt->term_hits + cntxt->num_term_hits;
-        for (; term_hits < end_term_hits; term_hits++) {
-                term_hits->term = term_db->get_term_from_index(term_db, term_hits->term_index);
-                term_hits->Evalue = term_hits->Pvalue * cntxt->effective_db_size;
+
+/* Up to SCORE_BLOCK_SIZE contexts with the same entities and options,
+   scored in one pass over the entity sets. Their weights (or, for Fisher's
+   test, indicators of positive weights) and used flags are interleaved by
+   entity, so that the sums over the hits of a set are accumulated for all
+   of them at once, as a product of the sparse set-entity matrix with a
+   dense block of weights. Each context keeps its own set selection and
+   background distribution. */
+typedef struct _ScoreBlock_s {
+        EnrichContext **cntxts;
+        uint32_t num_cntxts;
+        CVTermDb *term_db;
+        TermMappingDb *mapping_db;
+} ScoreBlock;
+
+
+static inline
+void block_scores(const weight_t *weights, const uint8_t *used,
+                  const uint32_t *hits, uint32_t num_hits,
+                  double *scores, uint32_t *num_used_hits)
+{
+        const uint32_t *end_hits = hits + num_hits;
+        const weight_t *w;
+        const uint8_t *u;
+        int b;
+
+        for (b=0; b < SCORE_BLOCK_SIZE; b++) {
+                scores[b] = 0.0;
+                num_used_hits[b] = 0;
+        }
+        for (; hits < end_hits; hits++) {
+                w = weights + (size_t) *hits * SCORE_BLOCK_SIZE;
+                u = used + (size_t) *hits * SCORE_BLOCK_SIZE;
+                for (b=0; b < SCORE_BLOCK_SIZE; b++) {
+                        scores[b] += w[b];
+                        num_used_hits[b] += u[b];
+                }
         }
+}
 
-	/* Sort term_hits */
-        qsort(cntxt->term_hits, cntxt->num_term_hits, sizeof(TermHit), TermHit_compare);
+
+static
+void ScoreBlock_run(void *block_)
+{
+        ScoreBlock *block = (ScoreBlock *) block_;
+        EnrichContext *cntxt;
+        TermMappingDb *mapping_db = block->mapping_db;
+        uint32_t num_entities = block->cntxts[0]->num_entities;
+        weight_t *weights;
+        uint8_t *used;
+        SetScores set_scores[SCORE_BLOCK_SIZE];
+        SDDLSUM *sddlsum[SCORE_BLOCK_SIZE];
+        HypergeomStats *hgeom[SCORE_BLOCK_SIZE];
+        double scores[SCORE_BLOCK_SIZE];
+        uint32_t num_used_hits[SCORE_BLOCK_SIZE];
+	const uint32_t *hits;
+	uint32_t num_hits;
+        uint32_t set_index;
+        uint32_t i;
+        uint32_t b;
+        uint8_t visit;
+
+        weights = calloc_((size_t) num_entities * SCORE_BLOCK_SIZE + 1, sizeof(weight_t));
+        used = calloc_((size_t) num_entities * SCORE_BLOCK_SIZE + 1, sizeof(uint8_t));
+        for (b=0; b < block->num_cntxts; b++) {
+                cntxt = block->cntxts[b];
+                EnrichResults_count_used_terms(cntxt, block->term_db, mapping_db);
+                for (i=0; i < num_entities; i++) {
+                        used[(size_t) i * SCORE_BLOCK_SIZE + b] = USED_INDEX(cntxt->used_indices, i);
+                        switch (cntxt->statistics_type) {
+                        case SADDLESUM:
+                                weights[(size_t) i * SCORE_BLOCK_SIZE + b] = cntxt->weights[i];
+                                break;
+                        case FISHER_EXACT:
+                                weights[(size_t) i * SCORE_BLOCK_SIZE + b] = (cntxt->weights[i] > 0.0);
+                                break;
+                        }
+                }
+                switch (cntxt->statistics_type) {
+                case SADDLESUM:
+                        sddlsum[b] = EnrichResults_wsum_background(cntxt);
+                        break;
+                case FISHER_EXACT:
+                        hgeom[b] = HypergeomStats_init(cntxt->num_valid_ids,
+                                                       cntxt->num_nonzero_valid_ids);
+                        break;
+                }
+                SetScores_init(set_scores + b, mapping_db->num_sets);
+        }
+
+        for (set_index=0; set_index < mapping_db->num_sets; set_index++) {
+                visit = 0;
+                for (b=0; b < block->num_cntxts; b++) {
+                        visit |= block->cntxts[b]->used_sets[set_index];
+                }
+                if (!visit) {
+                        continue;
+                }
+                num_hits = TermMappingDb_get_set(mapping_db, set_index, &hits);
+                block_scores(weights, used, hits, num_hits, scores, num_used_hits);
+                for (b=0; b < block->num_cntxts; b++) {
+                        cntxt = block->cntxts[b];
+                        if (!cntxt->used_sets[set_index]) {
+                                continue;
+                        }
+                        set_scores[b].score[set_index] = scores[b];
+                        set_scores[b].num_used_hits[set_index] = num_used_hits[b];
+                        switch (cntxt->statistics_type) {
+                        case SADDLESUM:
+                                set_scores[b].Pvalue[set_index] =
+                                        SADDLE_SUM_pvalue(sddlsum[b], scores[b],
+                                                          num_used_hits[b],
+                                                          cntxt->Pvalue_cutoff,
+                                                          SADDLESUM_MAX_ITERS,
+                                                          SADDLESUM_TOLERANCE);
+                                break;
+                        case FISHER_EXACT:
+                                set_scores[b].Pvalue[set_index] =
+                                        HypergeomStats_pvalue(hgeom[b], (uint32_t) scores[b],
+                                                              num_used_hits[b]);
+                                break;
+                        }
+                }
+        }
+
+        for (b=0; b < block->num_cntxts; b++) {
+                cntxt = block->cntxts[b];
+                switch (cntxt->statistics_type) {
+                case SADDLESUM:
+                        SADDLE_SUM_del(sddlsum[b]);
+                        break;
+                case FISHER_EXACT:
+                        HypergeomStats_del(hgeom[b]);
+                        break;
+                }
+                SetScores_insert_term_hits(cntxt, mapping_db, set_scores + b);
+        }
+        free(weights);
+        free(used);
+}
+
+
+/* Equivalent to EnrichResults_calc_pvalues() for each of the contexts,
+   which must share their entities and options (as the columns of an
+   EnrichMatrix do). Blocks of contexts are scored on several threads. */
+void EnrichResults_calc_pvalues_multi(EnrichContext **cntxts, uint32_t num_cntxts,
+                                      CVTermDb *term_db, TermMappingDb *mapping_db)
+{
+        uint32_t num_blocks = (num_cntxts + SCORE_BLOCK_SIZE - 1) / SCORE_BLOCK_SIZE;
+        ScoreBlock *blocks = calloc_(num_blocks + 1, sizeof(ScoreBlock));
+        uint32_t b;
+
+        for (b=0; b < num_blocks; b++) {
+                blocks[b].cntxts = cntxts + b * SCORE_BLOCK_SIZE;
+                blocks[b].num_cntxts = num_cntxts - b * SCORE_BLOCK_SIZE;
+                if (blocks[b].num_cntxts > SCORE_BLOCK_SIZE) {
+                        blocks[b].num_cntxts = SCORE_BLOCK_SIZE;
+                }
+                blocks[b].term_db = term_db;
+                blocks[b].mapping_db = mapping_db;
+        }
+        run_tasks(ScoreBlock_run, blocks, sizeof(ScoreBlock), num_blocks,
+                  num_worker_threads());
+        for (b=0; b < num_cntxts; b++) {
+                EnrichResults_finish_term_hits(cntxts[b], term_db);
+        }
+        free(blocks);
 }
 
 
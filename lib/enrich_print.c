@@ -61,6 +61,10 @@ void EnrichResults_print_header(EnrichContext *cntxt, FILE *fp, const char *fmt,
                 fprintf(fp, fmt, "Database name", cntxt->db_name);
         }
 
+        if (cntxt->weights_column != NULL) {
+                fprintf(fp, fmt, "Weights column", cntxt->weights_column);
+        }
+
         PrintBuf_printf(pbuf, 0, "%d", cntxt->num_terms);
         fprintf(fp, fmt, "Total database terms", pbuf->buf);
 
@@ -76,6 +80,11 @@ void EnrichResults_print_header(EnrichContext *cntxt, FILE *fp, const char *fmt,
         PrintBuf_printf(pbuf, 0, "%d", cntxt->min_term_size);
         fprintf(fp, fmt, "Minimum term size (weighted entities per term)", pbuf->buf);
 
+        if (cntxt->max_term_size > 0) {
+                PrintBuf_printf(pbuf, 0, "%d", cntxt->max_term_size);
+                fprintf(fp, fmt, "Maximum term size (weighted entities per term)", pbuf->buf);
+        }
+
         PrintBuf_printf(pbuf, 0, "%d", cntxt->num_used_terms);
         fprintf(fp, fmt, "Used database terms", pbuf->buf);
 
@@ -139,43 +148,58 @@ void EnrichResults_print_header(EnrichContext *cntxt, FILE *fp, const char *fmt,
 }
 
 
+/* Warnings beyond the number kept by the context are only counted, which
+   is noted with more_fmt */
 static
 void EnrichResults_print_warnings(EnrichContext *cntxt, FILE *fp, const char *fmt,
-                                  const char *heading_fmt)
+                                  const char *heading_fmt, const char *more_fmt)
 {
         EntityWarning *warning = cntxt->first_warning;
+        PrintBuf *pbuf = PrintBuf_init(NULL);
+        uint32_t num_printed = 0;
+        uint32_t num_warnings = cntxt->num_duplicate_ids + cntxt->num_conflicting_ids
+                + cntxt->num_resolvable_ids;
 
         fprintf(fp, heading_fmt, "NOMENCLATURE WARNINGS");
 
         while (warning != NULL) {
                 if (warning->code != UNKNOWN_ID) {
-                        fprintf(fp, fmt, warning->msg);
+                        EntityWarning_format(warning, pbuf);
+                        fprintf(fp, fmt, pbuf->buf);
+                        num_printed++;
                 }
                 warning = warning->next;
         }
+        if (num_printed < num_warnings) {
+                fprintf(fp, more_fmt, num_warnings - num_printed);
+        }
+        PrintBuf_delete(pbuf);
 }
 
 
 static
 void EnrichResults_print_unknown_ids(EnrichContext *cntxt, FILE *fp, const char *sep,
-                                     const char *heading_fmt, uint16_t break_after)
+                                     const char *heading_fmt, const char *more_fmt,
+                                     uint16_t break_after)
 {
         EntityWarning *warning = cntxt->first_warning;
         PrintBuf *pbuf = PrintBuf_init(NULL);
         uint16_t line_chars = 0;
         uint16_t seplen = strlen(sep);
         uint16_t msglen;
+        uint32_t num_printed = 0;
 
         fprintf(fp, heading_fmt, "UNKNOWN IDS");
         while (warning != NULL) {
                 if (warning->code == UNKNOWN_ID) {
-                        msglen = strlen(warning->msg);
+                        msglen = strlen(warning->symbol);
                         if (line_chars + msglen + seplen > break_after) {
                                 PrintBuf_printf(pbuf, -1, "\n");
                                 line_chars = 0;
                         }
-                        PrintBuf_printf(pbuf, -1, "%s%s", warning->msg, sep);
+                        PrintBuf_printf(pbuf, -1, "%s%s", warning->symbol, sep);
                         line_chars += msglen + seplen;
+                        num_printed++;
                 }
                 warning = warning->next;
         }
@@ -187,6 +211,9 @@ void EnrichResults_print_unknown_ids(EnrichContext *cntxt, FILE *fp, const char
                 PrintBuf_printf(pbuf, -1, "\n");
                 fprintf(fp, "%s", pbuf->buf);
         }
+        if (num_printed < cntxt->num_unknown_ids) {
+                fprintf(fp, more_fmt, cntxt->num_unknown_ids - num_printed);
+        }
         PrintBuf_delete(pbuf);
 }
 
@@ -276,13 +303,12 @@ void print_input_symbols(EnrichContext *cntxt, PrintBuf *pbuf, CVTermDb *term_db
                          TermMappingDb *mapping_db, CVTerm *term)
 {
         uint32_t term_index;
-        uint32_t *hits;
+        const uint32_t *hits;
         uint32_t num_hits;
         int i;
 
         term_index = term_db->get_index_from_term_id(term_db, term->term_id);
-        mapping_db->current_term = term_index;
-        (void) mapping_db->get_next_mapping(mapping_db, &term_index, &hits, &num_hits);
+        num_hits = TermMappingDb_get_mapping(mapping_db, term_index, &hits);
 
         PrintBuf_printf(pbuf, 0, "");
         if (num_hits == 0) {
@@ -290,7 +316,7 @@ void print_input_symbols(EnrichContext *cntxt, PrintBuf *pbuf, CVTermDb *term_db
         }
 
         for (i=0; i < num_hits; i++) {
-                if ( cntxt->used_indices[hits[i]] ) {
+                if (USED_INDEX(cntxt->used_indices, hits[i])) {
                         PrintBuf_printf(pbuf, -1, "%s,", cntxt->input_symbols[hits[i]]);
                 }
         }
@@ -404,10 +430,12 @@ void EnrichResults_print_all_text(EnrichContext *cntxt, FILE *fp,
         EnrichResults_print_header(cntxt, fp, "%-48.48s %s\n", "\n**** %s ****\n");
 
         if (print_warnings) {
-                EnrichResults_print_warnings(cntxt, fp, "%s\n",  "\n**** %s ****\n");
+                EnrichResults_print_warnings(cntxt, fp, "%s\n",  "\n**** %s ****\n",
+                                             "(%" PRIu32 " more not listed)\n");
         }
         if (print_unknown_ids) {
-                EnrichResults_print_unknown_ids(cntxt, fp, ", ", "\n**** %s ****\n", 80);
+                EnrichResults_print_unknown_ids(cntxt, fp, ", ", "\n**** %s ****\n",
+                                                "(%" PRIu32 " more not listed)\n", 80);
         }
 
         EnrichResults_print_term_hits(cntxt, fp, "%-15.15s %-40.40s %6.6s %12.12s %10.10s%.0s\n",
@@ -420,8 +448,10 @@ void EnrichResults_print_all_tabsep(EnrichContext *cntxt, FILE *fp, CVTermDb *te
                                     TermMappingDb *mapping_db)
 {
         EnrichResults_print_header(cntxt, fp, "%s\t%s\n", "#\n# %s\n#\n");
-        EnrichResults_print_warnings(cntxt, fp, "%s\n", "#\n# %s\n#\n");
-        EnrichResults_print_unknown_ids(cntxt, fp, ",", "#\n# %s\n#\n", 30000);
+        EnrichResults_print_warnings(cntxt, fp, "%s\n", "#\n# %s\n#\n",
+                                     "# %" PRIu32 " more not listed\n");
+        EnrichResults_print_unknown_ids(cntxt, fp, ",", "#\n# %s\n#\n",
+                                        "# %" PRIu32 " more not listed\n", 30000);
         EnrichResults_print_term_relationship_graph(cntxt, fp,
                                                     "%s\t%s\t%s\n",
                                                     "%s\t%s\t%d\t%s\t%s\n",
@@ -433,6 +463,29 @@ void EnrichResults_print_all_tabsep(EnrichContext *cntxt, FILE *fp, CVTermDb *te
 }
 
 
+/* A table of the term hits of several contexts, usually the columns of a
+   weights matrix, with one line per hit */
+void EnrichResults_print_long_heading(FILE *fp)
+{
+        fprintf(fp, "#Column\tNamespace\tTerm ID\tName\tAssociations\tScore\tE-value\n");
+}
+
+
+void EnrichResults_print_long(EnrichContext *cntxt, FILE *fp)
+{
+        TermHit *term_hits = cntxt->term_hits;
+        TermHit *end_term_hits = cntxt->term_hits + cntxt->num_term_hits;
+
+        for (; term_hits < end_term_hits; term_hits++) {
+                fprintf(fp, "%s\t%s\t%s\t%s\t%d\t%.4f\t%.2e\n",
+                        cntxt->weights_column != NULL ? cntxt->weights_column : "",
+                        term_hits->term->namespace, term_hits->term->term_id,
+                        term_hits->term->description, term_hits->num_entities,
+                        term_hits->score, term_hits->Evalue);
+        }
+}
+
+
 typedef struct _EntityWeight_s {
         Entity *entity;
         double weight;
@@ -468,8 +521,7 @@ void EnrichResults_print_term(EnrichContext *cntxt, FILE *fp, EntityDb *entity_d
         PrintBuf *pbuf1;
         PrintBuf *pbuf2;
         PrintBuf *pbuf3;
-        uint32_t term_index;
-        uint32_t *hits;
+        const uint32_t *hits;
         uint32_t num_hits;
         uint32_t num_used_hits = 0;
         uint32_t num_positive_hits = 0;
@@ -488,14 +540,13 @@ void EnrichResults_print_term(EnrichContext *cntxt, FILE *fp, EntityDb *entity_d
         pbuf2 = PrintBuf_init(NULL);
         pbuf3 = PrintBuf_init(NULL);
 
-        mapping_db->current_term = cntxt->term_hits->term_index;
-        (void) mapping_db->get_next_mapping(mapping_db, &term_index,
-                                              &hits, &num_hits);
+        num_hits = TermMappingDb_get_mapping(mapping_db, cntxt->term_hits->term_index,
+                                             &hits);
         ranked = malloc_(num_hits * sizeof(EntityWeight));
         for (i=0; i < num_hits; i++) {
                 ranked[i].entity = entity_db->get_entity_from_index(entity_db, hits[i]);
                 ranked[i].weight = cntxt->weights[hits[i]];
-                ranked[i].used_flag = cntxt->used_indices[hits[i]];
+                ranked[i].used_flag = USED_INDEX(cntxt->used_indices, hits[i]);
                 if (ranked[i].used_flag) {
                         num_zero_hits += (cntxt->weights[hits[i]] == 0.0);
                         num_used_hits += 1;
@@ -509,6 +560,9 @@ void EnrichResults_print_term(EnrichContext *cntxt, FILE *fp, EntityDb *entity_d
         if (cntxt->db_name != NULL) {
                 fprintf(fp, summary_fmt, "Database name", cntxt->db_name);
         }
+        if (cntxt->weights_column != NULL) {
+                fprintf(fp, summary_fmt, "Weights column", cntxt->weights_column);
+        }
         fprintf(fp, summary_fmt, "Term ID", term->term_id);
 
         fprintf(fp, summary_fmt, "Term definition", term->description);
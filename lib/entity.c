@@ -32,6 +32,7 @@
 */
 
 #include <stdlib.h>
+#include <string.h>
 #include "entity.h"
 
 void Entity_delete_data(Entity *entity)
@@ -51,3 +52,54 @@ void Entity_delete_struct_only(Entity *entity)
 {
         free(entity);
 }
+
+
+static
+void print_id_list(const char *src, int num_items, PrintBuf *pbuf)
+{
+        int i;
+        if (num_items < 1) {
+                return; /* just in case */
+        }
+        PrintBuf_printf(pbuf, -1, "%s", src);
+        src += (strlen(src) + 1);
+        for (i=1; i < (num_items-1); i++) {
+                PrintBuf_printf(pbuf, -1, ", %s", src);
+                src += (strlen(src) + 1);
+        }
+        if (num_items > 1) {
+                PrintBuf_printf(pbuf, -1, " and %s", src);
+        }
+}
+
+
+/* Replaces the contents of pbuf with the message of the warning */
+void EntityWarning_format(const EntityWarning *warning, PrintBuf *pbuf)
+{
+        const char *cur = warning->aliases;
+
+        switch (warning->code) {
+        case RESOLVABLE_CONFLICT:
+                PrintBuf_printf(pbuf, 0,  "Identifier %s is also a synonym for ", cur);
+                cur += (strlen(cur) + 1);
+                print_id_list(cur, warning->num_aliases - 1, pbuf);
+                PrintBuf_printf(pbuf, -1,  ".");
+                break;
+        case UNRESOLVABLE_CONFLICT:
+                PrintBuf_printf(pbuf, 0,
+                                "%s is not a primary identifier for any"
+                                " gene while being an alias for ",
+                                cur);
+                cur += (strlen(cur) + 1);
+                print_id_list(cur, warning->num_aliases - 1, pbuf);
+                PrintBuf_printf(pbuf, -1,  ".");
+                break;
+        case DUPLICATE_ID:
+                PrintBuf_printf(pbuf, 0, "Duplicate weight for %s (line %d)"
+                                " - additional instance IGNORED.",
+                                warning->symbol, warning->line);
+                break;
+        default:
+                PrintBuf_printf(pbuf, 0, "%s", warning->symbol);
+        }
+}
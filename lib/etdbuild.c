@@ -0,0 +1,706 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#include "miscutils.h"
+#include "hashtable.h"
+#include "cvterm.h"
+#include "enrich.h"
+
+#define GENE_INFO_NUM_FIELDS 9  /* tax_id through description */
+#define ETDBUILD_LINE_SIZE 4096
+#define ETDBUILD_GENE_INCR 4096
+
+
+/* Genes of the database being built. The symbol of each gene is followed
+   by its aliases in the aliases buffer. Conflicts are stored as in the
+   gene_info block: the name followed by the symbols of the genes it could
+   denote. */
+typedef struct _ETDGenes_s {
+        uint32_t num_genes;
+        uint32_t max_genes;
+        uint32_t *gene_ids;
+        uint32_t *num_aliases;
+        PrintBuf aliases;
+        PrintBuf descriptions;
+        uint32_t checksum;  /* of the gene_info file */
+        uint32_t num_conflicts[2];  /* resolvable, unresolvable */
+        uint32_t max_conflicts[2];
+        uint32_t *conflict_counts[2];
+        PrintBuf conflicts[2];
+        struct hashtable *geneid2index;
+        struct hashtable *name2index;
+} ETDGenes;
+
+
+/* A synonym listed for a gene in the gene_info file */
+typedef struct _Synonym_s {
+        char *name;
+        uint32_t gene;
+        uint32_t seq;  /* position in the file */
+} Synonym;
+
+
+static
+void append_string(PrintBuf *pbuf, const char *s)
+{
+        size_t n = strlen(s) + 1;
+        if (pbuf->len + n > pbuf->size) {
+                pbuf->size = max(2 * pbuf->size, pbuf->len + n);
+                pbuf->buf = realloc_(pbuf->buf, pbuf->size);
+        }
+        memcpy(pbuf->buf + pbuf->len, s, n);
+        pbuf->len += n;
+}
+
+
+/* Updates the CRC-32 checksum (as computed by zlib) with n bytes */
+static
+uint32_t crc32_update(uint32_t crc, const char *buf, size_t n)
+{
+        static uint32_t table[256];
+        uint32_t c;
+        int i;
+        int k;
+        if (table[1] == 0) {
+                for (i=0; i < 256; i++) {
+                        for (c=i, k=0; k < 8; k++) {
+                                c = (c & 1) ? 0xEDB88320U ^ (c >> 1) : (c >> 1);
+                        }
+                        table[i] = c;
+                }
+        }
+        crc = ~crc;
+        while (n--) {
+                crc = table[(crc ^ (uint8_t) *buf++) & 0xFF] ^ (crc >> 8);
+        }
+        return ~crc;
+}
+
+
+/* Reads a line of any length into *line, without the line terminator,
+   and adds the bytes read to the checksum *crc. Returns 0 at the end of
+   file. */
+static
+int read_line(FILE *fp, char **line, size_t *size, uint32_t *crc)
+{
+        size_t len = 0;
+        size_t n;
+        while (fgets(*line + len, *size - len, fp) != NULL) {
+                n = strlen(*line + len);
+                *crc = crc32_update(*crc, *line + len, n);
+                len += n;
+                if ((*line)[len-1] == '\n' || len + 1 < *size) {
+                        break;
+                }
+                *size *= 2;
+                *line = realloc_(*line, *size);
+        }
+        if (len == 0) {
+                return 0;
+        }
+        while (len > 0 && ((*line)[len-1] == '\n' || (*line)[len-1] == '\r')) {
+                (*line)[--len] = '\0';
+        }
+        return 1;
+}
+
+
+/* Splits line at separators in place. Returns the number of fields found,
+   at most max_fields. */
+static
+int split_fields(char *line, char sep, char **fields, int max_fields)
+{
+        int n = 0;
+        fields[n++] = line;
+        for (; *line && n < max_fields; line++) {
+                if (*line == sep) {
+                        *line = '\0';
+                        fields[n++] = line + 1;
+                }
+        }
+        return n;
+}
+
+
+static
+int Synonym_compare(const void *a_, const void *b_)
+{
+        const Synonym *a = (const Synonym *) a_;
+        const Synonym *b = (const Synonym *) b_;
+        int c = strcmp(a->name, b->name);
+        if (c != 0) {
+                return c;
+        }
+        if (a->gene != b->gene) {
+                return (a->gene < b->gene) ? -1 : 1;
+        }
+        return (a->seq < b->seq) ? -1 : (a->seq > b->seq);
+}
+
+
+static
+ETDGenes *ETDGenes_init(void)
+{
+        ETDGenes *genes = calloc_(1, sizeof(ETDGenes));
+        int w;
+        (void) PrintBuf_init(&genes->aliases);
+        (void) PrintBuf_init(&genes->descriptions);
+        for (w=0; w < 2; w++) {
+                (void) PrintBuf_init(genes->conflicts + w);
+        }
+        genes->geneid2index = create_hashtable(ETDBUILD_GENE_INCR, hash_from_int,
+                                               int_equal);
+        genes->name2index = create_hashtable(ETDBUILD_GENE_INCR, hash_from_string,
+                                             str_equal);
+        return genes;
+}
+
+
+static
+void ETDGenes_delete(ETDGenes *genes)
+{
+        int w;
+        free(genes->gene_ids);
+        free(genes->num_aliases);
+        PrintBuf_delete(&genes->aliases);
+        PrintBuf_delete(&genes->descriptions);
+        for (w=0; w < 2; w++) {
+                free(genes->conflict_counts[w]);
+                PrintBuf_delete(genes->conflicts + w);
+        }
+        hashtable_destroy(genes->geneid2index, 0);
+        hashtable_destroy(genes->name2index, 0);
+        free(genes);
+}
+
+
+/* Names map to the first gene that claims them */
+static
+void ETDGenes_insert_name(ETDGenes *genes, const char *name, uint32_t i)
+{
+        if (hashtable_search(genes->name2index, (char *) name) == NULL
+            && ! hashtable_insert(genes->name2index, strdup_(name),
+                                  (void *) ((intptr_t) i+1)) ) {
+                fprintf(stderr, "Could not insert entity item %s.\n", name);
+                exit(EXIT_FAILURE);
+        }
+}
+
+
+/* Returns 0 if the gene ID is already present */
+static
+int ETDGenes_insert_gene_id(ETDGenes *genes, uint32_t gene_id, uint32_t i)
+{
+        uint32_t *gene_id_;
+        if (hashtable_search(genes->geneid2index, &gene_id) != NULL) {
+                return 0;
+        }
+        gene_id_ = malloc_(sizeof(uint32_t));
+        *gene_id_ = gene_id;
+        if (! hashtable_insert(genes->geneid2index, gene_id_,
+                               (void *) ((intptr_t) i+1)) ) {
+                fprintf(stderr, "Could not insert gene id %ld.\n", (long) gene_id);
+                exit(EXIT_FAILURE);
+        }
+        return 1;
+}
+
+
+/* Appends a gene with its symbol as the only name. Gene ID 0 stands for
+   genes that are not in NCBI Gene. */
+static
+uint32_t ETDGenes_add(ETDGenes *genes, uint32_t gene_id, const char *symbol,
+                      const char *description)
+{
+        uint32_t i = genes->num_genes++;
+        if (i >= genes->max_genes) {
+                genes->max_genes += ETDBUILD_GENE_INCR;
+                genes->gene_ids = realloc_(genes->gene_ids,
+                                           genes->max_genes * sizeof(uint32_t));
+                genes->num_aliases = realloc_(genes->num_aliases,
+                                              genes->max_genes * sizeof(uint32_t));
+        }
+        genes->gene_ids[i] = gene_id;
+        genes->num_aliases[i] = 1;
+        append_string(&genes->aliases, symbol);
+        append_string(&genes->descriptions, description);
+        ETDGenes_insert_name(genes, symbol, i);
+        if (gene_id != 0) {
+                (void) ETDGenes_insert_gene_id(genes, gene_id, i);
+        }
+        return i;
+}
+
+
+/* Records a conflict for name among the listed genes, given by symbol */
+static
+void ETDGenes_add_conflict(ETDGenes *genes, int w, const char *name,
+                           char **symbols, const Synonym *syn, uint32_t n)
+{
+        uint32_t k = genes->num_conflicts[w]++;
+        uint32_t i;
+        if (k >= genes->max_conflicts[w]) {
+                genes->max_conflicts[w] += ETDBUILD_GENE_INCR;
+                genes->conflict_counts[w] = realloc_(genes->conflict_counts[w],
+                                                     genes->max_conflicts[w]
+                                                     * sizeof(uint32_t));
+        }
+        genes->conflict_counts[w][k] = n + 1;
+        append_string(genes->conflicts + w, name);
+        for (i=0; i < n; i++) {
+                append_string(genes->conflicts + w, symbols[syn[i].gene]);
+        }
+}
+
+
+/* Looks up a name the way NCBIGenesDb does: first as a gene ID, then as
+   a symbol or alias */
+static
+int ETDGenes_find(ETDGenes *genes, const char *name, uint32_t *i)
+{
+        char *endptr;
+        uint32_t gene_id = (uint32_t) strtoul(name, &endptr, 0);
+        void *indx = NULL;
+        if (*endptr == '\0') {
+                indx = hashtable_search(genes->geneid2index, &gene_id);
+        }
+        if (indx == NULL) {
+                indx = hashtable_search(genes->name2index, (char *) name);
+        }
+        if (indx == NULL) {
+                return 0;
+        }
+        *i = (uint32_t) ((intptr_t) indx) - 1;
+        return 1;
+}
+
+
+/* Adds all genes of the taxon from an NCBI gene_info file. If tax_id is 0,
+   the file must contain a single taxon, which is returned in *tax_id.
+   Synonyms shared by several genes, or naming another gene, are not used
+   as aliases but recorded as conflicts. Must be called before any other
+   genes are added. */
+static
+void ETDGenes_read_gene_info(ETDGenes *genes, const char *filename,
+                             uint32_t *tax_id)
+{
+        InFile *in;
+        size_t size = ETDBUILD_LINE_SIZE;
+        char *line = malloc_(size);
+        char *fields[GENE_INFO_NUM_FIELDS];
+        char *endptr;
+        unsigned int line_num = 0;
+        uint32_t max_genes = ETDBUILD_GENE_INCR;
+        uint32_t n = 0;
+        uint32_t num_syn = 0;
+        uint32_t t;
+        uint32_t gene_id;
+        uint32_t i;
+        uint32_t j;
+        uint32_t k;
+        uint32_t a;
+        uint32_t b;
+        uint32_t m;
+        uint32_t h;
+        uint32_t *ids = malloc_(max_genes * sizeof(uint32_t));
+        PrintBuf raw;  /* symbol, synonyms and description of each gene */
+        char **symbols;
+        char **synonyms;
+        char **descriptions;
+        Synonym *syn;
+        Synonym *sorted;
+        uint8_t *accepted;
+        char *cur;
+        char *end;
+        void *indx;
+        int select_taxon = (*tax_id != 0);
+
+        if ((in = InFile_open(filename)) == NULL) {
+                fprintf(stderr, "Could not open file %s.\n", filename);
+                exit(EXIT_FAILURE);
+        }
+        (void) PrintBuf_init(&raw);
+        while (read_line(in->fp, &line, &size, &genes->checksum)) {
+                line_num++;
+                if (line[0] == '#' || line[0] == '\0') {
+                        continue;
+                }
+                if (split_fields(line, '\t', fields, GENE_INFO_NUM_FIELDS)
+                    < GENE_INFO_NUM_FIELDS) {
+                        fprintf(stderr, "Invalid gene_info file format (file %s, line %d).\n",
+                                filename, line_num);
+                        exit(EXIT_FAILURE);
+                }
+                t = (uint32_t) strtoul(fields[0], &endptr, 10);
+                gene_id = (uint32_t) strtoul(fields[1], &endptr, 10);
+                if (*endptr != '\0' || gene_id == 0) {
+                        fprintf(stderr, "Invalid gene ID (file %s, line %d).\n",
+                                filename, line_num);
+                        exit(EXIT_FAILURE);
+                }
+                if (*tax_id == 0) {
+                        *tax_id = t;
+                }
+                else if (t != *tax_id) {
+                        if (select_taxon) {
+                                continue;
+                        }
+                        fprintf(stderr, "More than one taxon in gene_info file "
+                                "(file %s, line %d).\n", filename, line_num);
+                        exit(EXIT_FAILURE);
+                }
+                if (! ETDGenes_insert_gene_id(genes, gene_id, n)) {
+                        continue;  /* keep the first entry */
+                }
+                if (n >= max_genes) {
+                        max_genes += ETDBUILD_GENE_INCR;
+                        ids = realloc_(ids, max_genes * sizeof(uint32_t));
+                }
+                ids[n++] = gene_id;
+                append_string(&raw, fields[2]);
+                append_string(&raw, strcmp(fields[4], "-") ? fields[4] : "");
+                append_string(&raw, strcmp(fields[8], "-") ? fields[8] : "");
+        }
+        InFile_close(in);
+        free(line);
+
+        /* symbols of all genes take precedence over synonyms */
+        symbols = malloc_(((size_t) n + 1) * sizeof(char *));
+        synonyms = malloc_(((size_t) n + 1) * sizeof(char *));
+        descriptions = malloc_(((size_t) n + 1) * sizeof(char *));
+        cur = raw.buf;
+        for (i=0; i < n; i++) {
+                symbols[i] = cur;
+                cur += strlen(cur) + 1;
+                synonyms[i] = cur;
+                for (num_syn++; *cur; cur++) {
+                        num_syn += (*cur == '|');
+                }
+                cur++;
+                descriptions[i] = cur;
+                cur += strlen(cur) + 1;
+                ETDGenes_insert_name(genes, symbols[i], i);
+        }
+
+        /* split synonyms, keeping them in file order */
+        syn = malloc_(((size_t) num_syn + 1) * sizeof(Synonym));
+        for (k=0, i=0; i < n; i++) {
+                for (cur=synonyms[i]; *cur; cur=end) {
+                        end = cur + strcspn(cur, "|");
+                        if (*end) {
+                                *end++ = '\0';
+                        }
+                        if (*cur) {
+                                syn[k].name = cur;
+                                syn[k].gene = i;
+                                syn[k].seq = k;
+                                k++;
+                        }
+                }
+        }
+        num_syn = k;
+
+        /* classify each distinct synonym */
+        sorted = malloc_(((size_t) num_syn + 1) * sizeof(Synonym));
+        memcpy(sorted, syn, num_syn * sizeof(Synonym));
+        qsort(sorted, num_syn, sizeof(Synonym), Synonym_compare);
+        accepted = calloc_((size_t) num_syn + 1, sizeof(uint8_t));
+        for (a=0; a < num_syn; a=b) {
+                for (b=a+1; b < num_syn && !strcmp(sorted[b].name, sorted[a].name); b++);
+                indx = hashtable_search(genes->name2index, sorted[a].name);
+                h = (indx != NULL) ? (uint32_t) ((intptr_t) indx) - 1 : n;
+                /* distinct genes other than the one with that symbol */
+                for (m=a, j=a; j < b; j++) {
+                        if (sorted[j].gene != h
+                            && (m == a || sorted[j].gene != sorted[m-1].gene)) {
+                                sorted[m++] = sorted[j];
+                        }
+                }
+                if (indx != NULL) {
+                        if (m > a) {
+                                ETDGenes_add_conflict(genes, 0, sorted[a].name,
+                                                      symbols, sorted + a, m - a);
+                        }
+                }
+                else if (m - a == 1) {
+                        accepted[sorted[a].seq] = 1;
+                        ETDGenes_insert_name(genes, sorted[a].name, sorted[a].gene);
+                }
+                else {
+                        ETDGenes_add_conflict(genes, 1, sorted[a].name,
+                                              symbols, sorted + a, m - a);
+                }
+        }
+
+        /* genes with their symbols followed by accepted aliases */
+        for (k=0, i=0; i < n; i++) {
+                j = ETDGenes_add(genes, ids[i], symbols[i], descriptions[i]);
+                for (; k < num_syn && syn[k].gene == i; k++) {
+                        if (accepted[k]) {
+                                append_string(&genes->aliases, syn[k].name);
+                                genes->num_aliases[j]++;
+                        }
+                }
+        }
+
+        free(ids);
+        free(symbols);
+        free(synonyms);
+        free(descriptions);
+        free(syn);
+        free(sorted);
+        free(accepted);
+        PrintBuf_delete(&raw);
+}
+
+
+/* Writes the gene_info block. The offsets array holds the position of the
+   symbol of each gene among all names. */
+static
+void ETDGenes_write(ETDGenes *genes, const char *gene_info_file,
+                    uint32_t tax_id, FILE *fp)
+{
+        PrintBuf metadata;
+        uint32_t tmp;
+        uint32_t i;
+        int w;
+
+        fwrite_("NCBIGENE", 1, 8, fp);
+        tmp = NCBIGENE_MAGIC;
+        fwrite_uint32(&tmp, 1, fp);
+
+        (void) PrintBuf_init(&metadata);
+        append_string(&metadata, gene_info_file);
+        append_string(&metadata, "");  /* URL format, not used */
+        fwrite_buf(metadata.buf, metadata.len, fp);
+        PrintBuf_delete(&metadata);
+
+        fwrite_uint32(&genes->checksum, 1, fp);
+        fwrite_uint32(&tax_id, 1, fp);
+        fwrite_uint32(&genes->num_genes, 1, fp);
+        fwrite_uint32(genes->gene_ids, genes->num_genes, fp);
+        for (tmp=0, i=0; i <= genes->num_genes; i++) {
+                fwrite_uint32(&tmp, 1, fp);
+                if (i < genes->num_genes) {
+                        tmp += genes->num_aliases[i];
+                }
+        }
+        fwrite_uint32(genes->num_aliases, genes->num_genes, fp);
+        fwrite_buf(genes->aliases.buf, genes->aliases.len, fp);
+        fwrite_buf(genes->descriptions.buf, genes->descriptions.len, fp);
+        for (w=0; w < 2; w++) {
+                fwrite_uint32(genes->num_conflicts + w, 1, fp);
+                fwrite_uint32(genes->conflict_counts[w], genes->num_conflicts[w], fp);
+                fwrite_buf(genes->conflicts[w].buf, genes->conflicts[w].len, fp);
+        }
+}
+
+
+/* Writes the terms of one namespace as a block without term hierarchy.
+   Hits are translated to genes through entity2gene and genes repeated
+   within a term are stored once. */
+static
+void ETDTermDb_write_plain_ns(CVTermDb *term_db, TermMappingDb *mapping_db,
+                              const char *namespace, const uint32_t *entity2gene,
+                              uint32_t *seen, uint32_t *stamp, FILE *fp)
+{
+        PrintBuf term_ids;
+        PrintBuf descriptions;
+        CVTerm *term;
+        const uint32_t *set;
+        uint32_t *counts;
+        uint32_t *zeros;
+        uint32_t *hits;
+        uint32_t M = 0;
+        uint32_t tmp;
+        uint32_t n;
+        uint32_t g;
+        uint32_t i;
+        uint32_t j;
+        size_t num_hits = 0;
+
+        counts = malloc_(((size_t) term_db->num_terms + 1) * sizeof(uint32_t));
+        hits = malloc_(((size_t) mapping_db->num_hits + 1) * sizeof(uint32_t));
+        (void) PrintBuf_init(&term_ids);
+        (void) PrintBuf_init(&descriptions);
+        for (i=0; i < term_db->num_terms; i++) {
+                term = term_db->get_term_from_index(term_db, i);
+                if (strcmp(term->namespace, namespace)) {
+                        continue;
+                }
+                append_string(&term_ids, term->term_id);
+                append_string(&descriptions, term->description);
+                n = TermMappingDb_get_set(mapping_db, TermMappingDb_set_index(mapping_db, i),
+                                          &set);
+                (*stamp)++;
+                for (counts[M]=0, j=0; j < n; j++) {
+                        g = entity2gene[set[j]];
+                        if (seen[g] != *stamp) {
+                                seen[g] = *stamp;
+                                hits[num_hits++] = g;
+                                counts[M]++;
+                        }
+                }
+                M++;
+        }
+
+        fwrite_("TERMDBNS", 1, 8, fp);
+        tmp = PLAINTERMDB_MAGIC;
+        fwrite_uint32(&tmp, 1, fp);
+        tmp = 0;
+        fwrite_uint32(&tmp, 1, fp);  /* edge types */
+        fwrite_buf("", 0, fp);
+        fwrite_uint32(&M, 1, fp);
+        zeros = calloc_((size_t) M + 1, sizeof(uint32_t));
+        fwrite_uint32(zeros, M, fp);  /* flags */
+        fwrite_uint32(counts, M, fp);
+        fwrite_uint32(hits, num_hits, fp);
+        fwrite_buf(term_ids.buf, term_ids.len, fp);
+        fwrite_buf(descriptions.buf, descriptions.len, fp);
+        fwrite_uint32(zeros, M, fp);  /* numbers of parents */
+        fwrite_buf("", 0, fp);        /* metadata */
+
+        free(zeros);
+        free(counts);
+        free(hits);
+        PrintBuf_delete(&term_ids);
+        PrintBuf_delete(&descriptions);
+}
+
+
+/* Compiles GMT files into an ETD database. Each GMT file forms a namespace
+   (files with the same namespace label are merged) and its gene names are
+   resolved against the NCBI gene_info file if one is given. Names that are
+   not found become genes without IDs. The database is written in version
+   1 layout to a temporary file and then converted to version 2. */
+void ETDTermDb_build(const char *out_filename, const char *db_name,
+                     const char *gene_info_filename, uint32_t tax_id,
+                     const char **namespaces, const char **gmt_filenames,
+                     int num_files)
+{
+        ETDGenes *genes = ETDGenes_init();
+        EntityDb *entity_db = NULL;
+        CVTermDb *term_db = NULL;
+        TermMappingDb *mapping_db = NULL;
+        Entity *entity;
+        const char **ns_labels;
+        uint32_t *entity2gene;
+        uint32_t *seen;
+        uint32_t stamp = 0;
+        uint32_t num_added = 0;
+        uint32_t tmp;
+        uint32_t i;
+        int num_ns = 0;
+        int k;
+        PrintBuf buf;
+        PrintBuf tmp_filename;
+        FILE *fp;
+
+        if (gene_info_filename != NULL) {
+                ETDGenes_read_gene_info(genes, gene_info_filename, &tax_id);
+        }
+        GMT_enrichment_context_multi(namespaces, gmt_filenames, num_files, &entity_db,
+                                     &term_db, &mapping_db);
+
+        /* resolve GMT gene names */
+        entity2gene = malloc_(((size_t) entity_db->num_entities + 1) * sizeof(uint32_t));
+        for (i=0; i < entity_db->num_entities; i++) {
+                entity = entity_db->get_entity_from_index(entity_db, i);
+                if (! ETDGenes_find(genes, entity->symbol, entity2gene + i)) {
+                        entity2gene[i] = ETDGenes_add(genes, 0, entity->symbol, "");
+                        num_added++;
+                }
+        }
+        if (gene_info_filename != NULL && num_added > 0) {
+                fprintf(stderr, "Warning: %ld gene names from GMT files were not found in %s"
+                        " and were added without gene IDs.\n", (long) num_added,
+                        gene_info_filename);
+        }
+
+        /* namespaces in order of first appearance */
+        ns_labels = malloc_(num_files * sizeof(char *));
+        for (k=0; k < num_files; k++) {
+                for (i=0; i < num_ns && strcmp(ns_labels[i], namespaces[k]); i++);
+                if (i == num_ns) {
+                        ns_labels[num_ns++] = namespaces[k];
+                }
+        }
+
+        (void) PrintBuf_init(&tmp_filename);
+        PrintBuf_printf(&tmp_filename, 0, "%s.tmp", out_filename);
+	if ((fp = fopen(tmp_filename.buf, "wb")) == NULL) {
+		fprintf(stderr, "Could not open file %s.\n", tmp_filename.buf);
+		exit(EXIT_FAILURE);
+	}
+        fwrite_("EXTERMDB", 1, 8, fp);
+        tmp = EXTERMDB_MAGIC;
+        fwrite_uint32(&tmp, 1, fp);
+        fwrite_buf(db_name, strlen(db_name) + 1, fp);
+        tmp = num_ns;
+        fwrite_uint32(&tmp, 1, fp);
+        (void) PrintBuf_init(&buf);
+        for (k=0; k < num_ns; k++) {
+                append_string(&buf, ns_labels[k]);
+        }
+        fwrite_buf(buf.buf, buf.len, fp);
+        PrintBuf_delete(&buf);
+
+        ETDGenes_write(genes, (gene_info_filename != NULL) ? gene_info_filename : "",
+                       tax_id, fp);
+        seen = calloc_((size_t) genes->num_genes + 1, sizeof(uint32_t));
+        for (k=0; k < num_ns; k++) {
+                ETDTermDb_write_plain_ns(term_db, mapping_db, ns_labels[k], entity2gene,
+                                         seen, &stamp, fp);
+        }
+        if (fclose(fp) != 0) {
+		fprintf(stderr, "Could not write file %s.\n", tmp_filename.buf);
+		exit(EXIT_FAILURE);
+        }
+
+        ETDTermDb_write_v2(tmp_filename.buf, out_filename);
+        remove(tmp_filename.buf);
+
+        PrintBuf_delete(&tmp_filename);
+        free(seen);
+        free(entity2gene);
+        free(ns_labels);
+        ETDGenes_delete(genes);
+        entity_db->delete(entity_db);
+        term_db->delete(term_db);
+        mapping_db->delete(mapping_db);
+}
@@ -39,11 +39,23 @@
 #include "hashtable.h"
 #include "cvterm.h"
 #include "enrich.h"
+#include "taskpool.h"
 
-#define EXTERMDB_MAGIC 1644632861U
-#define KEGGTERMDB_MAGIC 2264738403U
-#define GOTERMDB_MAGIC 2187050528U
 #define EXTERMDB_BUF_INCR 2048
+#define EXTERMDB_SECTION_SIZE 40  /* bytes per directory entry on disk */
+#define EXTERMDB_SECTION_ALIGN 8
+#define EXTERMDB_NUM_GENE_INDEXES 3
+#define EXTERMDB_HITS_PER_TASK (1 << 20)
+
+/* Index section tags, in the order returned by NCBIGenesDb_pack_indexes */
+static const char *gene_index_tags[EXTERMDB_NUM_GENE_INDEXES] = {
+        "GENEIDX ", "ALIASIDX", "CNFLTIDX"
+};
+static const char term_index_tag[] = "TERMIDX ";
+
+
+static
+int ETDTermDb_find_ns(ETDTermDb *term_db, uint32_t i);
 
 
 /* Term database */
@@ -52,62 +64,284 @@ void ETDTermDb_delete(CVTermDb *term_db_)
 {
 	int i;
 	ETDTermDb *term_db = (ETDTermDb *) term_db_;
+        ETDNamespace *ns;
 	for (i=0; i < term_db->num_terms; i++) {
-		term_db->terms[i]->delete(term_db->terms[i]);
+                /* terms of loaded namespaces are in term_arena */
+                if (term_db->terms[i] != NULL && ETDTermDb_find_ns(term_db, i) < 0) {
+                        term_db->terms[i]->delete(term_db->terms[i]);
+                }
 	}
+        Arena_delete(&term_db->term_arena);
 	free(term_db->terms);
 	term_db->terms = NULL;
 	term_db->num_terms = 0;
 	term_db->max_terms = 0;
-        free(term_db->db_name);
+        BinReader_free(term_db->reader, term_db->db_name);
         free(term_db->namespaces);
-        free(term_db->namespace_buf);
+        BinReader_free(term_db->reader, term_db->namespace_buf);
 	for (i=0; i < term_db->num_namespaces; i++) {
-                free(term_db->termid_bufs[i]);
-                free(term_db->desc_bufs[i]);
-                free(term_db->edgetype_bufs[i]);
-                free(term_db->metadata_bufs[i]);
+                ns = term_db->ns_data + i;
+                BinReader_free(term_db->reader, ns->flags);
+                BinReader_free(term_db->reader, ns->num_parents);
+                BinReader_free(term_db->reader, ns->parent_terms);
+                BinReader_free(term_db->reader, ns->parent_edgetypes);
+                free(ns->edgetypes);
+                free(ns->term_id_offsets);
+                free(ns->desc_offsets);
+                free(ns->link_offsets);
+                BinReader_free(term_db->reader, term_db->termid_bufs[i]);
+                BinReader_free(term_db->reader, term_db->desc_bufs[i]);
+                BinReader_free(term_db->reader, term_db->edgetype_bufs[i]);
+                BinReader_free(term_db->reader, term_db->metadata_bufs[i]);
 	}
         free(term_db->termid_bufs);
         free(term_db->desc_bufs);
         free(term_db->edgetype_bufs);
         free(term_db->metadata_bufs);
+        free(term_db->sections);
+        if (term_db->termid_indexes != NULL) {
+                for (i=0; i < term_db->num_namespaces; i++) {
+                        StrIndex_delete(term_db->termid_indexes[i], term_db->reader);
+                }
+                free(term_db->termid_indexes);
+        }
+        free(term_db->ns_offsets);
+        free(term_db->ns_data);
 	hashtable_destroy(term_db->termid2index, 0);
+        BinReader_release(term_db->reader);
 	free(term_db);
 }
 
 
+/* Fills offsets with the positions of n consecutive strings in buf */
+static
+void strbuf2offsets(uint32_t *offsets, const char *buf, uint32_t n)
+{
+        const char *cur = buf;
+        uint32_t i;
+        for (i=0; i < n; i++) {
+                offsets[i] = (uint32_t) (cur - buf);
+                cur += strlen(cur) + 1;
+        }
+}
+
+
+/* Builds the string and link offsets of a loaded namespace on its first
+   use */
+static
+ETDNamespace *ETDTermDb_decode_ns(ETDTermDb *term_db, int cns)
+{
+        ETDNamespace *ns = term_db->ns_data + cns;
+        uint32_t M = term_db->num_ns_terms[cns];
+        uint32_t i;
+        size_t n;
+
+        if (ns->term_id_offsets != NULL) {
+                return ns;
+        }
+        ns->edgetypes = malloc_((ns->num_edgetypes + 1) * sizeof(char *));
+        strbuf2array(ns->edgetypes, term_db->edgetype_bufs[cns], ns->num_edgetypes);
+        ns->term_id_offsets = malloc_(((size_t) M + 1) * sizeof(uint32_t));
+        strbuf2offsets(ns->term_id_offsets, term_db->termid_bufs[cns], M);
+        ns->desc_offsets = malloc_(((size_t) M + 1) * sizeof(uint32_t));
+        strbuf2offsets(ns->desc_offsets, term_db->desc_bufs[cns], M);
+        ns->link_offsets = malloc_(((size_t) M + 1) * sizeof(size_t));
+        for (n=0, i=0; i < M; i++) {
+                ns->link_offsets[i] = n;
+                n += ns->num_parents[i];
+        }
+        return ns;
+}
+
+
+/* Returns the loaded namespace containing term i, or -1 */
+static
+int ETDTermDb_find_ns(ETDTermDb *term_db, uint32_t i)
+{
+        int cns;
+        for (cns=0; cns < term_db->num_namespaces; cns++) {
+                if (term_db->ns_data[cns].term_init != NULL
+                    && i >= term_db->ns_offsets[cns]
+                    && i - term_db->ns_offsets[cns] < term_db->num_ns_terms[cns]) {
+                        return cns;
+                }
+        }
+        return -1;
+}
+
+
+static
+CVTerm *ETDTermDb_get_term_from_index(CVTermDb *term_db_, uint32_t i);
+
+
+/* Creates the term object for term i together with its ancestors. The
+   term is stored before its parents are resolved, so that malformed
+   cyclic graphs cannot cause infinite recursion. */
+static
+CVTerm *ETDTermDb_make_term(ETDTermDb *term_db, uint32_t i)
+{
+        int cns = ETDTermDb_find_ns(term_db, i);
+        ETDNamespace *ns;
+        ETDTerm *term;
+        uint32_t M;
+        uint32_t j;
+        uint32_t k;
+        uint32_t p;
+        uint32_t e;
+        size_t link;
+
+        if (cns < 0) {
+                return NULL;
+        }
+        ns = ETDTermDb_decode_ns(term_db, cns);
+        M = term_db->num_ns_terms[cns];
+        j = i - term_db->ns_offsets[cns];
+
+        term = (ETDTerm *) ns->term_init(
+                Arena_alloc(&term_db->term_arena,
+                            (ns->term_init == ETDTerm_init) ? sizeof(ETDTerm)
+                            : sizeof(KEGGTerm)));
+        term->namespace = term_db->namespaces[cns];
+        term->term_id = term_db->termid_bufs[cns] + ns->term_id_offsets[j];
+        term->description = term_db->desc_bufs[cns] + ns->desc_offsets[j];
+        term->flag = ns->flags[j];
+        if (ns->term_init == KEGGTerm_init) {
+                ((KEGGTerm *) term)->org_prefix = term_db->metadata_bufs[cns];
+        }
+        term_db->terms[i] = (CVTerm *) term;
+
+        link = ns->link_offsets[j];
+        if (ns->num_parents[j] > 0) {
+                if (ns->num_parents[j] > ns->num_links - link) {
+                        fprintf(stderr, "Invalid ETD format database.\n");
+                        exit(EXIT_FAILURE);
+                }
+                term->parents = Arena_alloc(&term_db->term_arena,
+                                            ns->num_parents[j] * sizeof(CVTerm *));
+                term->edgetypes = Arena_alloc(&term_db->term_arena,
+                                              ns->num_parents[j] * sizeof(char *));
+                for (k=0; k < ns->num_parents[j]; k++) {
+                        p = ns->parent_terms[link + k];
+                        e = ns->parent_edgetypes[link + k];
+                        if (p >= M || e >= ns->num_edgetypes) {
+                                fprintf(stderr, "Invalid ETD format database.\n");
+                                exit(EXIT_FAILURE);
+                        }
+                        term->parents[k] = ETDTermDb_get_term_from_index(
+                                (CVTermDb *) term_db, term_db->ns_offsets[cns] + p);
+                        term->edgetypes[k] = ns->edgetypes[e];
+                }
+                term->num_parents = ns->num_parents[j];
+        }
+        return (CVTerm *) term;
+}
+
+
 static
 CVTerm *ETDTermDb_get_term_from_index(CVTermDb *term_db_, uint32_t i)
 {
 	ETDTermDb *term_db = (ETDTermDb *) term_db_;
 	if (i < term_db->num_terms) {
+                if (term_db->terms[i] == NULL) {
+                        return ETDTermDb_make_term(term_db, i);
+                }
 		return term_db->terms[i];
 	}
 	return NULL;
 }
 
 
+/* Loaded namespaces are found from the index range of the term, so that
+   no term object is created */
+static
+const char *ETDTermDb_get_namespace_from_index(CVTermDb *term_db_, uint32_t i)
+{
+	ETDTermDb *term_db = (ETDTermDb *) term_db_;
+        int cns;
+
+        if (i >= term_db->num_terms) {
+                return NULL;
+        }
+        cns = ETDTermDb_find_ns(term_db, i);
+        if (cns >= 0) {
+                return term_db->namespaces[cns];
+        }
+        if (term_db->terms[i] != NULL) {
+                return term_db->terms[i]->namespace;  /* added from a GMT file */
+        }
+        return NULL;
+}
+
+
+/* Adds the term IDs of loaded namespaces without a prebuilt index to
+   termid2index. Done on the first lookup, since most runs need none. */
+static
+void ETDTermDb_index_term_ids(ETDTermDb *term_db)
+{
+        ETDNamespace *ns;
+        const char *term_id;
+        uint32_t j;
+        uint32_t i;
+        int cns;
+
+        for (cns=0; cns < term_db->num_namespaces; cns++) {
+                if (term_db->ns_data[cns].term_init == NULL
+                    || term_db->termid_indexes[cns] != NULL) {
+                        continue;
+                }
+                ns = ETDTermDb_decode_ns(term_db, cns);
+                for (j=0; j < term_db->num_ns_terms[cns]; j++) {
+                        i = term_db->ns_offsets[cns] + j;
+                        term_id = term_db->termid_bufs[cns] + ns->term_id_offsets[j];
+                        if (! hashtable_insert(term_db->termid2index,
+                                               strdup_(term_id),
+                                               (void *) ((intptr_t) i + 1))) {
+                                fprintf(stderr, "Could not insert term %s.\n",
+                                        term_id);
+                                exit(EXIT_FAILURE);
+                        }
+                }
+        }
+        term_db->term_ids_indexed = 1;
+}
+
+
 static
 int ETDTermDb_get_index_from_term_id(CVTermDb *term_db_, char *term_id)
 {
 	ETDTermDb *term_db = (ETDTermDb *) term_db_;
-	void *indx = hashtable_search(term_db->termid2index, term_id);
-	if (indx == NULL) {
-                return -1;
+	void *indx;
+        uint32_t j;
+        int i;
+
+        if (!term_db->term_ids_indexed) {
+                ETDTermDb_index_term_ids(term_db);
+        }
+        indx = hashtable_search(term_db->termid2index, term_id);
+	if (indx != NULL) {
+                return  (int) ((intptr_t) indx) - 1;
+        }
+        for (i=0; i < term_db->num_namespaces; i++) {
+                if (term_db->termid_indexes[i] != NULL
+                    && StrIndex_search(term_db->termid_indexes[i], term_id, &j)) {
+                        if (j >= term_db->num_ns_terms[i]) {
+                                fprintf(stderr, "Invalid database index.\n");
+                                exit(EXIT_FAILURE);
+                        }
+                        return (int) (term_db->ns_offsets[i] + j);
+                }
         }
-	return  (int) ((intptr_t) indx) - 1;
+        return -1;
 }
 
 
 static
 CVTerm *ETDTermDb_get_term_from_term_id(CVTermDb *term_db_, char *term_id)
 {
-	ETDTermDb *term_db = (ETDTermDb *) term_db_;
         int i = ETDTermDb_get_index_from_term_id(term_db_, (char *) term_id);
         CVTerm *term;
         if (i > 0) {
-                term = *(term_db->terms + i);
+                term = ETDTermDb_get_term_from_index(term_db_, i);
                 return term;
         }
         return NULL;
@@ -145,45 +379,95 @@ int ETDTermDb_insert_term(CVTermDb *term_db_, const char *term_id,
 }
 
 
+/* Version 1 files store the gene_info block and the namespaces one after
+   another, so reaching any namespace requires decoding everything before
+   it. Version 2 files add a directory after the header that records the
+   position, size and counts of every block. The blocks themselves are
+   encoded identically in both versions. */
 static
-FILE *ETDTermDb_open(const char *etd_filename)
+BinReader *ETDTermDb_open(const char *etd_filename, uint32_t *version)
 {
         char header[8];
         uint32_t magic;
-        FILE *fp = fopen(etd_filename, "r");
-	if (fp == NULL) {
+        BinReader *reader = BinReader_open(etd_filename);
+	if (reader == NULL) {
 		fprintf(stderr, "Could not open file %s.\n", etd_filename);
 		exit(EXIT_FAILURE);
 	}
-        fread_(header, 1, 8, fp);
-        fread_uint32(&magic, 1, fp);
-        if (memcmp(header, "EXTERMDB", 8) || (magic != EXTERMDB_MAGIC)) {
+        if (reader->size < 12) {
                 fprintf(stderr, "%s is not a valid ETD format database.\n",
                         etd_filename);
                 exit(EXIT_FAILURE);
         }
-        return fp;
+        BinReader_read(reader, header, 8);
+        BinReader_read_uint32(reader, &magic, 1);
+        if (memcmp(header, "EXTERMDB", 8)
+            || ((magic != EXTERMDB_MAGIC) && (magic != EXTERMDB_V2_MAGIC))) {
+                fprintf(stderr, "%s is not a valid ETD format database.\n",
+                        etd_filename);
+                exit(EXIT_FAILURE);
+        }
+        *version = (magic == EXTERMDB_MAGIC) ? 1 : 2;
+        return reader;
+}
+
+
+/* String buffers of the term database point into the file image */
+static
+void ETDTermDb_read_directory(BinReader *reader, ETDTermDb *term_db)
+{
+        uint32_t num_sections;
+        ETDSection *sec;
+        int i;
+
+        BinReader_read_uint32(reader, &num_sections, 1);
+        if (num_sections < term_db->num_namespaces + 1) {
+                fprintf(stderr, "Invalid ETD format database.\n");
+                exit(EXIT_FAILURE);
+        }
+        term_db->num_sections = num_sections;
+        term_db->sections = malloc_(num_sections * sizeof(ETDSection));
+        for (i=0; i < num_sections; i++) {
+                sec = term_db->sections + i;
+                BinReader_read(reader, sec->tag, 8);
+                BinReader_read_uint64(reader, &sec->offset, 1);
+                BinReader_read_uint64(reader, &sec->size, 1);
+                BinReader_read_uint32(reader, &sec->magic, 1);
+                BinReader_read_uint32(reader, &sec->num_items, 1);
+                BinReader_read_uint64(reader, &sec->num_hits, 1);
+                if ((i <= term_db->num_namespaces
+                     && memcmp(sec->tag, (i == 0) ? "NCBIGENE" : "TERMDBNS", 8))
+                    || (sec->offset > reader->size)
+                    || (sec->size > reader->size - sec->offset)) {
+                        fprintf(stderr, "Invalid ETD format database.\n");
+                        exit(EXIT_FAILURE);
+                }
+        }
 }
 
 
 static
-ETDTermDb *ETDTermDb_init(FILE *fp)
+ETDTermDb *ETDTermDb_init(BinReader *reader, uint32_t version)
 {
 	ETDTermDb *term_db;
         uint32_t bufsize;
 
         term_db = calloc_(1, sizeof(ETDTermDb));
+        Arena_init(&term_db->term_arena);
 	term_db->delete = ETDTermDb_delete;
 	term_db->get_term_from_index = ETDTermDb_get_term_from_index;
+        term_db->get_namespace_from_index = ETDTermDb_get_namespace_from_index;
 	term_db->get_index_from_term_id = ETDTermDb_get_index_from_term_id;
 	term_db->get_term_from_term_id = ETDTermDb_get_term_from_term_id;
         term_db->insert_term = ETDTermDb_insert_term;
 	term_db->termid2index = create_hashtable(INIT_MAX_TERMS, hash_from_string, str_equal);
+        term_db->reader = reader;
+        BinReader_retain(reader);
 
-        term_db->db_name = fread_buf(fp, &bufsize);
-        fread_uint32(&term_db->num_namespaces, 1, fp);
+        term_db->db_name = BinReader_buf(reader, &bufsize);
+        BinReader_read_uint32(reader, &term_db->num_namespaces, 1);
         term_db->namespaces = malloc_(term_db->num_namespaces * sizeof(char *));
-        term_db->namespace_buf = fread_buf(fp, &bufsize);
+        term_db->namespace_buf = BinReader_buf(reader, &bufsize);
         strbuf2array(term_db->namespaces, term_db->namespace_buf,
                      term_db->num_namespaces);
 
@@ -192,21 +476,29 @@ ETDTermDb *ETDTermDb_init(FILE *fp)
         term_db->desc_bufs = calloc_(1, term_db->num_namespaces * sizeof(char *));
         term_db->edgetype_bufs = calloc_(1, term_db->num_namespaces * sizeof(char *));
         term_db->metadata_bufs = calloc_(1, term_db->num_namespaces * sizeof(char *));
+        term_db->termid_indexes = calloc_(1, term_db->num_namespaces * sizeof(StrIndex *));
+        term_db->ns_offsets = calloc_(1, term_db->num_namespaces * sizeof(uint32_t));
+        term_db->ns_data = calloc_(term_db->num_namespaces + 1, sizeof(ETDNamespace));
 
+        term_db->version = version;
+        if (version >= 2) {
+                ETDTermDb_read_directory(reader, term_db);
+        }
 	return term_db;
 }
 
 
 static
-uint32_t ETDTermDb_read_ns_header(FILE *fp)
+uint32_t ETDTermDb_read_ns_header(BinReader *reader)
 {
         char header[8];
         uint32_t magic;
-        fread_(header, 1, 8, fp);
-        fread_uint32(&magic, 1, fp);
+        BinReader_read(reader, header, 8);
+        BinReader_read_uint32(reader, &magic, 1);
         if (memcmp(header, "TERMDBNS", 8)
             || ((magic != KEGGTERMDB_MAGIC)
-                && (magic != GOTERMDB_MAGIC)) ) {
+                && (magic != GOTERMDB_MAGIC)
+                && (magic != PLAINTERMDB_MAGIC)) ) {
                 fprintf(stderr, "Invalid ETD format database.\n");
                 exit(EXIT_FAILURE);
         }
@@ -214,132 +506,99 @@ uint32_t ETDTermDb_read_ns_header(FILE *fp)
 }
 
 
+/* Reserves space for the hits of the namespace in mapping_db and keeps
+   the rest of its data in the file image until the terms are used. The
+   hits themselves are copied later from *hits_src to position *hits_dest
+   of mapping_db->hits. */
 static
-int ETDTermDb_read_ns_data(FILE *fp, ETDTermDb *term_db, TermMappingDb *mapping_db,
-                           CVTerm *(*term_init_func) (CVTerm *), int cns)
+int ETDTermDb_read_ns_data(BinReader *reader, ETDTermDb *term_db, TermMappingDb *mapping_db,
+                           uint32_t magic, int cns, const char **hits_src,
+                           TermOffset *hits_dest, size_t *hits_count)
 {
+        ETDNamespace *ns = term_db->ns_data + cns;
         int term_offset = term_db->num_terms;
-        uint32_t num_edgetypes;
-        char **tmp_edgetypes;
         uint32_t bufsize;
         uint32_t M;
         uint32_t *tmp_counts;
-        uint32_t tmp;
-        int i;
-        int j;
-        char *cur;
-        ETDTerm *term;
+        uint32_t i;
 
-        fread_uint32(&num_edgetypes, 1, fp);
-        term_db->edgetype_bufs[cns] = fread_buf(fp, &bufsize);
-        tmp_edgetypes = malloc_(num_edgetypes * sizeof(char *));
-        strbuf2array(tmp_edgetypes, term_db->edgetype_bufs[cns], num_edgetypes);
+        switch (magic) {
+        case KEGGTERMDB_MAGIC:
+                ns->term_init = KEGGTerm_init;
+                break;
+        case GOTERMDB_MAGIC:
+                ns->term_init = GOTerm_init;
+                break;
+        default:
+                ns->term_init = ETDTerm_init;
+        }
+        term_db->ns_offsets[cns] = term_offset;
+        BinReader_read_uint32(reader, &ns->num_edgetypes, 1);
+        term_db->edgetype_bufs[cns] = BinReader_buf(reader, &bufsize);
 
-        fread_uint32(&M, 1, fp);
-        tmp_counts = malloc_(M * sizeof(uint32_t));
+        BinReader_read_uint32(reader, &M, 1);
         term_db->num_ns_terms[cns] = M;
-
 	if (M + term_db->num_terms  >= term_db->max_terms) {
 		term_db->max_terms += M;
 		term_db->terms = realloc_(term_db->terms,
 					  term_db->max_terms*sizeof(CVTerm *));
 	}
+        memset(term_db->terms + term_offset, 0, M * sizeof(CVTerm *));
         term_db->num_terms += M;
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term_db->terms[i] = term_init_func(NULL);
-                term = (ETDTerm *) term_db->terms[i];
-                term->namespace = term_db->namespaces[cns];
-                fread_uint32(&term->flag, 1, fp);
-        }
-
-        /* If this is too slow, we can later replace it with inlined code for bulk insertion */
-        fread_uint32(tmp_counts, M, fp);
-        for (i=0; i < M; i++) {
-                mapping_db->insert_new_mapping(mapping_db);
-                for (j=0; j < tmp_counts[i]; j++) {
-                        fread_uint32(&tmp, 1, fp);
-                        mapping_db->insert_hit(mapping_db, tmp);
-                }
-        }
+        ns->flags = BinReader_uint32_array(reader, M);
+
+        /* Hits of all terms in the namespace are stored contiguously */
+        tmp_counts = malloc_(((size_t) M + 1) * sizeof(uint32_t));
+        BinReader_read_uint32(reader, tmp_counts, M);
+        *hits_dest = mapping_db->num_hits;
+        (void) TermMappingDb_append_mappings(mapping_db, tmp_counts, M);
+        *hits_count = mapping_db->num_hits - *hits_dest;
+        *hits_src = reader->data + reader->pos;
+        BinReader_skip(reader, *hits_count * sizeof(uint32_t));
         free(tmp_counts);
 
-        term_db->termid_bufs[cns] = fread_buf(fp, &bufsize);
-        cur = term_db->termid_bufs[cns];
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term_db->terms[i]->term_id = cur;
-                cur += (strlen(cur) + 1);
-                if (! hashtable_insert(term_db->termid2index,
-                                       strdup_(term_db->terms[i]->term_id),
-                                       (void *) ((intptr_t) i + 1))) {
-                        fprintf(stderr, "Could not insert term %s.\n",
-                                term_db->terms[i]->term_id);
-                        exit(EXIT_FAILURE);
-                }
-        }
-
-        term_db->desc_bufs[cns] = fread_buf(fp, &bufsize);
-        cur = term_db->desc_bufs[cns];
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term_db->terms[i]->description = cur;
-                cur += (strlen(cur) + 1);
-        }
-
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term = (ETDTerm *) term_db->terms[i];
-                fread_uint32(&tmp, 1, fp);
-                term->num_parents = tmp;
-                if (tmp > 0) {
-                        term->parents = malloc_(tmp*sizeof(CVTerm *));
-                        term->edgetypes = malloc_(tmp*sizeof(const char *));
-                }
-        }
-
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term = (ETDTerm *) term_db->terms[i];
-                for (j=0; j < term->num_parents; j++) {
-                        fread_uint32(&tmp, 1, fp);
-                        term->parents[j] = term_db->terms[term_offset + tmp];
-                }
-        }
+        term_db->termid_bufs[cns] = BinReader_buf(reader, &bufsize);
+        term_db->desc_bufs[cns] = BinReader_buf(reader, &bufsize);
 
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term = (ETDTerm *) term_db->terms[i];
-                for (j=0; j < term->num_parents; j++) {
-                        fread_uint32(&tmp, 1, fp);
-                        term->edgetypes[j] = tmp_edgetypes[tmp];
-                }
+        ns->num_parents = BinReader_uint32_array(reader, M);
+        for (ns->num_links=0, i=0; i < M; i++) {
+                ns->num_links += ns->num_parents[i];
         }
-        free(tmp_edgetypes);
+        ns->parent_terms = BinReader_uint32_array(reader, ns->num_links);
+        ns->parent_edgetypes = BinReader_uint32_array(reader, ns->num_links);
 
-        term_db->metadata_bufs[cns] = fread_buf(fp, &bufsize);
+        term_db->metadata_bufs[cns] = BinReader_buf(reader, &bufsize);
         return term_offset;
 }
 
 
+/* Moves past the namespace data, reporting its term and hit counts */
 static
-void ETDTermDb_skip_ns_data(FILE *fp)
+void ETDTermDb_skip_ns_data(BinReader *reader, uint32_t *M_, uint64_t *num_hits)
 {
         uint32_t tmp;
         uint32_t M;
-        uint32_t n;
+        size_t n;
         int i;
-        fseek(fp, sizeof(uint32_t), SEEK_CUR);
-        fskip_buf(fp);
-        fread_uint32(&M, 1, fp);
-        fseek(fp, M * sizeof(uint32_t), SEEK_CUR);
+        BinReader_skip(reader, sizeof(uint32_t));
+        BinReader_skip_buf(reader);
+        BinReader_read_uint32(reader, &M, 1);
+        BinReader_skip(reader, (size_t) M * sizeof(uint32_t));
         for (n=0, i=0; i < M; i++) {
-                fread_uint32(&tmp, 1, fp);
+                BinReader_read_uint32(reader, &tmp, 1);
                 n += tmp;
         }
-        fseek(fp, n * sizeof(uint32_t), SEEK_CUR);
-        fskip_buf(fp);
-        fskip_buf(fp);
+        BinReader_skip(reader, n * sizeof(uint32_t));
+        *M_ = M;
+        *num_hits = n;
+        BinReader_skip_buf(reader);
+        BinReader_skip_buf(reader);
         for (n=0, i=0; i < M; i++) {
-                fread_uint32(&tmp, 1, fp);
+                BinReader_read_uint32(reader, &tmp, 1);
                 n += tmp;
         }
-        fseek(fp, 2 * n * sizeof(uint32_t), SEEK_CUR);
-        fskip_buf(fp);
+        BinReader_skip(reader, 2 * n * sizeof(uint32_t));
+        BinReader_skip_buf(reader);
 }
 
 static
@@ -354,14 +613,52 @@ int is_excluded(const char *namespace, const char **excluded_namespaces, int n)
         return 0;
 }
 
+/* Returns the directory number of the index section with the given tag
+   for section block, or -1 if there is none */
 static
-void ETDTermDb_update_KEGG_terms(ETDTermDb *term_db, int cns, int term_offset)
+int ETDTermDb_find_index(ETDTermDb *term_db, const char *tag, uint32_t block)
 {
         int i;
-        KEGGTerm *term;
-        for (i=term_offset; i < term_db->num_terms; i++) {
-                term = (KEGGTerm *) term_db->terms[i];
-                term->org_prefix = term_db->metadata_bufs[cns];
+        for (i=term_db->num_namespaces+1; i < term_db->num_sections; i++) {
+                if (!memcmp(term_db->sections[i].tag, tag, 8)
+                    && term_db->sections[i].magic == block) {
+                        return i;
+                }
+        }
+        return -1;
+}
+
+
+/* Loading work that can proceed concurrently once all blocks have been
+   located: decoding the gene block (the only task that uses the reader)
+   and copying ranges of hits into the term mapping database. */
+typedef struct _ETDLoadTask_s {
+        BinReader *reader;  /* NULL for hit copies */
+        uint64_t gene_pos;
+        IntIndex *geneid_index;
+        StrIndex *alias_index;
+        StrIndex *conflict_index;
+        NCBIGenesDb *entity_db;
+        TermMappingDb *mapping_db;
+        TermOffset dest;
+        const char *src;
+        size_t count;
+} ETDLoadTask;
+
+
+static
+void ETDLoadTask_run(void *task_)
+{
+        ETDLoadTask *task = (ETDLoadTask *) task_;
+        if (task->reader != NULL) {
+                BinReader_seek(task->reader, task->gene_pos);
+                task->entity_db = NCBIGenesDb_init(task->reader, task->geneid_index,
+                                                   task->alias_index,
+                                                   task->conflict_index);
+        }
+        else {
+                copy_le_uint32(task->mapping_db->hits + task->dest, task->src,
+                               task->count);
         }
 }
 
@@ -370,45 +667,103 @@ int ETD_enrichment_context(const char *etd_filename, EntityDb **entity_db_,
 			   CVTermDb **term_db_, TermMappingDb **mapping_db_,
                            const char **excluded_namespaces, int num_excluded)
 {
-        FILE *fp;
+        BinReader *reader;
         NCBIGenesDb *entity_db;
         ETDTermDb *term_db;
         TermMappingDb *mapping_db = *mapping_db_;
+        uint32_t version;
         uint32_t magic;
+        uint32_t M;
+        uint64_t num_hits;
+        ETDLoadTask *tasks;
+        ETDLoadTask *task;
+        size_t num_tasks;
+        size_t max_tasks;
+        const char *src;
+        TermOffset dest;
+        size_t count;
+        size_t n;
+        int k[EXTERMDB_NUM_GENE_INDEXES];
         int i;
-        int x;  /* term_offset */
+        int x;  /* index section */
 
-        fp = ETDTermDb_open(etd_filename);
+        reader = ETDTermDb_open(etd_filename, &version);
 
         /* read ETD file header */
-        term_db = ETDTermDb_init(fp);
-
-        /* read NCBI Genes database */
-        entity_db = NCBIGenesDb_init(fp);
+        term_db = ETDTermDb_init(reader, version);
+
+        /* locate NCBI Genes database, using its prebuilt indexes if present */
+        max_tasks = 1 + term_db->num_namespaces;
+        tasks = calloc_(max_tasks, sizeof(ETDLoadTask));
+        num_tasks = 1;
+        tasks[0].reader = reader;
+        tasks[0].gene_pos = reader->pos;
+        for (i=0; i < EXTERMDB_NUM_GENE_INDEXES; i++) {
+                k[i] = ETDTermDb_find_index(term_db, gene_index_tags[i], 0);
+        }
+        if (k[0] >= 0 && k[1] >= 0 && k[2] >= 0) {
+                BinReader_seek(reader, term_db->sections[k[0]].offset);
+                tasks[0].geneid_index = IntIndex_load(reader);
+                BinReader_seek(reader, term_db->sections[k[1]].offset);
+                tasks[0].alias_index = StrIndex_load(reader);
+                BinReader_seek(reader, term_db->sections[k[2]].offset);
+                tasks[0].conflict_index = StrIndex_load(reader);
+        }
+        if (term_db->sections != NULL) {
+                tasks[0].gene_pos = term_db->sections[0].offset;
+        }
+        else {
+                (void) NCBIGenesDb_skip(reader);
+        }
 
-        /* read namespaces */
+        /* locate namespaces and reserve space for their hits */
 	if (mapping_db == NULL) {
 		mapping_db = TermMappingDb_init();
 	}
         for (i=0; i < term_db->num_namespaces; i++) {
-                magic = ETDTermDb_read_ns_header(fp);
+                if (term_db->sections != NULL) {
+                        /* excluded namespaces are never touched */
+                        if (is_excluded(term_db->namespaces[i],
+                                        excluded_namespaces, num_excluded)) {
+                                continue;
+                        }
+                        x = ETDTermDb_find_index(term_db, term_index_tag, i+1);
+                        if (x >= 0) {
+                                BinReader_seek(reader, term_db->sections[x].offset);
+                                term_db->termid_indexes[i] = StrIndex_load(reader);
+                        }
+                        BinReader_seek(reader, term_db->sections[i+1].offset);
+                }
+                magic = ETDTermDb_read_ns_header(reader);
                 if (is_excluded(term_db->namespaces[i], excluded_namespaces,
                                 num_excluded)) {
-                        ETDTermDb_skip_ns_data(fp);
-                }
-                else if (magic == KEGGTERMDB_MAGIC) {
-                        x = ETDTermDb_read_ns_data(fp, term_db, mapping_db,
-                                                   KEGGTerm_init, i);
-                        /* need to add org_prefix to terms */
-                        ETDTermDb_update_KEGG_terms(term_db, i, x);
+                        ETDTermDb_skip_ns_data(reader, &M, &num_hits);
                 }
-                else {  /* GOTERMDB_MAGIC */
-                        (void) ETDTermDb_read_ns_data(fp, term_db, mapping_db,
-                                                      GOTerm_init, i);
-                        /* No need for further processing */
+                else {
+                        (void) ETDTermDb_read_ns_data(reader, term_db, mapping_db,
+                                                      magic, i, &src, &dest, &count);
+                        /* split large namespaces to balance the threads */
+                        for (n=0; n < count; n += EXTERMDB_HITS_PER_TASK) {
+                                if (num_tasks >= max_tasks) {
+                                        max_tasks *= 2;
+                                        tasks = realloc_(tasks, max_tasks * sizeof(ETDLoadTask));
+                                }
+                                task = tasks + num_tasks++;
+                                memset(task, 0, sizeof(ETDLoadTask));
+                                task->mapping_db = mapping_db;
+                                task->dest = dest + n;
+                                task->src = src + n * sizeof(uint32_t);
+                                task->count = min(count - n, EXTERMDB_HITS_PER_TASK);
+                        }
                 }
         }
-	fclose(fp);
+
+        /* decode genes and copy hits */
+        run_tasks(ETDLoadTask_run, tasks, sizeof(ETDLoadTask), num_tasks,
+                  num_worker_threads());
+        entity_db = tasks[0].entity_db;
+        free(tasks);
+        BinReader_release(reader);
 
 	*entity_db_ = (EntityDb *) entity_db;
 	*term_db_ = (CVTermDb *) term_db;
@@ -418,6 +773,28 @@ int ETD_enrichment_context(const char *etd_filename, EntityDb **entity_db_,
 }
 
 
+/* Reads the summary of a version 2 database from its directory and the
+   gene_info block header, without loading genes or terms */
+static
+ETDTermDb *ETDTermDb_read_info(BinReader *reader, uint32_t version,
+                               const char **gene_info_file, uint32_t *tax_id)
+{
+        ETDTermDb *term_db = ETDTermDb_init(reader, version);
+        uint32_t bufsize;
+        int i;
+
+        BinReader_seek(reader, term_db->sections[0].offset + 12);
+        *gene_info_file = BinReader_buf(reader, &bufsize);
+        BinReader_skip(reader, sizeof(uint32_t));  /* checksum */
+        BinReader_read_uint32(reader, tax_id, 1);
+        for (i=0; i < term_db->num_namespaces; i++) {
+                term_db->num_ns_terms[i] = term_db->sections[i+1].num_items;
+                term_db->num_terms += term_db->sections[i+1].num_items;
+        }
+        return term_db;
+}
+
+
 void ETDTermDb_print_info(const char *etd_filename, FILE *fp,
                           OutputType output_type)
 {
@@ -426,6 +803,11 @@ void ETDTermDb_print_info(const char *etd_filename, FILE *fp,
         NCBIGenesDb *entity_db = NULL;
         ETDTermDb *term_db = NULL;
         TermMappingDb *mapping_db = NULL;
+        BinReader *reader;
+        uint32_t version;
+        const char *gene_info_file;
+        uint32_t tax_id;
+        uint32_t num_genes;
         int i;
         const char *fmt;
         const char *heading_fmt;
@@ -442,23 +824,33 @@ void ETDTermDb_print_info(const char *etd_filename, FILE *fp,
                 break;
         }
 
-        (void) ETD_enrichment_context(etd_filename,
-                                      (EntityDb **) &entity_db,
-                                      (CVTermDb **) &term_db,
-                                      (TermMappingDb **) &mapping_db,
-                                      NULL, 0);
-
+        reader = ETDTermDb_open(etd_filename, &version);
+        if (version >= 2) {
+                term_db = ETDTermDb_read_info(reader, version, &gene_info_file,
+                                              &tax_id);
+                num_genes = term_db->sections[0].num_items;
+        }
+        else {
+                (void) ETD_enrichment_context(etd_filename,
+                                              (EntityDb **) &entity_db,
+                                              (CVTermDb **) &term_db,
+                                              (TermMappingDb **) &mapping_db,
+                                              NULL, 0);
+                gene_info_file = entity_db->gene_info_file;
+                tax_id = entity_db->tax_id;
+                num_genes = entity_db->num_entities;
+        }
 
         fprintf(fp, heading_fmt, "EXTENDED TERM DATABASE GENERAL INFO");
 
         fprintf(fp, fmt, "Database name", term_db->db_name);
         fprintf(fp, fmt, "Database file", etd_filename);
-        fprintf(fp, fmt, "NCBI Gene info file", entity_db->gene_info_file);
+        fprintf(fp, fmt, "NCBI Gene info file", gene_info_file);
 
-        PrintBuf_printf(pbuf1, 0, "%d", entity_db->tax_id);
+        PrintBuf_printf(pbuf1, 0, "%d", tax_id);
         fprintf(fp, fmt, "NCBI Taxonomy ID", pbuf1->buf);
 
-        PrintBuf_printf(pbuf1, 0, "%d", entity_db->num_entities);
+        PrintBuf_printf(pbuf1, 0, "%d", num_genes);
         fprintf(fp, fmt, "Total Gene entries", pbuf1->buf);
 
         PrintBuf_printf(pbuf1, 0, "%d", term_db->num_terms);
@@ -476,19 +868,21 @@ void ETDTermDb_print_info(const char *etd_filename, FILE *fp,
         }
         PrintBuf_delete(pbuf1);
         PrintBuf_delete(pbuf2);
+        BinReader_release(reader);
 }
 
 
 void ETDTermDb_print_namespaces(const char *etd_filename, FILE *fp_out,
                                 OutputType output_type)
 {
-        FILE *fp_in;
+        BinReader *reader;
         ETDTermDb *term_db;
+        uint32_t version;
         int i;
 
-        fp_in = ETDTermDb_open(etd_filename);
-        term_db = ETDTermDb_init(fp_in);
-	fclose(fp_in);
+        reader = ETDTermDb_open(etd_filename, &version);
+        term_db = ETDTermDb_init(reader, version);
+        BinReader_release(reader);
 
         if (output_type == TEXT) {
                 fprintf(fp_out, "Term database contains the following namespaces:\n");
@@ -497,3 +891,240 @@ void ETDTermDb_print_namespaces(const char *etd_filename, FILE *fp_out,
                 fprintf(fp_out, "%s\n", term_db->namespaces[i]);
         }
 }
+
+
+/* Lists the genes in the order of the database file, which is the order of
+   weights in binary weights files, together with their fingerprint */
+void ETDTermDb_print_genes(const char *etd_filename, FILE *fp,
+                           OutputType output_type)
+{
+        PrintBuf *pbuf1 = PrintBuf_init(NULL);
+        EntityDb *entity_db = NULL;
+        CVTermDb *term_db = NULL;
+        TermMappingDb *mapping_db = NULL;
+        NCBIGenesDb *genes;
+        uint32_t i;
+        const char *fmt;
+        const char *heading_fmt;
+
+        switch (output_type) {
+        case TEXT:
+                fmt = "%-48.48s %s\n";
+                heading_fmt = "\n**** %s ****\n";
+                break;
+        case TAB:
+        default:
+                fmt = "%s\t%s\n";
+                heading_fmt = "#\n# %s\n#\n";
+                break;
+        }
+
+        (void) ETD_enrichment_context(etd_filename, &entity_db, &term_db, &mapping_db,
+                                      NULL, 0);
+        genes = (NCBIGenesDb *) entity_db;
+
+        fprintf(fp, heading_fmt, "GENE LIST");
+
+        PrintBuf_printf(pbuf1, 0, "%016" PRIx64, genes->fingerprint);
+        fprintf(fp, fmt, "Gene fingerprint", pbuf1->buf);
+
+        PrintBuf_printf(pbuf1, 0, "%d", genes->num_entities);
+        fprintf(fp, fmt, "Total Gene entries", pbuf1->buf);
+
+        fprintf(fp, heading_fmt, "GENES IN DATABASE ORDER (GENE ID, SYMBOL)");
+        for (i=0; i < genes->num_entities; i++) {
+                PrintBuf_printf(pbuf1, 0, "%u", genes->gene_ids[i]);
+                fprintf(fp, fmt, pbuf1->buf, genes->symbols[i]);
+        }
+        PrintBuf_delete(pbuf1);
+}
+
+
+/* Fills the directory of a version 1 file by walking all its blocks */
+static
+void ETDTermDb_scan_sections(BinReader *reader, ETDTermDb *term_db)
+{
+        ETDSection *sec;
+        int i;
+
+        term_db->sections = calloc_(term_db->num_namespaces + 1,
+                                    sizeof(ETDSection));
+        for (i=0; i <= term_db->num_namespaces; i++) {
+                sec = term_db->sections + i;
+                sec->offset = reader->pos;
+                BinReader_read(reader, sec->tag, 8);
+                BinReader_read_uint32(reader, &sec->magic, 1);
+                BinReader_seek(reader, sec->offset);
+                if (i == 0) {
+                        sec->num_items = NCBIGenesDb_skip(reader);
+                }
+                else {
+                        sec->magic = ETDTermDb_read_ns_header(reader);
+                        ETDTermDb_skip_ns_data(reader, &sec->num_items,
+                                               &sec->num_hits);
+                }
+                sec->size = reader->pos - sec->offset;
+        }
+}
+
+
+/* Builds the term ID index of the namespace block at the current position.
+   Term IDs map to term numbers within the namespace. */
+static
+char *ETDTermDb_pack_ns_index(BinReader *reader, uint32_t *num_keys,
+                              uint64_t *size)
+{
+        uint32_t M;
+        uint32_t *counts;
+        uint32_t *values;
+        uint32_t bufsize;
+        char **keys;
+        char *cur;
+        char *packed;
+        size_t n;
+        uint32_t i;
+
+        (void) ETDTermDb_read_ns_header(reader);
+        BinReader_skip(reader, sizeof(uint32_t));
+        BinReader_skip_buf(reader);
+        BinReader_read_uint32(reader, &M, 1);
+        BinReader_skip(reader, (size_t) M * sizeof(uint32_t));
+        counts = malloc_(((size_t) M + 1) * sizeof(uint32_t));
+        BinReader_read_uint32(reader, counts, M);
+        for (n=0, i=0; i < M; i++) {
+                n += counts[i];
+        }
+        BinReader_skip(reader, n * sizeof(uint32_t));
+
+        keys = malloc_(((size_t) M + 1) * sizeof(char *));
+        values = counts;
+        cur = BinReader_buf(reader, &bufsize);
+        for (i=0; i < M; i++) {
+                keys[i] = cur;
+                values[i] = i;
+                cur += (strlen(cur) + 1);
+        }
+        packed = StrIndex_pack(keys, NULL, values, M, num_keys, size);
+        free(keys);
+        free(values);
+        return packed;
+}
+
+
+/* Writes a version 2 copy of an ETD database. Blocks are copied verbatim,
+   followed by freshly built lookup indexes for genes and for the term IDs
+   of each namespace. All sections are aligned to EXTERMDB_SECTION_ALIGN
+   bytes. */
+void ETDTermDb_write_v2(const char *etd_filename, const char *out_filename)
+{
+        static const char padding[EXTERMDB_SECTION_ALIGN] = {0};
+        BinReader *reader;
+        ETDTermDb *term_db;
+        ETDSection *sections;
+        ETDSection *sec;
+        char **packed;
+        const char *src;
+        uint32_t version;
+        uint32_t tmp;
+        size_t header_start = 12;
+        size_t header_end;
+        uint64_t pos;
+        uint64_t *offsets;
+        uint32_t gene_keys[EXTERMDB_NUM_GENE_INDEXES];
+        uint64_t gene_sizes[EXTERMDB_NUM_GENE_INDEXES];
+        int num_blocks;
+        int num_sections;
+        int i;
+        FILE *fp;
+
+        reader = ETDTermDb_open(etd_filename, &version);
+        term_db = ETDTermDb_init(reader, version);
+        BinReader_seek(reader, header_start);
+        BinReader_skip_buf(reader);
+        BinReader_skip(reader, sizeof(uint32_t));
+        BinReader_skip_buf(reader);
+        header_end = reader->pos;
+        if (version == 1) {
+                ETDTermDb_scan_sections(reader, term_db);
+        }
+
+        /* blocks are kept, any old indexes are rebuilt */
+        num_blocks = term_db->num_namespaces + 1;
+        num_sections = num_blocks + EXTERMDB_NUM_GENE_INDEXES
+                + term_db->num_namespaces;
+        sections = calloc_(num_sections, sizeof(ETDSection));
+        packed = calloc_(num_sections, sizeof(char *));
+        memcpy(sections, term_db->sections, num_blocks * sizeof(ETDSection));
+
+        BinReader_seek(reader, sections[0].offset);
+        NCBIGenesDb_pack_indexes(reader, packed + num_blocks, gene_keys,
+                                 gene_sizes);
+        for (i=0; i < EXTERMDB_NUM_GENE_INDEXES; i++) {
+                sec = sections + num_blocks + i;
+                memcpy(sec->tag, gene_index_tags[i], 8);
+                sec->num_items = gene_keys[i];
+                sec->size = gene_sizes[i];
+        }
+        for (i=1; i < num_blocks; i++) {
+                sec = sections + num_blocks + EXTERMDB_NUM_GENE_INDEXES + i - 1;
+                memcpy(sec->tag, term_index_tag, 8);
+                sec->magic = i;
+                BinReader_seek(reader, sections[i].offset);
+                packed[sec - sections] = ETDTermDb_pack_ns_index(reader, &sec->num_items,
+                                                                 &sec->size);
+        }
+
+        /* lay out the sections after the directory */
+        offsets = malloc_(num_sections * sizeof(uint64_t));
+        pos = header_end + sizeof(uint32_t)
+                + (uint64_t) num_sections * EXTERMDB_SECTION_SIZE;
+        for (i=0; i < num_sections; i++) {
+                pos = (pos + EXTERMDB_SECTION_ALIGN - 1)
+                        & ~((uint64_t) EXTERMDB_SECTION_ALIGN - 1);
+                offsets[i] = pos;
+                pos += sections[i].size;
+        }
+
+	if ((fp = fopen(out_filename, "wb")) == NULL) {
+		fprintf(stderr, "Could not open file %s.\n", out_filename);
+		exit(EXIT_FAILURE);
+	}
+        fwrite_("EXTERMDB", 1, 8, fp);
+        tmp = EXTERMDB_V2_MAGIC;
+        fwrite_uint32(&tmp, 1, fp);
+        fwrite_(reader->data + header_start, 1,
+                header_end - header_start, fp);
+        tmp = num_sections;
+        fwrite_uint32(&tmp, 1, fp);
+        for (i=0; i < num_sections; i++) {
+                sec = sections + i;
+                fwrite_(sec->tag, 1, 8, fp);
+                fwrite_uint64(offsets + i, 1, fp);
+                fwrite_uint64(&sec->size, 1, fp);
+                fwrite_uint32(&sec->magic, 1, fp);
+                fwrite_uint32(&sec->num_items, 1, fp);
+                fwrite_uint64(&sec->num_hits, 1, fp);
+        }
+        pos = header_end + sizeof(uint32_t)
+                + (uint64_t) num_sections * EXTERMDB_SECTION_SIZE;
+        for (i=0; i < num_sections; i++) {
+                sec = sections + i;
+                src = (i < num_blocks) ? reader->data + sec->offset : packed[i];
+                fwrite_(padding, 1, offsets[i] - pos, fp);
+                fwrite_(src, 1, sec->size, fp);
+                pos = offsets[i] + sec->size;
+        }
+	if (fclose(fp)) {
+		fprintf(stderr, "Problem writing file %s.\n", out_filename);
+		exit(EXIT_FAILURE);
+	}
+
+        for (i=0; i < num_sections; i++) {
+                free(packed[i]);
+        }
+        free(packed);
+        free(sections);
+        free(offsets);
+        term_db->delete((CVTermDb *) term_db);
+        BinReader_release(reader);
+}
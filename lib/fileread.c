@@ -34,8 +34,29 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <string.h>
+#ifndef _WIN32
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+#ifndef SADDLESUM_NO_ZLIB
+#include <zlib.h>
+#endif
+#if !defined(SADDLESUM_NO_THREADS) && !defined(_WIN32)
+#include <pthread.h>
+#include <signal.h>
+#define INFLATE_IN_THREAD 1
+#endif
 #include "miscutils.h"
 
+#if defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_LITTLE_ENDIAN__
+#define LITTLE_ENDIAN_HOST 1
+#elif defined(__BYTE_ORDER__) && __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define BIG_ENDIAN_HOST 1
+#endif
+
 
 void fread_(void *ptr, size_t size, size_t nmemb, FILE *stream)
 {
@@ -46,16 +67,117 @@ void fread_(void *ptr, size_t size, size_t nmemb, FILE *stream)
         }
 }
 
+void fwrite_(const void *ptr, size_t size, size_t nmemb, FILE *stream)
+{
+        size_t count = fwrite(ptr, size, nmemb, stream);
+        if (count != nmemb) {
+                fprintf(stderr, "Problem writing file.");
+                exit(EXIT_FAILURE);
+        }
+}
+
+#define UINT32_CHUNK 1024  /* integers per fwrite when converting */
+
+#ifdef BIG_ENDIAN_HOST
+/* Reverses the bytes of nmemb integers at ptr, working on whole words so
+   that the compiler can vectorize the loop */
+static
+void swap_uint32(uint32_t *ptr, size_t nmemb)
+{
+        uint32_t *y = ptr + nmemb;
+        uint32_t x;
+        for (; ptr < y; ptr++) {
+                x = *ptr;
+                *ptr = (x >> 24) | ((x >> 8) & 0xFF00U) | ((x << 8) & 0xFF0000U)
+                        | (x << 24);
+        }
+}
+#endif
+
+/* Converts nmemb little-endian integers at ptr to host order in place.
+   Nothing is done on little-endian hosts and the bytes are swapped on
+   big-endian ones. If the byte order of the host is not known, each value
+   is assembled from its bytes. */
+static
+void le_to_host_uint32(uint32_t *ptr, size_t nmemb)
+{
+#if defined(BIG_ENDIAN_HOST)
+        swap_uint32(ptr, nmemb);
+#elif !defined(LITTLE_ENDIAN_HOST)
+        uint32_t *y = ptr + nmemb;
+        const unsigned char *b;
+        for (; ptr < y; ptr++) {
+                b = (const unsigned char *) ptr;
+                *ptr = b[0] | (b[1] << 8) | (b[2] << 16) | ((uint32_t) b[3] << 24);
+        }
+#else
+        (void) ptr;
+        (void) nmemb;
+#endif
+}
+
+#ifndef LITTLE_ENDIAN_HOST
+/* The inverse of le_to_host_uint32 */
+static
+void host_to_le_uint32(uint32_t *ptr, size_t nmemb)
+{
+#ifdef BIG_ENDIAN_HOST
+        swap_uint32(ptr, nmemb);
+#else
+        uint32_t *y = ptr + nmemb;
+        unsigned char *b;
+        uint32_t x;
+        for (; ptr < y; ptr++) {
+                x = *ptr;
+                b = (unsigned char *) ptr;
+                b[0] = x & 0xFF;
+                b[1] = (x >> 8) & 0xFF;
+                b[2] = (x >> 16) & 0xFF;
+                b[3] = (x >> 24) & 0xFF;
+        }
+#endif
+}
+#endif
+
 void fread_uint32(uint32_t *ptr, size_t nmemb, FILE *stream)
 {
-        uint32_t *x = ptr;
-        uint32_t *y = x + nmemb;
-        for (; x < y; x++) {
-                *x = fgetc(stream) & 0xFF;            /* read lowest byte */
-                *x |= (fgetc(stream) & 0xFF) << 8;    /* read 2nd byte */
-                *x |= (fgetc(stream) & 0xFF) << 16;   /* read 3rd byte */
-                *x |= (fgetc(stream) & 0xFF) << 24;   /* read highest byte */
+        fread_(ptr, sizeof(uint32_t), nmemb, stream);
+        le_to_host_uint32(ptr, nmemb);
+}
+
+void fwrite_uint32(const uint32_t *ptr, size_t nmemb, FILE *stream)
+{
+#ifdef LITTLE_ENDIAN_HOST
+        fwrite_(ptr, sizeof(uint32_t), nmemb, stream);
+#else
+        uint32_t chunk[UINT32_CHUNK];
+        size_t n;
+        while (nmemb > 0) {
+                n = (nmemb < UINT32_CHUNK) ? nmemb : UINT32_CHUNK;
+                memcpy(chunk, ptr, n * sizeof(uint32_t));
+                host_to_le_uint32(chunk, n);
+                fwrite_(chunk, sizeof(uint32_t), n, stream);
+                ptr += n;
+                nmemb -= n;
         }
+#endif
+}
+
+void fwrite_uint64(const uint64_t *ptr, size_t nmemb, FILE *stream)
+{
+        const uint64_t *y = ptr + nmemb;
+        uint32_t half[2];
+        for (; ptr < y; ptr++) {
+                half[0] = (uint32_t) *ptr;
+                half[1] = (uint32_t) (*ptr >> 32);
+                fwrite_uint32(half, 2, stream);
+        }
+}
+
+void fwrite_buf(const char *buf, uint32_t n, FILE *stream)
+{
+        fwrite_uint32(&n, 1, stream);
+        fwrite_(buf, 1, n, stream);
 }
 
 char *fread_buf(FILE *stream, uint32_t *n)
@@ -83,3 +205,452 @@ void strbuf2array(char **dest, char *buf, int n)
                 buf += strlen(buf) + 1;
         }
 }
+
+
+
+/* Compressed input */
+
+#define GZIP_MAGIC1 0x1f  /* first byte of gzip data */
+#define INFLATE_CHUNK 65536
+
+#ifndef SADDLESUM_NO_ZLIB
+
+typedef struct _Inflater_s {
+        FILE *src;
+        FILE *dest;
+        char *filename;
+#ifdef INFLATE_IN_THREAD
+        pthread_t thread;
+#endif
+} Inflater;
+
+
+/* Writes the decompressed contents of src, which may consist of several
+   gzip members, to dest. Returns 0 on success, -1 if the data are invalid
+   or truncated and 1 if dest could not be written. */
+static
+int inflate_file(FILE *src, FILE *dest)
+{
+        unsigned char *in = malloc_(INFLATE_CHUNK);
+        unsigned char *out = malloc_(INFLATE_CHUNK);
+        z_stream zs;
+        int ret = Z_OK;
+        int status = 0;
+        size_t n;
+
+        memset(&zs, 0, sizeof(z_stream));
+        if (inflateInit2(&zs, 16 + MAX_WBITS) != Z_OK) {
+                fprintf(stderr, "Could not initialize decompression.\n");
+                exit(EXIT_FAILURE);
+        }
+        while (status == 0) {
+                zs.avail_in = fread(in, 1, INFLATE_CHUNK, src);
+                if (zs.avail_in == 0) {
+                        status = ferror(src) ? -1 : 0;
+                        break;
+                }
+                zs.next_in = in;
+                do {
+                        if (ret == Z_STREAM_END) {
+                                (void) inflateReset(&zs);  /* next member */
+                        }
+                        zs.next_out = out;
+                        zs.avail_out = INFLATE_CHUNK;
+                        ret = inflate(&zs, Z_NO_FLUSH);
+                        if (ret != Z_OK && ret != Z_STREAM_END && ret != Z_BUF_ERROR) {
+                                status = -1;
+                                break;
+                        }
+                        n = INFLATE_CHUNK - zs.avail_out;
+                        if (n > 0 && fwrite(out, 1, n, dest) != n) {
+                                status = 1;
+                                break;
+                        }
+                } while (zs.avail_in > 0 || (zs.avail_out == 0 && ret != Z_STREAM_END));
+        }
+        if (status == 0 && ret != Z_STREAM_END) {
+                status = -1;
+        }
+        inflateEnd(&zs);
+        free(in);
+        free(out);
+        return status;
+}
+
+
+static
+void inflate_error(const char *filename)
+{
+        fprintf(stderr, "Problem reading compressed file %s.\n", filename);
+        exit(EXIT_FAILURE);
+}
+
+
+#ifdef INFLATE_IN_THREAD
+static
+void *Inflater_run(void *inflater_)
+{
+        Inflater *inflater = (Inflater *) inflater_;
+        sigset_t set;
+
+        /* If the reader stops early, writes fail instead of raising SIGPIPE */
+        sigemptyset(&set);
+        sigaddset(&set, SIGPIPE);
+        pthread_sigmask(SIG_BLOCK, &set, NULL);
+        if (inflate_file(inflater->src, inflater->dest) < 0) {
+                inflate_error(inflater->filename);
+        }
+        fclose(inflater->dest);
+        return NULL;
+}
+#endif
+
+
+/* Starts inflating src. With threads, the data are passed through a pipe
+   while they are being decompressed; otherwise they are first written to a
+   temporary file. */
+static
+FILE *Inflater_start(Inflater *inflater)
+{
+#ifdef INFLATE_IN_THREAD
+        int fds[2];
+        FILE *fp;
+        if (pipe(fds) != 0) {
+                fprintf(stderr, "Could not create a pipe.\n");
+                exit(EXIT_FAILURE);
+        }
+        fp = fdopen(fds[0], "rb");
+        inflater->dest = fdopen(fds[1], "wb");
+        if (fp == NULL || inflater->dest == NULL
+            || pthread_create(&inflater->thread, NULL, Inflater_run, inflater) != 0) {
+                fprintf(stderr, "Could not start decompression.\n");
+                exit(EXIT_FAILURE);
+        }
+        return fp;
+#else
+        inflater->dest = tmpfile();
+        if (inflater->dest == NULL) {
+                fprintf(stderr, "Could not create a temporary file.\n");
+                exit(EXIT_FAILURE);
+        }
+        if (inflate_file(inflater->src, inflater->dest) != 0) {
+                inflate_error(inflater->filename);
+        }
+        rewind(inflater->dest);
+        return inflater->dest;
+#endif
+}
+
+#endif /* !SADDLESUM_NO_ZLIB */
+
+
+/* Takes over src, which is decompressed if it starts with the gzip magic */
+static
+InFile *InFile_init(FILE *src, const char *filename)
+{
+        InFile *in = calloc_(1, sizeof(InFile));
+#ifndef SADDLESUM_NO_ZLIB
+        Inflater *inflater;
+#endif
+        int c = getc(src);
+
+        in->src = src;
+        in->fp = src;
+        if (c == EOF) {
+                return in;
+        }
+        ungetc(c, src);
+        if (c != GZIP_MAGIC1) {
+                return in;
+        }
+#ifndef SADDLESUM_NO_ZLIB
+        inflater = calloc_(1, sizeof(Inflater));
+        inflater->src = src;
+        inflater->filename = strdup_(filename);
+        in->inflater = inflater;
+        in->fp = Inflater_start(inflater);
+#else
+        fprintf(stderr, "Cannot read compressed file %s (no zlib support).\n", filename);
+        exit(EXIT_FAILURE);
+#endif
+        return in;
+}
+
+
+/* Returns NULL if the file cannot be opened. "-" is the standard input. */
+InFile *InFile_open(const char *filename)
+{
+        FILE *src = strcmp(filename, "-") ? fopen(filename, "rb") : stdin;
+        if (src == NULL) {
+                return NULL;
+        }
+        return InFile_init(src, filename);
+}
+
+
+void InFile_close(InFile *in)
+{
+#ifndef SADDLESUM_NO_ZLIB
+        Inflater *inflater = (Inflater *) in->inflater;
+        if (inflater != NULL) {
+                fclose(in->fp);
+#ifdef INFLATE_IN_THREAD
+                pthread_join(inflater->thread, NULL);
+#endif
+                free(inflater->filename);
+                free(inflater);
+        }
+#endif
+        if (in->src != stdin) {
+                fclose(in->src);
+        }
+        free(in);
+}
+
+
+
+/* Binary file images */
+
+static
+void BinReader_load(BinReader *reader, FILE *fp)
+{
+        size_t n;
+        size_t max_size = 1 << 16;
+        reader->data = malloc_(max_size);
+        while ((n = fread(reader->data + reader->size, 1,
+                          max_size - reader->size, fp)) > 0) {
+                reader->size += n;
+                if (reader->size == max_size) {
+                        max_size *= 2;
+                        reader->data = realloc_(reader->data, max_size);
+                }
+        }
+        if (ferror(fp)) {
+                fprintf(stderr, "Problem reading file.");
+                exit(EXIT_FAILURE);
+        }
+}
+
+
+/* Returns NULL if the file cannot be opened. "-" is the standard input,
+   which is always read into memory. */
+BinReader *BinReader_open(const char *filename)
+{
+        BinReader *reader;
+        FILE *fp = strcmp(filename, "-") ? fopen(filename, "rb") : stdin;
+#ifndef _WIN32
+        struct stat st;
+        void *data;
+#endif
+        InFile *in;
+        int c;
+        if (fp == NULL) {
+                return NULL;
+        }
+        reader = calloc_(1, sizeof(BinReader));
+        reader->refcount = 1;
+
+        /* compressed files are decompressed into memory */
+        c = getc(fp);
+        ungetc(c, fp);
+        if (c == GZIP_MAGIC1) {
+                in = InFile_init(fp, filename);
+                BinReader_load(reader, in->fp);
+                InFile_close(in);
+                return reader;
+        }
+#ifndef _WIN32
+        if (fp != stdin && fstat(fileno(fp), &st) == 0 && S_ISREG(st.st_mode)
+            && st.st_size > 0) {
+                /* Private writable mapping, so that the borrowed buffers
+                   behave like ordinary (copy-on-write) memory */
+                data = mmap(NULL, st.st_size, PROT_READ | PROT_WRITE, MAP_PRIVATE,
+                            fileno(fp), 0);
+                if (data != MAP_FAILED) {
+                        reader->data = data;
+                        reader->size = st.st_size;
+                        reader->mapped = 1;
+                }
+        }
+#endif
+        if (!reader->mapped) {
+                BinReader_load(reader, fp);
+        }
+        if (fp != stdin) {
+                fclose(fp);
+        }
+        return reader;
+}
+
+
+void BinReader_retain(BinReader *reader)
+{
+        reader->refcount++;
+}
+
+
+void BinReader_release(BinReader *reader)
+{
+        if (reader == NULL || --reader->refcount > 0) {
+                return;
+        }
+#ifndef _WIN32
+        if (reader->mapped) {
+                munmap(reader->data, reader->size);
+                reader->data = NULL;
+        }
+#endif
+        free(reader->data);
+        free(reader);
+}
+
+
+static
+const char *BinReader_advance(BinReader *reader, size_t n)
+{
+        const char *cur = reader->data + reader->pos;
+        if (n > reader->size - reader->pos) {
+                fprintf(stderr, "Problem reading file.");
+                exit(EXIT_FAILURE);
+        }
+        reader->pos += n;
+        return cur;
+}
+
+
+void BinReader_read(BinReader *reader, void *ptr, size_t n)
+{
+        memcpy(ptr, BinReader_advance(reader, n), n);
+}
+
+
+/* Converts nmemb little-endian integers at src to host order */
+void copy_le_uint32(uint32_t *ptr, const void *src, size_t nmemb)
+{
+        memcpy(ptr, src, nmemb * sizeof(uint32_t));
+        le_to_host_uint32(ptr, nmemb);
+}
+
+
+void BinReader_read_uint32(BinReader *reader, uint32_t *ptr, size_t nmemb)
+{
+        if (nmemb > SIZE_MAX / sizeof(uint32_t)) {
+                fprintf(stderr, "Problem reading file.");
+                exit(EXIT_FAILURE);
+        }
+        copy_le_uint32(ptr, BinReader_advance(reader, nmemb * sizeof(uint32_t)), nmemb);
+}
+
+
+void BinReader_read_uint64(BinReader *reader, uint64_t *ptr, size_t nmemb)
+{
+        uint32_t half[2];
+        size_t i;
+        for (i=0; i < nmemb; i++) {
+                BinReader_read_uint32(reader, half, 2);
+                ptr[i] = half[0] | ((uint64_t) half[1] << 32);
+        }
+}
+
+
+/* IEEE 754 values, stored with the same byte order as integers */
+void BinReader_read_double(BinReader *reader, double *ptr, size_t nmemb)
+{
+        uint64_t x;
+        size_t i;
+#ifdef LITTLE_ENDIAN_HOST
+        if (nmemb <= SIZE_MAX / sizeof(double)) {
+                memcpy(ptr, BinReader_advance(reader, nmemb * sizeof(double)),
+                       nmemb * sizeof(double));
+                return;
+        }
+#endif
+        for (i=0; i < nmemb; i++) {
+                BinReader_read_uint64(reader, &x, 1);
+                memcpy(ptr + i, &x, sizeof(double));
+        }
+}
+
+
+void BinReader_read_float(BinReader *reader, float *ptr, size_t nmemb)
+{
+        uint32_t x;
+        size_t i;
+#ifdef LITTLE_ENDIAN_HOST
+        if (nmemb <= SIZE_MAX / sizeof(float)) {
+                memcpy(ptr, BinReader_advance(reader, nmemb * sizeof(float)),
+                       nmemb * sizeof(float));
+                return;
+        }
+#endif
+        for (i=0; i < nmemb; i++) {
+                BinReader_read_uint32(reader, &x, 1);
+                memcpy(ptr + i, &x, sizeof(float));
+        }
+}
+
+
+/* Returns an array of nmemb integers at the current position. On little
+   endian hosts aligned arrays are used in place; otherwise they are copied.
+   Either way the array must be disposed of with BinReader_free. */
+uint32_t *BinReader_uint32_array(BinReader *reader, size_t nmemb)
+{
+        uint32_t *ptr;
+#ifdef LITTLE_ENDIAN_HOST
+        if (((uintptr_t) (reader->data + reader->pos)) % sizeof(uint32_t) == 0) {
+                if (nmemb > SIZE_MAX / sizeof(uint32_t)) {
+                        fprintf(stderr, "Problem reading file.");
+                        exit(EXIT_FAILURE);
+                }
+                return (uint32_t *) BinReader_advance(reader, nmemb * sizeof(uint32_t));
+        }
+#endif
+        ptr = malloc_((nmemb ? nmemb : 1) * sizeof(uint32_t));
+        BinReader_read_uint32(reader, ptr, nmemb);
+        return ptr;
+}
+
+
+/* Moves to an absolute position within the file image */
+void BinReader_seek(BinReader *reader, uint64_t pos)
+{
+        if (pos > reader->size) {
+                fprintf(stderr, "Problem reading file.");
+                exit(EXIT_FAILURE);
+        }
+        reader->pos = (size_t) pos;
+}
+
+
+/* Returns a pointer to the buffer inside the file image (no copy) */
+char *BinReader_buf(BinReader *reader, uint32_t *n)
+{
+        BinReader_read_uint32(reader, n, 1);
+        return (char *) BinReader_advance(reader, *n);
+}
+
+
+void BinReader_skip(BinReader *reader, size_t n)
+{
+        (void) BinReader_advance(reader, n);
+}
+
+
+void BinReader_skip_buf(BinReader *reader)
+{
+        uint32_t n;
+        BinReader_read_uint32(reader, &n, 1);
+        BinReader_skip(reader, n);
+}
+
+
+/* Frees ptr unless it points into the file image of reader */
+void BinReader_free(BinReader *reader, void *ptr)
+{
+        const char *p = (const char *) ptr;
+        if (reader != NULL && reader->data != NULL
+            && p >= reader->data && p < reader->data + reader->size) {
+                return;
+        }
+        free(ptr);
+}
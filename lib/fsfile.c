@@ -31,10 +31,16 @@
 *
 */
 
+#include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
 #include <ctype.h>
+#include <float.h>
+#include "miscutils.h"
 #include "fsfile.h"
 
+#define LINE_READER_BLOCK 65536
+
 FSFile_proc_code_type FSFile_next_field(FILE *fp, char fs, char *buf,
 					uint32_t max_chars)
 {
@@ -108,3 +114,225 @@ FSFile_proc_code_type SSFile_next_field(FILE *fp, char *buf,
 	}
 	return END_OF_FIELD;
 }
+
+
+LineReader *LineReader_init(FILE *fp)
+{
+        LineReader *reader = calloc_(1, sizeof(LineReader));
+        reader->fp = fp;
+        reader->size = 2 * LINE_READER_BLOCK;
+        reader->buf = malloc_(reader->size);
+        return reader;
+}
+
+
+/* The file is not closed */
+void LineReader_delete(LineReader *reader)
+{
+        free(reader->buf);
+        free(reader);
+}
+
+
+/* Returns the next line, or NULL at the end of file. The last line need
+   not end with a newline. */
+char *LineReader_next(LineReader *reader, size_t *len)
+{
+        char *line = reader->buf + reader->pos;
+        char *nl;
+        size_t scanned = 0;
+        size_t n;
+
+        for (;;) {
+                n = reader->len - reader->pos;
+                nl = memchr(line + scanned, '\n', n - scanned);
+                if (nl != NULL) {
+                        *nl = '\0';
+                        *len = nl - line;
+                        reader->pos += *len + 1;
+                        return line;
+                }
+                if (reader->eof) {
+                        if (n == 0) {
+                                return NULL;
+                        }
+                        line[n] = '\0';  /* there is always room for it */
+                        *len = n;
+                        reader->pos = reader->len;
+                        return line;
+                }
+
+                /* move the partial line to the front and read another block */
+                memmove(reader->buf, line, n);
+                reader->pos = 0;
+                reader->len = n;
+                line = reader->buf;
+                scanned = n;
+                if (reader->size - n < LINE_READER_BLOCK + 1) {
+                        reader->size *= 2;
+                        reader->buf = realloc_(reader->buf, reader->size);
+                        line = reader->buf;
+                }
+                n = fread(reader->buf + reader->len, 1,
+                          reader->size - reader->len - 1, reader->fp);
+                if (n == 0) {
+                        if (ferror(reader->fp)) {
+                                fprintf(stderr, "Problem reading file.\n");
+                                exit(EXIT_FAILURE);
+                        }
+                        reader->eof = 1;
+                }
+                reader->len += n;
+        }
+}
+
+
+/* Returns the field starting at *cur, terminated in place, and moves *cur
+   past the separator, or sets it to NULL if this was the last field
+   before end */
+char *FSFile_split_field(char **cur, char *end, char fs)
+{
+        char *field = *cur;
+        char *sep = memchr(field, fs, end - field);
+        if (sep == NULL) {
+                *cur = NULL;
+                return field;
+        }
+        *sep = '\0';
+        *cur = sep + 1;
+        return field;
+}
+
+
+/* Whitespace other than newlines, as matched by isspace in the C locale */
+static inline
+int is_field_space(char c)
+{
+        return c == ' ' || c == '\t' || c == '\r' || c == '\v' || c == '\f';
+}
+
+
+/* Like FSFile_split_field but for fields separated by runs of whitespace,
+   which is also skipped at the start and the end of the line. Returns NULL
+   if there is no field left before end. The character at end is
+   overwritten if the field extends up to it. */
+char *SSFile_split_field(char **cur, char *end)
+{
+        char *field = *cur;
+        char *p;
+
+        while (field < end && is_field_space(*field)) {
+                field++;
+        }
+        if (field == end) {
+                *cur = NULL;
+                return NULL;
+        }
+        for (p=field; p < end && !is_field_space(*p); p++)
+                ;
+        *cur = p;
+        while (*cur < end && is_field_space(**cur)) {
+                (*cur)++;
+        }
+        if (*cur == end) {
+                *cur = NULL;
+        }
+        *p = '\0';
+        return field;
+}
+
+
+#define FAST_DOUBLE_MAX_DIGITS 19
+#define FAST_DOUBLE_MAX_POW10 22
+#define FAST_DOUBLE_MAX_MANTISSA (UINT64_C(1) << 53)
+
+static const double fast_pow10[FAST_DOUBLE_MAX_POW10 + 1] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+        1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+};
+
+
+/* Locale-independent replacement for strtod. Plain decimal numbers whose
+   digits and exponent fit exactly into doubles (which covers nearly all
+   weights written by other programs) are converted directly with a single
+   correctly rounded operation; everything else, including numbers followed
+   by anything other than whitespace or the end of string, goes through
+   strtod. The result is identical to that of strtod either way. */
+double FSFile_strtod(const char *s, char **endptr)
+{
+        const char *p = s;
+        uint64_t mantissa = 0;
+        int num_digits = 0;
+        int num_mantissa_digits = 0;
+        int exponent = 0;
+        int exp_value = 0;
+        int negative = 0;
+        int exp_negative = 0;
+        double value;
+
+#if defined(FLT_EVAL_METHOD) && FLT_EVAL_METHOD != 0
+        /* the direct conversion relies on arithmetic in plain doubles */
+        return strtod(s, endptr);
+#endif
+        if (*p == '-' || *p == '+') {
+                negative = (*p == '-');
+                p++;
+        }
+        for (; *p >= '0' && *p <= '9'; p++, num_digits++) {
+                if (mantissa != 0 || *p != '0') {
+                        mantissa = 10 * mantissa + (*p - '0');
+                        num_mantissa_digits++;
+                }
+        }
+        if (*p == '.') {
+                for (p++; *p >= '0' && *p <= '9'; p++, num_digits++) {
+                        if (mantissa != 0 || *p != '0') {
+                                mantissa = 10 * mantissa + (*p - '0');
+                                num_mantissa_digits++;
+                        }
+                        exponent--;
+                }
+        }
+        if (num_digits == 0 || num_mantissa_digits > FAST_DOUBLE_MAX_DIGITS) {
+                return strtod(s, endptr);
+        }
+        if (*p == 'e' || *p == 'E') {
+                p++;
+                if (*p == '-' || *p == '+') {
+                        exp_negative = (*p == '-');
+                        p++;
+                }
+                if (*p < '0' || *p > '9') {
+                        return strtod(s, endptr);
+                }
+                for (; *p >= '0' && *p <= '9'; p++) {
+                        if (exp_value > 10000) {
+                                return strtod(s, endptr);
+                        }
+                        exp_value = 10 * exp_value + (*p - '0');
+                }
+                exponent += exp_negative ? -exp_value : exp_value;
+        }
+        if (*p != '\0' && !isspace((unsigned char) *p)) {
+                return strtod(s, endptr);
+        }
+
+        if (mantissa == 0) {
+                value = 0.0;
+        }
+        else if (mantissa > FAST_DOUBLE_MAX_MANTISSA
+                 || exponent < -FAST_DOUBLE_MAX_POW10
+                 || exponent > FAST_DOUBLE_MAX_POW10) {
+                return strtod(s, endptr);
+        }
+        else if (exponent < 0) {
+                value = (double) mantissa / fast_pow10[-exponent];
+        }
+        else {
+                value = (double) mantissa * fast_pow10[exponent];
+        }
+        if (endptr != NULL) {
+                *endptr = (char *) p;
+        }
+        return negative ? -value : value;
+}
@@ -38,35 +38,38 @@
 #include "miscutils.h"
 #include "fsfile.h"
 #include "hashtable.h"
+#include "dbindex.h"
 #include "enrich.h"
+#include "taskpool.h"
 
 
-#ifndef GMT_MAX_FIELD_WIDTH
-#define GMT_MAX_FIELD_WIDTH 512
-#endif
-
-
-/* Entity database */
+/* Entity database. Symbols are stored once, in symbol_arena, and are also
+   the keys of symbol2index. */
 typedef struct _GMTEntityDb_s {
 	EntityDb_HEAD
         Entity *entities;
         uint32_t max_entities;
-        struct hashtable *symbol2index;
+        StrTable *symbol2index;
+        Arena symbol_arena;
 } GMTEntityDb;
 
+/* Entity data is owned by the database */
+static
+void GMTEntity_delete(Entity *entity)
+{
+        entity->symbol = NULL;
+}
+
 static
 void GMTEntityDb_delete(EntityDb *entity_db_)
 {
-	int i;
 	GMTEntityDb *entity_db = (GMTEntityDb *) entity_db_;
-	for (i=0; i < entity_db->num_entities; i++) {
-		entity_db->entities[i].delete(entity_db->entities + i);
-	}
 	free(entity_db->entities);
 	entity_db->entities = NULL;
 	entity_db->num_entities = 0;
 	entity_db->max_entities = 0;
-	hashtable_destroy(entity_db->symbol2index, 0);
+	StrTable_delete(entity_db->symbol2index);
+        Arena_delete(&entity_db->symbol_arena);
 	free(entity_db);
 }
 
@@ -77,8 +80,7 @@ uint32_t GMTEntityDb_insert_item(EntityDb *entity_db_, const char *symbol,
 	GMTEntityDb *entity_db = (GMTEntityDb *) entity_db_;
         Entity *item;
 	uint32_t i;
-	void *indx = hashtable_search(entity_db->symbol2index, (char *) symbol);
-	if (indx == NULL) {
+	if (StrTable_search(entity_db->symbol2index, symbol, &i) == NULL) {
 		if (entity_db->num_entities >= entity_db->max_entities) {
 			entity_db->max_entities *= 2;
 			entity_db->entities = realloc_(entity_db->entities,
@@ -87,45 +89,28 @@ uint32_t GMTEntityDb_insert_item(EntityDb *entity_db_, const char *symbol,
 		i = entity_db->num_entities;
 		item = entity_db->entities + entity_db->num_entities;
 		entity_db->num_entities++;
-		item->delete = Entity_delete_data;
+		item->delete = GMTEntity_delete;
                 item->print_url = NULL;
-		item->symbol = strdup_(symbol);
+		item->symbol = Arena_strdup(&entity_db->symbol_arena, symbol);
                 item->description = NULL;
-
-		if (! hashtable_insert(entity_db->symbol2index, strdup_(symbol),
-                                       (void *) ((intptr_t) i)+1) ) {
-			fprintf(stderr, "Could not insert entity item %s.\n", symbol);
-			exit(EXIT_FAILURE);
-		}
-	}
-	else {
-		i = (uint32_t) ((size_t) indx) - 1;
+                StrTable_insert(entity_db->symbol2index, item->symbol, i);
 	}
-	return (uint32_t) i;
+	return i;
 }
 
 static
-EntityWarning *GMTEntityDb_map_symbol(EntityDb *entity_db_, char *symbol, uint32_t *i)
+int GMTEntityDb_map_symbol(EntityDb *entity_db_, char *symbol, uint32_t *i,
+                           EntityWarning *warning)
 {
-	PrintBuf pbuf;
-	EntityWarning *warning;
 	GMTEntityDb *entity_db = (GMTEntityDb *) entity_db_;
-	void *indx = hashtable_search(entity_db->symbol2index, symbol);
 
-	if (indx == NULL) {
-                /* Initialize PrintBuf on the stack. EntityWarning instance
-                   will take ownership of the actual buffer so PrintBuf_delete
-                   should not be called. */
-                (void) PrintBuf_init(&pbuf);
-
-		warning = calloc_(1, sizeof(EntityWarning));
-		PrintBuf_printf(&pbuf, 0, "%s", symbol);
-		warning->msg = pbuf.buf;
+	if (StrTable_search(entity_db->symbol2index, symbol, i) == NULL) {
+                memset(warning, 0, sizeof(EntityWarning));
+		warning->symbol = symbol;
                 warning->code = UNKNOWN_ID;
-		return warning;
+		return 1;
 	}
-	*i = (uint32_t) ((size_t) indx) - 1;
-	return NULL;
+	return 0;
 }
 
 static
@@ -139,6 +124,21 @@ Entity * GMTEntityDb_get_entity_from_index(EntityDb *entity_db_, uint32_t i)
 	return NULL;
 }
 
+static
+void GMTEntityDb_renumber(EntityDb *entity_db_, const uint32_t *new_index)
+{
+	GMTEntityDb *entity_db = (GMTEntityDb *) entity_db_;
+	Entity *entities = malloc_(entity_db->max_entities * sizeof(Entity));
+	uint32_t i;
+
+	for (i=0; i < entity_db->num_entities; i++) {
+		entities[new_index[i]] = entity_db->entities[i];
+	}
+	free(entity_db->entities);
+	entity_db->entities = entities;
+	StrTable_renumber_values(entity_db->symbol2index, new_index);
+}
+
 static
 GMTEntityDb *GMTEntityDb_init(void)
 {
@@ -148,10 +148,12 @@ GMTEntityDb *GMTEntityDb_init(void)
 	entity_db->map_symbol = GMTEntityDb_map_symbol;
 	entity_db->get_entity_from_index = GMTEntityDb_get_entity_from_index;
         entity_db->insert_item = GMTEntityDb_insert_item;
+        entity_db->renumber = GMTEntityDb_renumber;
 	entity_db->entities = calloc_(INIT_MAX_ENTITIES, sizeof(Entity));
 	entity_db->num_entities = 0;
 	entity_db->max_entities = INIT_MAX_ENTITIES;
-	entity_db->symbol2index = create_hashtable(INIT_MAX_ENTITIES, hash_from_string, str_equal);
+	entity_db->symbol2index = StrTable_init(INIT_MAX_ENTITIES);
+        Arena_init(&entity_db->symbol_arena);
 	return entity_db;
 }
 
@@ -190,6 +192,17 @@ CVTerm *GMTTermDb_get_term_from_index(CVTermDb *term_db_, uint32_t i)
 	return NULL;
 }
 
+static
+const char *GMTTermDb_get_namespace_from_index(CVTermDb *term_db_, uint32_t i)
+{
+	GMTTermDb *term_db = (GMTTermDb *) term_db_;
+
+	if (i < term_db->num_terms) {
+		return term_db->terms[i].namespace;
+	}
+	return NULL;
+}
+
 static
 int GMTTermDb_get_index_from_term_id(CVTermDb *term_db_, char *term_id)
 {
@@ -252,6 +265,7 @@ GMTTermDb *GMTTermDb_init(void)
 	GMTTermDb *term_db = calloc_(1, sizeof(GMTTermDb));
 	term_db->delete = GMTTermDb_delete;
 	term_db->get_term_from_index = GMTTermDb_get_term_from_index;
+	term_db->get_namespace_from_index = GMTTermDb_get_namespace_from_index;
 	term_db->get_term_from_term_id = GMTTermDb_get_term_from_term_id;
         term_db->get_index_from_term_id = GMTTermDb_get_index_from_term_id;
         term_db->insert_term = GMTTermDb_insert_term;
@@ -265,90 +279,268 @@ GMTTermDb *GMTTermDb_init(void)
 
 
 
-int GMT_enrichment_context(const char *gmt_filename, const char *namespace, EntityDb **entity_db_,
-			   CVTermDb **term_db_, TermMappingDb **mapping_db_)
+/* A GMT file parsed on its own, so that several files can be parsed
+   concurrently. Entities are numbered locally in order of first
+   appearance and the hits of terms are stored in CSR form. */
+typedef struct _GMTBlock_s {
+        const char *filename;
+        uint32_t num_terms;
+        uint32_t max_terms;
+        char **term_ids;
+        char **descriptions;
+        TermOffset *term_offsets;
+        TermOffset num_hits;
+        TermOffset max_hits;
+        uint32_t *hits;
+        uint32_t num_entities;
+        uint32_t max_entities;
+        char **entities;
+        StrTable *entity2index;
+        Arena strings;
+        char *error;  /* the first format error, reported when merging */
+} GMTBlock;
+
+#define GMT_UNMAPPED UINT32_MAX
+
+
+static
+void GMTBlock_delete(GMTBlock *block)
 {
-	unsigned int line_num = 1;
-	unsigned int current_field;
-	char buf1[GMT_MAX_FIELD_WIDTH];
-	char buf2[GMT_MAX_FIELD_WIDTH];
-	FSFile_proc_code_type retcode;
-	uint32_t entity_index;
-	int active_term;
-
-	EntityDb *entity_db = *entity_db_;
-	CVTermDb *term_db = *term_db_;
-        TermMappingDb *mapping_db = *mapping_db_;
-	FILE *fp;
-
-	if (entity_db == NULL) {
-		entity_db = (EntityDb *) GMTEntityDb_init();
-	}
-	if (term_db == NULL) {
-		term_db = (CVTermDb *) GMTTermDb_init();
-	}
-	if (mapping_db == NULL) {
-		mapping_db = TermMappingDb_init();
-	}
+        free(block->term_ids);
+        free(block->descriptions);
+        free(block->term_offsets);
+        free(block->hits);
+        free(block->entities);
+        StrTable_delete(block->entity2index);
+        Arena_delete(&block->strings);
+        free(block->error);
+}
 
-	fp = fopen(gmt_filename, "r");
-	if (fp == NULL) {
-		fprintf(stderr, "Could not open file %s.\n", gmt_filename);
-		exit(EXIT_FAILURE);
-	}
+
+static
+void GMTBlock_insert_term(GMTBlock *block, const char *term_id,
+                          const char *description)
+{
+        if (block->num_terms + 1 >= block->max_terms) {
+                block->max_terms = 2 * block->max_terms + INIT_MAX_TERMS;
+                block->term_ids = realloc_(block->term_ids,
+                                           block->max_terms * sizeof(char *));
+                block->descriptions = realloc_(block->descriptions,
+                                               block->max_terms * sizeof(char *));
+                block->term_offsets = realloc_(block->term_offsets,
+                                               block->max_terms * sizeof(TermOffset));
+        }
+        block->term_ids[block->num_terms] = Arena_strdup(&block->strings, term_id);
+        block->descriptions[block->num_terms] = Arena_strdup(&block->strings,
+                                                             description);
+        block->term_offsets[block->num_terms++] = block->num_hits;
+        block->term_offsets[block->num_terms] = block->num_hits;
+}
 
 
-	while (END_OF_FILE != (retcode = FSFile_next_field(fp, '\t', buf1, GMT_MAX_FIELD_WIDTH))) {
-		/* First read term_id and description */
+static
+void GMTBlock_insert_hit(GMTBlock *block, const char *symbol)
+{
+        uint32_t i;
+        if (StrTable_search(block->entity2index, symbol, &i) == NULL) {
+                if (block->num_entities >= block->max_entities) {
+                        block->max_entities = 2 * block->max_entities + INIT_MAX_ENTITIES;
+                        block->entities = realloc_(block->entities,
+                                                   block->max_entities * sizeof(char *));
+                }
+                i = block->num_entities++;
+                block->entities[i] = Arena_strdup(&block->strings, symbol);
+                StrTable_insert(block->entity2index, block->entities[i], i);
+        }
+        if (block->num_hits >= block->max_hits) {
+                if (block->max_hits > (TERM_OFFSET_MAX - INIT_MAX_ENTITIES) / 2) {
+                        fprintf(stderr, "Too many term-entity associations.\n");
+                        exit(EXIT_FAILURE);
+                }
+                block->max_hits = 2 * block->max_hits + INIT_MAX_ENTITIES;
+                block->hits = realloc_(block->hits, block->max_hits * sizeof(uint32_t));
+        }
+        block->hits[block->num_hits++] = i;
+        block->term_offsets[block->num_terms] = block->num_hits;
+}
 
- 		if (retcode != END_OF_FIELD) {
-			fprintf(stderr, "Invalid gmt file format (file %s, line %d, field #1).\n",
-				gmt_filename, line_num);
-			exit(EXIT_FAILURE);
-		}
-		retcode = FSFile_next_field(fp, '\t', buf2, GMT_MAX_FIELD_WIDTH);
-		if (retcode != END_OF_FIELD) {
-			fprintf(stderr, "Invalid gmt file format (file %s, line %d, field #2).\n",
-				gmt_filename, line_num);
-			exit(EXIT_FAILURE);
-		}
 
-		active_term = term_db->insert_term(term_db, buf1, namespace, buf2);
+/* Reads the file of a block. Parsing stops at the first format error. */
+static
+void GMTBlock_parse(void *block_)
+{
+        GMTBlock *block = (GMTBlock *) block_;
+	unsigned int line_num = 1;
+	unsigned int current_field;
+        PrintBuf pbuf;
+        LineReader *reader;
+        char *line;
+        char *cur;
+        char *end;
+        char *term_id;
+        char *description;
+        char *symbol;
+        size_t len;
+	InFile *in;
+
+        block->entity2index = StrTable_init(INIT_MAX_ENTITIES);
+        Arena_init(&block->strings);
+        (void) PrintBuf_init(&pbuf);  /* the block takes the buffer */
+
+	in = InFile_open(block->filename);
+	if (in == NULL) {
+		PrintBuf_printf(&pbuf, 0, "Could not open file %s.\n", block->filename);
+                block->error = pbuf.buf;
+                return;
+	}
+        reader = LineReader_init(in->fp);
 
-		if (active_term) {
-			mapping_db->insert_new_mapping(mapping_db);
+	while ((line = LineReader_next(reader, &len)) != NULL) {
+		/* First read term_id and description */
+                cur = line;
+                end = line + len;
+                term_id = FSFile_split_field(&cur, end, '\t');
+ 		if (cur == NULL) {
+			PrintBuf_printf(&pbuf, 0, "Invalid gmt file format (file %s, line %d, field #1).\n",
+                                        block->filename, line_num);
+                        break;
+		}
+                description = FSFile_split_field(&cur, end, '\t');
+		if (cur == NULL) {
+			PrintBuf_printf(&pbuf, 0, "Invalid gmt file format (file %s, line %d, field #2).\n",
+                                        block->filename, line_num);
+                        break;
 		}
+                GMTBlock_insert_term(block, term_id, description);
 
 		/* Now process all entities (genes) for that term */
 		current_field = 3;
-		do {
-			retcode = FSFile_next_field(fp, '\t', buf1, GMT_MAX_FIELD_WIDTH);
-			if (retcode == TRUNCATED_FIELD) {
-				fprintf(stderr, "Maximum field width (%d chars) exceeded (file %s, line %d, field #%d).\n",
-					GMT_MAX_FIELD_WIDTH-1, gmt_filename, line_num, current_field);
-				exit(EXIT_FAILURE);
-			}
-                        if (strlen(buf1) < 1) {
-				fprintf(stderr, "Empty entity field (file %s, line %d, field #%d).\n",
-					gmt_filename, line_num, current_field);
-				exit(EXIT_FAILURE);
+		while (cur != NULL) {
+                        symbol = FSFile_split_field(&cur, end, '\t');
+                        if (*symbol == '\0') {
+				PrintBuf_printf(&pbuf, 0, "Empty entity field (file %s, line %d, field #%d).\n",
+                                                block->filename, line_num, current_field);
+                                break;
                         }
-
-			if (active_term) {
-				entity_index = entity_db->insert_item(entity_db, buf1, NULL);
-                                mapping_db->insert_hit(mapping_db, entity_index);
-			}
+                        GMTBlock_insert_hit(block, symbol);
 			current_field++;
-		} while (retcode == END_OF_FIELD);
-
+		}
+                if (cur != NULL) {
+                        break;
+                }
 		line_num++;
 	}
 
-	fclose(fp);
+        if (pbuf.len > 0) {
+                block->error = pbuf.buf;
+        }
+        else {
+                PrintBuf_delete(&pbuf);
+        }
+        LineReader_delete(reader);
+	InFile_close(in);
+}
 
-	*entity_db_ = entity_db;
-	*term_db_ = term_db;
-	*mapping_db_ = mapping_db;
 
+/* Adds the terms of a parsed block to the databases, exactly as if its file
+   were read line by line: terms whose IDs are already present are skipped
+   and entities are inserted in order of their first appearance in the
+   remaining terms. */
+static
+void GMTBlock_merge(GMTBlock *block, const char *namespace, EntityDb *entity_db,
+                    CVTermDb *term_db, TermMappingDb *mapping_db)
+{
+        uint32_t *counts;
+        uint32_t *entity_map;
+        uint32_t *dest;
+        uint8_t *active;
+        uint32_t num_active = 0;
+        uint32_t e;
+        uint32_t t;
+        TermOffset k;
+
+        if (block->error != NULL) {
+                fputs(block->error, stderr);
+                exit(EXIT_FAILURE);
+        }
+        counts = malloc_(((size_t) block->num_terms + 1) * sizeof(uint32_t));
+        active = malloc_((size_t) block->num_terms + 1);
+        for (t=0; t < block->num_terms; t++) {
+                active[t] = term_db->insert_term(term_db, block->term_ids[t], namespace,
+                                                 block->descriptions[t]);
+                if (active[t]) {
+                        counts[num_active++] = (uint32_t) (block->term_offsets[t+1]
+                                                           - block->term_offsets[t]);
+                }
+        }
+        dest = TermMappingDb_append_mappings(mapping_db, counts, num_active);
+
+        entity_map = malloc_(((size_t) block->num_entities + 1) * sizeof(uint32_t));
+        for (e=0; e < block->num_entities; e++) {
+                entity_map[e] = GMT_UNMAPPED;
+        }
+        for (t=0; t < block->num_terms; t++) {
+                if (!active[t]) {
+                        continue;
+                }
+                for (k=block->term_offsets[t]; k < block->term_offsets[t+1]; k++) {
+                        e = block->hits[k];
+                        if (entity_map[e] == GMT_UNMAPPED) {
+                                entity_map[e] = entity_db->insert_item(entity_db,
+                                                                       block->entities[e],
+                                                                       NULL);
+                        }
+                        *dest++ = entity_map[e];
+                }
+        }
+        free(counts);
+        free(active);
+        free(entity_map);
+}
+
+
+/* Loads GMT files into the databases, creating those that are NULL. The
+   files are parsed concurrently and then merged in the order given, so
+   the result is the same as that of loading them one by one. */
+int GMT_enrichment_context_multi(const char **namespaces, const char **gmt_filenames,
+                                 int num_files, EntityDb **entity_db_,
+                                 CVTermDb **term_db_, TermMappingDb **mapping_db_)
+{
+        GMTBlock *blocks;
+        int k;
+
+	if (*entity_db_ == NULL) {
+		*entity_db_ = (EntityDb *) GMTEntityDb_init();
+	}
+	if (*term_db_ == NULL) {
+		*term_db_ = (CVTermDb *) GMTTermDb_init();
+	}
+	if (*mapping_db_ == NULL) {
+		*mapping_db_ = TermMappingDb_init();
+	}
+        if (num_files < 1) {
+                return 1;
+        }
+
+        blocks = calloc_(num_files, sizeof(GMTBlock));
+        for (k=0; k < num_files; k++) {
+                blocks[k].filename = gmt_filenames[k];
+        }
+        run_tasks(GMTBlock_parse, blocks, sizeof(GMTBlock), num_files,
+                  num_worker_threads());
+        for (k=0; k < num_files; k++) {
+                GMTBlock_merge(blocks + k, namespaces[k], *entity_db_, *term_db_,
+                               *mapping_db_);
+                GMTBlock_delete(blocks + k);
+        }
+        free(blocks);
 	return 1;
 }
+
+
+int GMT_enrichment_context(const char *gmt_filename, const char *namespace, EntityDb **entity_db_,
+			   CVTermDb **term_db_, TermMappingDb **mapping_db_)
+{
+        return GMT_enrichment_context_multi(&namespace, &gmt_filename, 1, entity_db_,
+                                            term_db_, mapping_db_);
+}
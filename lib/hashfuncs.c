@@ -31,8 +31,11 @@
 *
 */
 
+#include <stdlib.h>
 #include <string.h>
 #include "miscutils.h"
+#include "hashtable.h"
+#include "hashtable_itr.h"
 
 /* sdbm function from http://www.cse.yorku.ca/~oz/hash.html */
 unsigned int hash_from_string(void *str)
@@ -70,3 +73,33 @@ int int_equal(void *i_, void *j_)
         }
 	return 0;
 }
+
+/* For hashtables mapping keys to (index + 1), replace each index i by
+   new_index[i] */
+void hashtable_renumber_values(struct hashtable *h, const uint32_t *new_index)
+{
+        struct hashtable_itr *itr;
+        intptr_t i;
+
+        if (hashtable_count(h) == 0) {
+                return;
+        }
+        itr = hashtable_iterator(h);
+        do {
+                i = (intptr_t) hashtable_iterator_value(itr) - 1;
+                hashtable_iterator_value(itr) = (void *) ((intptr_t) new_index[i] + 1);
+        } while (hashtable_iterator_advance(itr));
+        free(itr);
+}
+
+
+uint64_t fnv64_update(uint64_t hash, const void *buf, size_t n)
+{
+        const unsigned char *p = (const unsigned char *) buf;
+        const unsigned char *end = p + n;
+
+        for (; p < end; p++) {
+                hash = (hash ^ *p) * UINT64_C(1099511628211);
+        }
+        return hash;
+}
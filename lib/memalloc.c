@@ -36,6 +36,9 @@
 #include <string.h>
 #include "miscutils.h"
 
+#define ARENA_CHUNK_SIZE 65536
+#define ARENA_ALIGN 16  /* also the size of the chunk header */
+
 void *calloc_(size_t nmemb, size_t size)
 {
 	void *memp;
@@ -98,3 +101,64 @@ char *strdup_(const char *s)
 	p = memcpy(p,s,n);
 	return p;
 }
+
+
+void Arena_init(Arena *arena)
+{
+        arena->chunk = NULL;
+        arena->used = 0;
+        arena->size = 0;
+}
+
+
+/* Returns size bytes at the end of the arena, starting a new chunk if
+   they do not fit */
+static
+char *Arena_take(Arena *arena, size_t size)
+{
+        char *chunk;
+        size_t chunk_size;
+
+        if (arena->chunk == NULL || size > arena->size - arena->used) {
+                chunk_size = max(ARENA_CHUNK_SIZE, size + ARENA_ALIGN);
+                chunk = calloc_(1, chunk_size);
+                *(char **) chunk = arena->chunk;
+                arena->chunk = chunk;
+                arena->used = ARENA_ALIGN;
+                arena->size = chunk_size;
+        }
+        chunk = arena->chunk + arena->used;
+        arena->used += size;
+        return chunk;
+}
+
+
+void *Arena_alloc(Arena *arena, size_t size)
+{
+        arena->used = min(arena->size, (arena->used + ARENA_ALIGN - 1)
+                          & ~((size_t) ARENA_ALIGN - 1));
+        return Arena_take(arena, size);
+}
+
+
+/* Strings are packed without alignment */
+char *Arena_strdup(Arena *arena, const char *s)
+{
+        size_t n = strlen(s) + 1;
+        char *dest = Arena_take(arena, n);
+        memcpy(dest, s, n);
+        return dest;
+}
+
+
+void Arena_delete(Arena *arena)
+{
+        char *next;
+        while (arena->chunk != NULL) {
+                next = *(char **) arena->chunk;
+                free(arena->chunk);
+                arena->chunk = next;
+        }
+        arena->used = 0;
+        arena->size = 0;
+}
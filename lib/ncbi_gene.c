@@ -42,8 +42,9 @@
 #define NCBIGENES_ITEM_INCR 4096
 #define NCBIGENES_SYMB_BUF_INCR 4096
 #define NCBIGENES_DESC_BUF_INCR 16384
+#define NCBIGENES_OVERLAY_SIZE 64  /* initial hashtable size with indexes */
+#define CONFLICT_UNRESOLVABLE 0x80000000U  /* flag in conflict index values */
 
-#define NCBIGENE_MAGIC 1200900292U  /* from ncbi_gene.py */
 #define NCBIGENE_URL_FMT "http://www.ncbi.nlm.nih.gov/sites/entrez?" \
                          "db=gene&cmd=Retrieve&dopt=Graphics"        \
                          "&list_uids=%ld"
@@ -72,56 +73,13 @@ typedef struct _SymbolConflict_s {
 
 
 static
-void print_id_list(char *src, int num_items, PrintBuf *pbuf)
+void SymbolConflict_warning(SymbolConflict *conflict, EntityWarning *warning)
 {
-        int i;
-        if (num_items < 1) {
-                return; /* just in case */
-        }
-        PrintBuf_printf(pbuf, -1, "%s", src);
-        src += (strlen(src) + 1);
-        for (i=1; i < (num_items-1); i++) {
-                PrintBuf_printf(pbuf, -1, ", %s", src);
-                src += (strlen(src) + 1);
-        }
-        if (num_items > 1) {
-                PrintBuf_printf(pbuf, -1, " and %s", src);
-        }
-}
-
-
-static
-EntityWarning *SymbolConflict_warning(SymbolConflict *conflict)
-{
-        PrintBuf pbuf;
-	//	EntityWarning *warning = malloc_(sizeof(EntityWarning));
-	EntityWarning *warning = calloc_(1, sizeof(EntityWarning));
+        memset(warning, 0, sizeof(EntityWarning));
         warning->code = conflict->wtype;
-        char *cur = conflict->aliases;
-
-        /* Initialize PrintBuf on the stack. EntityWarning instance
-           will take ownership of the actual buffer so PrintBuf_delete
-           should not be called. */
-        (void) PrintBuf_init(&pbuf);
-
-        if (conflict->wtype == RESOLVABLE_CONFLICT) {
-                PrintBuf_printf(&pbuf, -1,  "Identifier %s is also a synonym for ",
-                                cur);
-                cur += (strlen(cur) + 1);
-                print_id_list(cur, conflict->num_aliases - 1, &pbuf);
-                PrintBuf_printf(&pbuf, -1,  ".");
-        }
-        else {
-                PrintBuf_printf(&pbuf, -1,
-                                "%s is not a primary identifier for any"
-                                " gene while being an alias for ",
-                                cur);
-                cur += (strlen(cur) + 1);
-                print_id_list(cur, conflict->num_aliases - 1, &pbuf);
-                PrintBuf_printf(&pbuf, -1,  ".");
-        }
-        warning->msg = pbuf.buf;
-        return warning;
+        warning->symbol = conflict->aliases;
+        warning->aliases = conflict->aliases;
+        warning->num_aliases = conflict->num_aliases;
 }
 
 
@@ -130,21 +88,59 @@ static
 void NCBIGenesDb_delete(EntityDb *entity_db_)
 {
 	NCBIGenesDb *entity_db = (NCBIGenesDb *) entity_db_;
-	hashtable_destroy(entity_db->geneid2index, 0);
 	hashtable_destroy(entity_db->alias2index, 0);
-	hashtable_destroy(entity_db->conflicts, 1);
+        IntIndex_delete(entity_db->geneid_index, entity_db->reader);
+        StrIndex_delete(entity_db->alias_index, entity_db->reader);
+        StrIndex_delete(entity_db->conflict_index, entity_db->reader);
+        IntTable_delete(entity_db->geneid_table);
+        StrTable_delete(entity_db->alias_table);
+        StrTable_delete(entity_db->conflict_table);
+        free(entity_db->index_map);
 	free(entity_db->gene_ids);
 	free(entity_db->symbols);
         free(entity_db->descriptions);
-	free(entity_db->metadata_buf);
+	BinReader_free(entity_db->reader, entity_db->metadata_buf);
 	free(entity_db->symbols_buf);
-	free(entity_db->desc_buf);
-        free(entity_db->conflicts1_buf);
-        free(entity_db->conflicts2_buf);
+	BinReader_free(entity_db->reader, entity_db->desc_buf);
+        BinReader_free(entity_db->reader, entity_db->conflicts1_buf);
+        BinReader_free(entity_db->reader, entity_db->conflicts2_buf);
+        BinReader_release(entity_db->reader);
 	free(entity_db);
 }
 
 
+/* Looks up the symbol in the indexes or tables of the loaded genes */
+static
+int NCBIGenesDb_search_indexes(NCBIGenesDb *entity_db, const char *symbol,
+                               int is_gene_id, uint32_t gene_id, uint32_t *i)
+{
+        int found = 0;
+        if (is_gene_id && entity_db->geneid_index != NULL) {
+                found = IntIndex_search(entity_db->geneid_index, gene_id, i);
+        }
+        else if (is_gene_id && entity_db->geneid_table != NULL) {
+                found = IntTable_search(entity_db->geneid_table, gene_id, i);
+        }
+        if (!found && entity_db->alias_index != NULL) {
+                found = (StrIndex_search(entity_db->alias_index, symbol, i) != NULL);
+        }
+        else if (!found && entity_db->alias_table != NULL) {
+                found = (StrTable_search(entity_db->alias_table, symbol, i) != NULL);
+        }
+        if (!found) {
+                return 0;
+        }
+        if (*i >= entity_db->num_indexed) {
+                fprintf(stderr, "Invalid database index.\n");
+                exit(EXIT_FAILURE);
+        }
+        if (entity_db->index_map != NULL) {
+                *i = entity_db->index_map[*i];
+        }
+        return 1;
+}
+
+
 static
 int NCBIGenesDb_search_symbol(NCBIGenesDb *entity_db, const char *symbol, uint32_t *i)
 {
@@ -152,13 +148,12 @@ int NCBIGenesDb_search_symbol(NCBIGenesDb *entity_db, const char *symbol, uint32
         uint32_t gene_id;
         gene_id = (uint32_t) strtoul(symbol, &endptr, 0);
         void *indx = NULL;
-        if (*endptr == '\0') {  /* string is valid */
-                indx = hashtable_search(entity_db->geneid2index, &gene_id);
-        }
-	if (indx == NULL) {
-                /* The cast is OK since the key is not modified by hashtable_search */
-                indx = hashtable_search(entity_db->alias2index, (char *) symbol);
+        if (NCBIGenesDb_search_indexes(entity_db, symbol, *endptr == '\0',
+                                       gene_id, i)) {
+                return 1;
         }
+        /* The cast is OK since the key is not modified by hashtable_search */
+        indx = hashtable_search(entity_db->alias2index, (char *) symbol);
 	if (indx == NULL) {
                 return 0;
         }
@@ -167,6 +162,26 @@ int NCBIGenesDb_search_symbol(NCBIGenesDb *entity_db, const char *symbol, uint32
 }
 
 
+/* Moves a string buffer to a new, larger allocation and updates the first
+   num_items pointers into it. The old buffer may be in the file image, so
+   it cannot simply be realloc'ed. */
+static
+char *NCBIGenesDb_grow_buf(NCBIGenesDb *entity_db, char *buf, uint32_t len,
+                           uint32_t *size, uint32_t incr, char **items,
+                           uint32_t num_items)
+{
+        char *new_buf = malloc_(*size + incr);
+        uint32_t i;
+        memcpy(new_buf, buf, len);
+        for (i=0; i < num_items; i++) {
+                items[i] = new_buf + (items[i] - buf);
+        }
+        BinReader_free(entity_db->reader, buf);
+        *size += incr;
+        return new_buf;
+}
+
+
 static
 uint32_t NCBIGenesDb_insert_item(EntityDb *entity_db_, const char *symbol,
                                  const char *description)
@@ -191,9 +206,12 @@ uint32_t NCBIGenesDb_insert_item(EntityDb *entity_db_, const char *symbol,
 
                 n = strlen(symbol) + 1;
                 if (entity_db->symbols_buf_len + n >= entity_db->symbols_buf_size) {
-                        entity_db->symbols_buf_size += (n + NCBIGENES_SYMB_BUF_INCR);
-                        entity_db->symbols_buf = realloc_(entity_db->symbols_buf,
-                                                          entity_db->symbols_buf_size);
+                        entity_db->symbols_buf = NCBIGenesDb_grow_buf(entity_db,
+                                                                      entity_db->symbols_buf,
+                                                                      entity_db->symbols_buf_len,
+                                                                      &entity_db->symbols_buf_size,
+                                                                      n + NCBIGENES_SYMB_BUF_INCR,
+                                                                      entity_db->symbols, i);
                 }
                 memcpy(entity_db->symbols_buf + entity_db->symbols_buf_len, symbol, n);
                 entity_db->symbols[i] = entity_db->symbols_buf + entity_db->symbols_buf_len;
@@ -205,9 +223,12 @@ uint32_t NCBIGenesDb_insert_item(EntityDb *entity_db_, const char *symbol,
 
                 n = strlen(description) + 1;
                 if (entity_db->desc_buf_len + n >= entity_db->desc_buf_size) {
-                        entity_db->desc_buf_size += (n + NCBIGENES_DESC_BUF_INCR);
-                        entity_db->desc_buf = realloc_(entity_db->desc_buf,
-                                                          entity_db->desc_buf_size);
+                        entity_db->desc_buf = NCBIGenesDb_grow_buf(entity_db,
+                                                                   entity_db->desc_buf,
+                                                                   entity_db->desc_buf_len,
+                                                                   &entity_db->desc_buf_size,
+                                                                   n + NCBIGENES_DESC_BUF_INCR,
+                                                                   entity_db->descriptions, i);
                 }
                 memcpy(entity_db->desc_buf + entity_db->desc_buf_len, description, n);
                 entity_db->descriptions[i] = entity_db->desc_buf + entity_db->desc_buf_len;
@@ -223,41 +244,52 @@ uint32_t NCBIGenesDb_insert_item(EntityDb *entity_db_, const char *symbol,
 }
 
 
+/* Returns the conflict for symbol, using tmp as storage for indexed ones */
 static
-EntityWarning *NCBIGenesDb_map_symbol(EntityDb *entity_db_, char *symbol, uint32_t *i)
+SymbolConflict *NCBIGenesDb_search_conflict(NCBIGenesDb *entity_db, char *symbol,
+                                            SymbolConflict *tmp)
+{
+        uint32_t value;
+        const char *aliases;
+        if (entity_db->conflict_index != NULL) {
+                aliases = StrIndex_search(entity_db->conflict_index, symbol, &value);
+        }
+        else {
+                aliases = StrTable_search(entity_db->conflict_table, symbol, &value);
+        }
+        if (aliases == NULL) {
+                return NULL;
+        }
+        tmp->wtype = (value & CONFLICT_UNRESOLVABLE)
+                ? UNRESOLVABLE_CONFLICT : RESOLVABLE_CONFLICT;
+        tmp->num_aliases = value & ~CONFLICT_UNRESOLVABLE;
+        tmp->aliases = (char *) aliases;
+        return tmp;
+}
+
+
+static
+int NCBIGenesDb_map_symbol(EntityDb *entity_db_, char *symbol, uint32_t *i,
+                           EntityWarning *warning)
 {
-	PrintBuf pbuf;
         SymbolConflict *conflict;
-	EntityWarning *warning = NULL;
+        SymbolConflict tmp;
 	NCBIGenesDb *entity_db = (NCBIGenesDb *) entity_db_;
         int found = NCBIGenesDb_search_symbol(entity_db, symbol, i);
 
-	if (!found) {
-                conflict = (SymbolConflict *) hashtable_search(entity_db->conflicts, symbol);
-                if (conflict != NULL) {
-                        /* unresolvable conflict */
-                        warning = SymbolConflict_warning(conflict);
-                }
-                else {
-                        /* Initialize PrintBuf on the stack. EntityWarning instance
-                           will take ownership of the actual buffer so PrintBuf_delete
-                           should not be called. */
-                        (void) PrintBuf_init(&pbuf);
-
-                        warning = calloc_(1, sizeof(EntityWarning));
-                        PrintBuf_printf(&pbuf, 0, "%s", symbol);
-                        warning->msg = pbuf.buf;
-                        warning->code = UNKNOWN_ID;
-                }
+        conflict = NCBIGenesDb_search_conflict(entity_db, symbol, &tmp);
+	if (conflict != NULL) {
+                /* the type of conflict was decided when it was stored */
+                SymbolConflict_warning(conflict, warning);
+                return 1;
 	}
-        else {
-                conflict = (SymbolConflict *) hashtable_search(entity_db->conflicts, symbol);
-                if (conflict != NULL) {
-                        /* resolvable conflict */
-                        warning = SymbolConflict_warning(conflict);
-                }
+        if (!found) {
+                memset(warning, 0, sizeof(EntityWarning));
+                warning->symbol = symbol;
+                warning->code = UNKNOWN_ID;
+                return 1;
         }
-	return warning;
+	return 0;
 }
 
 
@@ -284,38 +316,103 @@ Entity *NCBIGenesDb_get_entity_from_index(EntityDb *entity_db_, uint32_t i)
 }
 
 static
-void NCBIGenesDb_insert_conflicts(FILE *fp, NCBIGenesDb *entity_db,
-                                  EntityWarning_code_type wtype)
+void NCBIGenesDb_renumber(EntityDb *entity_db_, const uint32_t *new_index)
+{
+	NCBIGenesDb *entity_db = (NCBIGenesDb *) entity_db_;
+        uint32_t n = entity_db->max_entities + 1;
+        uint32_t *gene_ids = malloc_(n * sizeof(uint32_t));
+        char **symbols = malloc_(n * sizeof(char *));
+        char **descriptions = malloc_(n * sizeof(char *));
+        uint32_t i;
+
+        for (i=0; i < entity_db->num_entities; i++) {
+                gene_ids[new_index[i]] = entity_db->gene_ids[i];
+                symbols[new_index[i]] = entity_db->symbols[i];
+                descriptions[new_index[i]] = entity_db->descriptions[i];
+        }
+        free(entity_db->gene_ids);
+        free(entity_db->symbols);
+        free(entity_db->descriptions);
+        entity_db->gene_ids = gene_ids;
+        entity_db->symbols = symbols;
+        entity_db->descriptions = descriptions;
+        hashtable_renumber_values(entity_db->alias2index, new_index);
+
+        /* indexed values are translated on lookup */
+        if (entity_db->num_indexed > 0) {
+                if (entity_db->index_map == NULL) {
+                        entity_db->index_map = malloc_(n * sizeof(uint32_t));
+                        for (i=0; i < entity_db->num_indexed; i++) {
+                                entity_db->index_map[i] = new_index[i];
+                        }
+                }
+                else {
+                        for (i=0; i < entity_db->num_indexed; i++) {
+                                entity_db->index_map[i] = new_index[entity_db->index_map[i]];
+                        }
+                }
+        }
+}
+
+static
+uint32_t NCBIGenesDb_loaded_index(EntityDb *entity_db_, uint32_t i)
+{
+	NCBIGenesDb *entity_db = (NCBIGenesDb *) entity_db_;
+        return (entity_db->index_map != NULL) ? entity_db->index_map[i] : i;
+}
+
+
+/* Continues the fingerprint of a gene block with integers in their file
+   (little-endian) byte order */
+static
+uint64_t fingerprint_uint32(uint64_t hash, const uint32_t *ptr, uint32_t nmemb)
+{
+        unsigned char le[4];
+        uint32_t i;
+
+        for (i=0; i < nmemb; i++) {
+                le[0] = ptr[i] & 0xFF;
+                le[1] = (ptr[i] >> 8) & 0xFF;
+                le[2] = (ptr[i] >> 16) & 0xFF;
+                le[3] = ptr[i] >> 24;
+                hash = fnv64_update(hash, le, 4);
+        }
+        return hash;
+}
+
+
+static
+void NCBIGenesDb_insert_conflicts(BinReader *reader, NCBIGenesDb *entity_db,
+                                  EntityWarning_code_type wtype, uint64_t *hash)
 {
         uint32_t n;
         uint32_t tmp;
         uint32_t *counts;
         char *cur;
-        SymbolConflict *cnf;
         int i;
         int j;
 
-        fread_uint32(&n, 1, fp);
+        BinReader_read_uint32(reader, &n, 1);
         counts = malloc_(n * sizeof(uint32_t));
-        fread_uint32(counts, n, fp);
+        BinReader_read_uint32(reader, counts, n);
 
-        cur = fread_buf(fp, &tmp);
+        cur = BinReader_buf(reader, &tmp);
+        *hash = fingerprint_uint32(*hash, counts, n);
+        *hash = fnv64_update(*hash, cur, tmp);
         if (wtype == RESOLVABLE_CONFLICT) {
                 entity_db->conflicts1_buf = cur;
         }
         else {
                 entity_db->conflicts2_buf = cur;
         }
+        if (entity_db->conflict_index != NULL) {
+                n = 0;  /* already indexed */
+        }
 
         for (i=0; i < n; i++) {
-                cnf = malloc_(sizeof(SymbolConflict));
-                cnf->wtype = wtype;
-                cnf->num_aliases = counts[i];
-                cnf->aliases = cur;
-                if (! hashtable_insert(entity_db->conflicts, strdup_(cur), (void *) cnf) ) {
-                        fprintf(stderr, "Could not insert conflict for %s.\n", cur);
-                        exit(EXIT_FAILURE);
-                }
+                StrTable_insert(entity_db->conflict_table, cur,
+                                counts[i] | ((wtype == UNRESOLVABLE_CONFLICT)
+                                             ? CONFLICT_UNRESOLVABLE : 0));
                 for (j=0; j < counts[i]; j++) {
                         cur += (strlen(cur) + 1);
                 }
@@ -323,87 +420,125 @@ void NCBIGenesDb_insert_conflicts(FILE *fp, NCBIGenesDb *entity_db,
         free(counts);
 }
 
-NCBIGenesDb *NCBIGenesDb_init(FILE *fp)
+static
+void NCBIGenesDb_read_header(BinReader *reader)
 {
         char header[8];
+        uint32_t tmp;
+        BinReader_read(reader, header, 8);
+        BinReader_read_uint32(reader, &tmp, 1);
+        if (memcmp(header, "NCBIGENE", 8) || (tmp != NCBIGENE_MAGIC)) {
+                fprintf(stderr, "Invalid binary file format for gene_info index.\n");
+                exit(EXIT_FAILURE);
+        }
+}
+
+
+/* The indexes, if given, must cover the gene block being read and all of
+   them must be present. The database takes ownership of them. The genes
+   are fingerprinted by their IDs, symbols, aliases and conflicts, which
+   determine how identifiers are resolved, in file order. */
+NCBIGenesDb *NCBIGenesDb_init(BinReader *reader, IntIndex *geneid_index,
+                              StrIndex *alias_index, StrIndex *conflict_index)
+{
         uint32_t tmp;
         uint32_t n;
         uint32_t *counts;
-        uint32_t *gene_id_;
+        uint32_t num_aliases;
         char *buf;
         char *cur;
         char *dest;
-        intptr_t i;
-        int j;
+        uint32_t i;
+        uint32_t j;
+        uint64_t hash = FNV64_OFFSET;
 	NCBIGenesDb *entity_db = calloc_(1, sizeof(NCBIGenesDb));
+        entity_db->reader = reader;
+        BinReader_retain(reader);
+        entity_db->geneid_index = geneid_index;
+        entity_db->alias_index = alias_index;
+        entity_db->conflict_index = conflict_index;
 
         /* header */
-        fread_(header, 1, 8, fp);
-        fread_uint32(&tmp, 1, fp);
-        if (memcmp(header, "NCBIGENE", 8) || (tmp != NCBIGENE_MAGIC)) {
-                fprintf(stderr, "Invalid binary file format for gene_info index.\n");
-                exit(EXIT_FAILURE);
-        }
+        NCBIGenesDb_read_header(reader);
 
         /* metadata */
-        entity_db->metadata_buf = fread_buf(fp, &tmp);
+        entity_db->metadata_buf = BinReader_buf(reader, &tmp);
         entity_db->gene_info_file = entity_db->metadata_buf;
         entity_db->url_fmt = entity_db->metadata_buf + strlen(entity_db->metadata_buf) + 1;
 
         /* skip checksum */
-        fread_uint32(&tmp, 1, fp);
+        BinReader_read_uint32(reader, &tmp, 1);
 
         /* tax_id */
-        fread_uint32(&entity_db->tax_id, 1, fp);
+        BinReader_read_uint32(reader, &entity_db->tax_id, 1);
 
         /* gene count - allocate all related arrays */
-        fread_uint32(&entity_db->num_entities, 1, fp);
+        BinReader_read_uint32(reader, &entity_db->num_entities, 1);
 	entity_db->max_entities = entity_db->num_entities;
         entity_db->gene_ids = malloc_(entity_db->num_entities * sizeof(uint32_t));
         entity_db->symbols = malloc_(entity_db->num_entities * sizeof(char *));
         entity_db->descriptions = malloc_(entity_db->num_entities * sizeof(char *));
-	entity_db->alias2index = create_hashtable(entity_db->num_entities,
+        entity_db->num_indexed = entity_db->num_entities;
+	entity_db->alias2index = create_hashtable(NCBIGENES_OVERLAY_SIZE,
                                                   hash_from_string, str_equal);
-	entity_db->geneid2index = create_hashtable(entity_db->num_entities,
-                                                   hash_from_int, int_equal);
-	entity_db->conflicts = create_hashtable(entity_db->num_entities / 2,
-                                                hash_from_string, str_equal);
 
         /* gene_ids */
-        fread_uint32(entity_db->gene_ids, entity_db->num_entities, fp);
-        for (i=0; i < entity_db->num_entities; i++) {
-                gene_id_ = malloc_(sizeof(uint32_t));
-                *gene_id_ = entity_db->gene_ids[i];
-		if (! hashtable_insert(entity_db->geneid2index,
-                                       gene_id_, (void *) (i+1)) ) {
-			fprintf(stderr, "Could not insert gene id %ld.\n",
-                                (long int) entity_db->gene_ids[i]);
-			exit(EXIT_FAILURE);
-		}
+        BinReader_read_uint32(reader, entity_db->gene_ids, entity_db->num_entities);
+        hash = fingerprint_uint32(hash, entity_db->gene_ids, entity_db->num_entities);
+        if (geneid_index == NULL) {
+                entity_db->geneid_table = IntTable_init(entity_db->num_entities);
+                for (i=0; i < entity_db->num_entities; i++) {
+                        /* genes without IDs are found by symbol */
+                        if (entity_db->gene_ids[i] != 0) {
+                                IntTable_insert(entity_db->geneid_table,
+                                                entity_db->gene_ids[i], i);
+                        }
+                }
         }
 
         /* skip offsets */
-        fseek(fp, (entity_db->num_entities+1)*sizeof(uint32_t), SEEK_CUR);
+        BinReader_skip(reader, ((size_t) entity_db->num_entities+1)*sizeof(uint32_t));
 
         /* symbols */
         counts = malloc_(entity_db->num_entities * sizeof(uint32_t));
-        fread_uint32(counts, entity_db->num_entities, fp);
-        buf = fread_buf(fp, &tmp); /* temporary buffer */
+        BinReader_read_uint32(reader, counts, entity_db->num_entities);
+        buf = BinReader_buf(reader, &tmp); /* keys of alias_table */
+        hash = fingerprint_uint32(hash, counts, entity_db->num_entities);
+        hash = fnv64_update(hash, buf, tmp);
 
-        /* insert all symbols and aliases into entity_db->alias2index */
-        /*    (also count cannonical symbols) */
+        /* count cannonical symbols */
         cur = buf;
-        for (i=0; i < entity_db->num_entities; i++) {
+        for (num_aliases=0, i=0; i < entity_db->num_entities; i++) {
                 entity_db->symbols_buf_len += (strlen(cur) + 1);
                 for (j=0; j < counts[i]; j++) {
-                        if (! hashtable_insert(entity_db->alias2index,
-                                               strdup_(cur),
-                                               (void *) (i+1)) ) {
-                                fprintf(stderr, "Could not insert entity item %s.\n", cur);
-                                exit(EXIT_FAILURE);
-                        }
                         cur += (strlen(cur) + 1);
                 }
+                num_aliases += counts[i];
+        }
+
+        /* Without an index, put all symbols into alias_table, followed by
+           the other aliases, so that a symbol takes precedence over the
+           same alias of another gene */
+        if (alias_index == NULL) {
+                entity_db->alias_table = StrTable_init(num_aliases);
+                cur = buf;
+                for (i=0; i < entity_db->num_entities; i++) {
+                        for (j=0; j < counts[i]; j++) {
+                                if (j == 0) {
+                                        StrTable_insert(entity_db->alias_table, cur, i);
+                                }
+                                cur += (strlen(cur) + 1);
+                        }
+                }
+                cur = buf;
+                for (i=0; i < entity_db->num_entities; i++) {
+                        for (j=0; j < counts[i]; j++) {
+                                if (j > 0) {
+                                        StrTable_insert(entity_db->alias_table, cur, i);
+                                }
+                                cur += (strlen(cur) + 1);
+                        }
+                }
         }
 
         /* Insert cannonical symbols into entity_db->symbols_buf and make
@@ -423,29 +558,149 @@ NCBIGenesDb *NCBIGenesDb_init(FILE *fp)
                         cur += n;
                 }
         }
-        free(buf);
         free(counts);
 
         /* descriptions */
-        entity_db->desc_buf = fread_buf(fp, &entity_db->desc_buf_size);
+        entity_db->desc_buf = BinReader_buf(reader, &entity_db->desc_buf_size);
         entity_db->desc_buf_len = entity_db->desc_buf_size;
         strbuf2array(entity_db->descriptions, entity_db->desc_buf, entity_db->num_entities);
 
         /* conflicts */
-        NCBIGenesDb_insert_conflicts(fp, entity_db, RESOLVABLE_CONFLICT);
-        NCBIGenesDb_insert_conflicts(fp, entity_db, UNRESOLVABLE_CONFLICT);
+        if (conflict_index == NULL) {
+                entity_db->conflict_table = StrTable_init(NCBIGENES_OVERLAY_SIZE);
+        }
+        NCBIGenesDb_insert_conflicts(reader, entity_db, RESOLVABLE_CONFLICT, &hash);
+        NCBIGenesDb_insert_conflicts(reader, entity_db, UNRESOLVABLE_CONFLICT, &hash);
+        entity_db->num_loaded = entity_db->num_entities;
+        entity_db->fingerprint = hash ? hash : 1;  /* zero means none */
 
         /* function pointers */
 	entity_db->delete = NCBIGenesDb_delete;
 	entity_db->map_symbol = NCBIGenesDb_map_symbol;
 	entity_db->get_entity_from_index = NCBIGenesDb_get_entity_from_index;
         entity_db->insert_item = NCBIGenesDb_insert_item;
+        entity_db->renumber = NCBIGenesDb_renumber;
+        entity_db->loaded_index = NCBIGenesDb_loaded_index;
 	return entity_db;
 }
 
 
+/* Moves the reader past a gene_info block without loading it. Returns the
+   number of genes in the block. */
+uint32_t NCBIGenesDb_skip(BinReader *reader)
+{
+        uint32_t tmp;
+        uint32_t N;
+        int i;
 
+        NCBIGenesDb_read_header(reader);
+        BinReader_skip_buf(reader);
+        BinReader_skip(reader, 2 * sizeof(uint32_t));
+        BinReader_read_uint32(reader, &N, 1);
+        BinReader_skip(reader, (3 * (size_t) N + 1) * sizeof(uint32_t));
+        BinReader_skip_buf(reader);
+        BinReader_skip_buf(reader);
+        for (i=0; i < 2; i++) {
+                BinReader_read_uint32(reader, &tmp, 1);
+                BinReader_skip(reader, (size_t) tmp * sizeof(uint32_t));
+                BinReader_skip_buf(reader);
+        }
+        return N;
+}
 
 
+/* Builds the gene ID, alias and conflict indexes (in that order) of the
+   gene_info block at the current position of reader. Keys map to gene
+   indexes, except for conflicts, whose values hold the number of aliases
+   in the conflict and the CONFLICT_UNRESOLVABLE flag. A name that is both
+   the symbol of one gene and an alias of another maps to the former.
+   Genes without IDs (zero) are left out of the gene ID index. */
+void NCBIGenesDb_pack_indexes(BinReader *reader, char **packed,
+                              uint32_t *num_keys, uint64_t *sizes)
+{
+        uint32_t N;
+        uint32_t n;
+        uint32_t *gene_ids;
+        uint32_t *counts;
+        uint32_t *values;
+        uint32_t *key_sizes = NULL;
+        char **keys;
+        char *cur;
+        size_t total;
+        size_t k;
+        size_t m;
+        size_t p;
+        uint32_t i;
+        uint32_t j;
+        int w;
+
+        NCBIGenesDb_read_header(reader);
+        BinReader_skip_buf(reader);
+        BinReader_skip(reader, 2 * sizeof(uint32_t));
+        BinReader_read_uint32(reader, &N, 1);
+
+        /* gene IDs */
+        gene_ids = malloc_(((size_t) N + 1) * sizeof(uint32_t));
+        values = malloc_(((size_t) N + 1) * sizeof(uint32_t));
+        BinReader_read_uint32(reader, gene_ids, N);
+        for (n=0, i=0; i < N; i++) {
+                if (gene_ids[i] != 0) {
+                        gene_ids[n] = gene_ids[i];
+                        values[n++] = i;
+                }
+        }
+        packed[0] = IntIndex_pack(gene_ids, values, n, num_keys, sizes);
+        free(gene_ids);
+        BinReader_skip(reader, ((size_t) N + 1) * sizeof(uint32_t));
+
+        /* symbols followed by aliases */
+        counts = malloc_(((size_t) N + 1) * sizeof(uint32_t));
+        BinReader_read_uint32(reader, counts, N);
+        for (total=0, m=0, i=0; i < N; i++) {
+                total += counts[i];
+                m += (counts[i] > 0);
+        }
+        keys = malloc_((total + 1) * sizeof(char *));
+        values = realloc_(values, (total + 1) * sizeof(uint32_t));
+        cur = BinReader_buf(reader, &n);
+        for (p=0, k=m, i=0; i < N; i++) {
+                for (j=0; j < counts[i]; j++) {
+                        if (j == 0) {
+                                keys[p] = cur;
+                                values[p++] = i;
+                        }
+                        else {
+                                keys[k] = cur;
+                                values[k++] = i;
+                        }
+                        cur += (strlen(cur) + 1);
+                }
+        }
+        packed[1] = StrIndex_pack(keys, NULL, values, total, num_keys + 1, sizes + 1);
+        BinReader_skip_buf(reader);
+
+        /* resolvable conflicts followed by unresolvable ones */
+        for (k=0, w=0; w < 2; w++) {
+                BinReader_read_uint32(reader, &n, 1);
+                counts = realloc_(counts, ((size_t) n + 1) * sizeof(uint32_t));
+                keys = realloc_(keys, (k + n + 1) * sizeof(char *));
+                values = realloc_(values, (k + n + 1) * sizeof(uint32_t));
+                key_sizes = realloc_(key_sizes, (k + n + 1) * sizeof(uint32_t));
+                BinReader_read_uint32(reader, counts, n);
+                cur = BinReader_buf(reader, &j);
+                for (i=0; i < n; i++, k++) {
+                        keys[k] = cur;
+                        values[k] = counts[i] | (w ? CONFLICT_UNRESOLVABLE : 0);
+                        for (j=0; j < counts[i]; j++) {
+                                cur += (strlen(cur) + 1);
+                        }
+                        key_sizes[k] = cur - keys[k];
+                }
+        }
+        packed[2] = StrIndex_pack(keys, key_sizes, values, k, num_keys + 2, sizes + 2);
 
-
+        free(counts);
+        free(keys);
+        free(values);
+        free(key_sizes);
+}
@@ -0,0 +1,182 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdint.h>
+#include <string.h>
+#ifndef _WIN32
+#include <unistd.h>
+#endif
+#include "miscutils.h"
+#include "platmap.h"
+
+#define PLATFORM_MAP_MAGIC "SSPLTMAP"
+#define PLATFORM_MAP_MAGIC_LEN 8
+#define PLATFORM_MAP_VERSION 2
+
+
+uint64_t PlatformMap_hash_row(uint64_t rows_hash, uint64_t row_hash)
+{
+        unsigned char bytes[8];
+        int i;
+
+        for (i=0; i < 8; i++) {
+                bytes[i] = (unsigned char) (row_hash >> (8 * i));
+        }
+        return fnv64_update(rows_hash, bytes, 8);
+}
+
+
+PlatformMap *PlatformMap_init(uint32_t num_rows, uint64_t fingerprint,
+                              uint64_t rows_hash)
+{
+        PlatformMap *map = malloc_(sizeof(PlatformMap));
+
+        map->num_rows = num_rows;
+        map->fingerprint = fingerprint;
+        map->rows_hash = rows_hash;
+        map->genes = malloc_(((size_t) num_rows + 1) * sizeof(uint32_t));
+        map->codes = calloc_((size_t) num_rows + 1, sizeof(uint8_t));
+        map->reader = NULL;
+        return map;
+}
+
+
+void PlatformMap_delete(PlatformMap *map)
+{
+        BinReader_free(map->reader, map->genes);
+        free(map->codes);
+        if (map->reader != NULL) {
+                BinReader_release(map->reader);
+        }
+        free(map);
+}
+
+
+/* Anything that does not add up is taken as a stale map rather than an
+   error */
+PlatformMap *PlatformMap_read(const char *filename, uint32_t num_rows,
+                              uint64_t fingerprint, uint64_t rows_hash,
+                              uint32_t num_genes)
+{
+        BinReader *reader;
+        PlatformMap *map;
+        uint32_t header[2];
+        uint64_t keys[2];
+        uint32_t i;
+
+        reader = BinReader_open(filename);
+        if (reader == NULL) {
+                return NULL;
+        }
+        if (reader->size < PLATFORM_MAP_MAGIC_LEN + 2 * sizeof(uint32_t)
+            + 2 * sizeof(uint64_t)
+            || memcmp(reader->data, PLATFORM_MAP_MAGIC, PLATFORM_MAP_MAGIC_LEN)) {
+                BinReader_release(reader);
+                return NULL;
+        }
+        BinReader_skip(reader, PLATFORM_MAP_MAGIC_LEN);
+        BinReader_read_uint32(reader, header, 2);
+        BinReader_read_uint64(reader, keys, 2);
+        if (header[0] != PLATFORM_MAP_VERSION || header[1] != num_rows
+            || keys[0] != fingerprint || keys[1] != rows_hash
+            || reader->size - reader->pos != 5 * (uint64_t) num_rows) {
+                BinReader_release(reader);
+                return NULL;
+        }
+
+        map = malloc_(sizeof(PlatformMap));
+        map->num_rows = num_rows;
+        map->fingerprint = fingerprint;
+        map->rows_hash = rows_hash;
+        map->reader = reader;
+        map->genes = BinReader_uint32_array(reader, num_rows);
+        map->codes = malloc_((size_t) num_rows + 1);
+        BinReader_read(reader, map->codes, num_rows);
+        for (i=0; i < num_rows; i++) {
+                if (map->genes[i] == PLATFORM_MAP_NONE ? !map->codes[i]
+                    : map->genes[i] >= num_genes) {
+                        PlatformMap_delete(map);
+                        return NULL;
+                }
+        }
+        return map;
+}
+
+
+int PlatformMap_write(const PlatformMap *map, const char *filename)
+{
+        PrintBuf *pbuf = PrintBuf_init(NULL);
+        FILE *fp;
+        uint32_t header[2];
+        uint64_t keys[2];
+        int ok;
+
+        /* maps of several analyses in one process are written at once */
+#ifndef _WIN32
+        PrintBuf_printf(pbuf, 0, "%s.%ld.%lx.tmp", filename, (long) getpid(),
+                        (unsigned long) (uintptr_t) map);
+#else
+        PrintBuf_printf(pbuf, 0, "%s.%lx.tmp", filename,
+                        (unsigned long) (uintptr_t) map);
+#endif
+        fp = fopen(pbuf->buf, "wb");
+        if (fp == NULL) {
+                PrintBuf_delete(pbuf);
+                return 0;
+        }
+        header[0] = PLATFORM_MAP_VERSION;
+        header[1] = map->num_rows;
+        keys[0] = map->fingerprint;
+        keys[1] = map->rows_hash;
+        fwrite_(PLATFORM_MAP_MAGIC, 1, PLATFORM_MAP_MAGIC_LEN, fp);
+        fwrite_uint32(header, 2, fp);
+        fwrite_uint64(keys, 2, fp);
+        fwrite_uint32(map->genes, map->num_rows, fp);
+        fwrite_(map->codes, 1, map->num_rows, fp);
+        ok = (fclose(fp) == 0);
+#ifdef _WIN32
+        remove(filename);
+#endif
+        if (ok) {
+                ok = (rename(pbuf->buf, filename) == 0);
+        }
+        if (!ok) {
+                remove(pbuf->buf);
+        }
+        PrintBuf_delete(pbuf);
+        return ok;
+}
@@ -0,0 +1,137 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef SADDLESUM_NO_THREADS
+#include <pthread.h>
+#include <unistd.h>
+#endif
+#include "miscutils.h"
+#include "taskpool.h"
+
+#define MAX_WORKER_THREADS 8
+
+
+#ifndef SADDLESUM_NO_THREADS
+
+typedef struct _TaskQueue_s {
+        void (*func) (void *);
+        char *tasks;
+        size_t task_size;
+        size_t num_tasks;
+        size_t next;
+        pthread_mutex_t lock;
+} TaskQueue;
+
+
+static
+void *TaskQueue_work(void *queue_)
+{
+        TaskQueue *queue = (TaskQueue *) queue_;
+        size_t i;
+
+        for (;;) {
+                pthread_mutex_lock(&queue->lock);
+                i = queue->next++;
+                pthread_mutex_unlock(&queue->lock);
+                if (i >= queue->num_tasks) {
+                        break;
+                }
+                queue->func(queue->tasks + i * queue->task_size);
+        }
+        return NULL;
+}
+
+
+void run_tasks(void (*func) (void *), void *tasks, size_t task_size,
+               size_t num_tasks, int max_threads)
+{
+        TaskQueue queue;
+        pthread_t *threads;
+        int num_threads;
+        int i;
+
+        num_threads = (num_tasks < (size_t) max_threads) ? (int) num_tasks : max_threads;
+        queue.func = func;
+        queue.tasks = (char *) tasks;
+        queue.task_size = task_size;
+        queue.num_tasks = num_tasks;
+        queue.next = 0;
+        pthread_mutex_init(&queue.lock, NULL);
+
+        /* Threads that cannot be created are simply not used */
+        threads = malloc_((num_threads > 1 ? num_threads : 1) * sizeof(pthread_t));
+        for (i=1; i < num_threads; i++) {
+                if (pthread_create(threads + i, NULL, TaskQueue_work, &queue)) {
+                        break;
+                }
+        }
+        num_threads = i;
+        (void) TaskQueue_work(&queue);
+        for (i=1; i < num_threads; i++) {
+                pthread_join(threads[i], NULL);
+        }
+        free(threads);
+        pthread_mutex_destroy(&queue.lock);
+}
+
+
+int num_worker_threads(void)
+{
+        long n = sysconf(_SC_NPROCESSORS_ONLN);
+        if (n < 1) {
+                return 1;
+        }
+        return (n > MAX_WORKER_THREADS) ? MAX_WORKER_THREADS : (int) n;
+}
+
+#else
+
+void run_tasks(void (*func) (void *), void *tasks, size_t task_size,
+               size_t num_tasks, int max_threads)
+{
+        size_t i;
+        for (i=0; i < num_tasks; i++) {
+                func((char *) tasks + i * task_size);
+        }
+}
+
+
+int num_worker_threads(void)
+{
+        return 1;
+}
+
+#endif /* SADDLESUM_NO_THREADS */
@@ -34,6 +34,7 @@
 #include <stdlib.h>
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
 #include "miscutils.h"
 #include "enrich.h"
 
@@ -49,6 +50,9 @@ void TermMappingDb_delete(TermMappingDb *mapping_db)
 	mapping_db->offsets = NULL;
 	mapping_db->max_mappings = 0;
 	mapping_db->num_mappings = 0;
+	free(mapping_db->term2set);
+	mapping_db->term2set = NULL;
+	mapping_db->num_sets = 0;
 	free(mapping_db);
 }
 
@@ -60,31 +64,65 @@ void TermMappingDb_reset(TermMappingDb *mapping_db)
 }
 
 
+/* Compatibility iterator - library code uses TermMappingDb_get_mapping() */
 static
 int TermMappingDb_get_next_mapping(TermMappingDb *mapping_db, uint32_t *term_index,
                                    uint32_t **hits, uint32_t *num_hits)
 {
+	const uint32_t *span;
 	uint32_t i = mapping_db->current_term;
 	if (i >= mapping_db->num_mappings) {
 		*hits = NULL;
 		return 0;
 	}
 	*term_index = i;
-	*hits = mapping_db->hits + mapping_db->offsets[i];
-	*num_hits = mapping_db->offsets[i+1] - mapping_db->offsets[i];
+	*num_hits = TermMappingDb_get_mapping(mapping_db, i, &span);
+	*hits = (uint32_t *) span;
 	mapping_db->current_term++;
 	return 1;
 }
 
 
+static
+void capacity_exceeded(void)
+{
+        fprintf(stderr, "Too many terms or term-entity associations for this build"
+#ifndef SADDLESUM_LARGE_DB
+                " (recompile with -DSADDLESUM_LARGE_DB)"
+#endif
+                ".\n");
+        exit(EXIT_FAILURE);
+}
+
+
+/* Doubles capacity, failing instead of silently wrapping around */
+static
+TermOffset grow_capacity(TermOffset capacity, TermOffset limit, size_t item_size)
+{
+        if (capacity >= limit) {
+                capacity_exceeded();
+        }
+        if (SIZE_MAX / item_size < limit) {
+                limit = (TermOffset) (SIZE_MAX / item_size);
+        }
+        return capacity > limit / 2 ? limit : 2 * capacity;
+}
+
+
 static
 void TermMappingDb_insert_new_mapping(TermMappingDb *mapping_db)
 {
+        if (mapping_db->term2set != NULL) {
+                fprintf(stderr, "Cannot insert mappings after deduplication.\n");
+                exit(EXIT_FAILURE);
+        }
         mapping_db->num_mappings++;
+        mapping_db->num_sets = mapping_db->num_mappings;
         if (mapping_db->num_mappings >= mapping_db->max_mappings) {
-                mapping_db->max_mappings *= 2;
+                mapping_db->max_mappings = grow_capacity(mapping_db->max_mappings,
+                                                         UINT32_MAX, sizeof(TermOffset));
                 mapping_db->offsets = realloc_(mapping_db->offsets,
-                                               mapping_db->max_mappings*sizeof(uint32_t));
+                                               mapping_db->max_mappings*sizeof(TermOffset));
         }
         mapping_db->offsets[mapping_db->num_mappings] = mapping_db->num_hits;
 }
@@ -94,7 +132,8 @@ static
 void TermMappingDb_insert_hit(TermMappingDb *mapping_db, uint32_t entity_index)
 {
         if (mapping_db->num_hits >= mapping_db->max_hits) {
-                mapping_db->max_hits *= 2;
+                mapping_db->max_hits = grow_capacity(mapping_db->max_hits,
+                                                     TERM_OFFSET_MAX, sizeof(uint32_t));
                 mapping_db->hits = realloc_(mapping_db->hits,
                                             mapping_db->max_hits*sizeof(uint32_t));
         }
@@ -103,6 +142,37 @@ void TermMappingDb_insert_hit(TermMappingDb *mapping_db, uint32_t entity_index)
 }
 
 
+/* Appends num_terms mappings with the given numbers of hits and returns
+   the location where the caller must store all their hits, in order */
+uint32_t *TermMappingDb_append_mappings(TermMappingDb *mapping_db,
+                                        const uint32_t *counts, uint32_t num_terms)
+{
+        TermOffset num_hits = mapping_db->num_hits;
+        uint32_t *hits;
+        uint32_t i;
+
+        for (i=0; i < num_terms; i++) {
+                mapping_db->insert_new_mapping(mapping_db);
+                if (counts[i] > TERM_OFFSET_MAX - mapping_db->num_hits) {
+                        capacity_exceeded();
+                }
+                mapping_db->num_hits += counts[i];
+                mapping_db->offsets[mapping_db->num_mappings] = mapping_db->num_hits;
+        }
+        if (mapping_db->num_hits > mapping_db->max_hits) {
+                while (mapping_db->num_hits > mapping_db->max_hits) {
+                        mapping_db->max_hits = grow_capacity(mapping_db->max_hits,
+                                                             TERM_OFFSET_MAX,
+                                                             sizeof(uint32_t));
+                }
+                mapping_db->hits = realloc_(mapping_db->hits,
+                                            mapping_db->max_hits*sizeof(uint32_t));
+        }
+        hits = mapping_db->hits + num_hits;
+        return hits;
+}
+
+
 TermMappingDb *TermMappingDb_init(void)
 {
 	TermMappingDb *mapping_db = calloc_(1, sizeof(TermMappingDb));
@@ -114,10 +184,312 @@ TermMappingDb *TermMappingDb_init(void)
 	mapping_db->hits = calloc_(INIT_MAX_ENTITIES, sizeof(uint32_t));
 	mapping_db->max_hits = INIT_MAX_ENTITIES;
 	mapping_db->num_hits = 0;
-	mapping_db->offsets = calloc_(INIT_MAX_TERMS + 1, sizeof(uint32_t));
+	mapping_db->offsets = calloc_(INIT_MAX_TERMS + 1, sizeof(TermOffset));
 	mapping_db->max_mappings = INIT_MAX_TERMS + 1;
 	mapping_db->num_mappings = 0;
 	mapping_db->current_term = 0;
+	mapping_db->term2set = NULL;
+	mapping_db->num_sets = 0;
 	return mapping_db;
 }
 
+
+
+/* Locality-optimizing entity order */
+
+static int uint64_compare(const void *M1, const void *M2)
+{
+        const uint64_t *v1 = (const uint64_t *) M1;
+        const uint64_t *v2 = (const uint64_t *) M2;
+        return (*v1 > *v2) - (*v1 < *v2);
+}
+
+
+static int uint32_compare(const void *M1, const void *M2)
+{
+        const uint32_t *v1 = (const uint32_t *) M1;
+        const uint32_t *v2 = (const uint32_t *) M2;
+        return (*v1 > *v2) - (*v1 < *v2);
+}
+
+
+/* Sort items by key using a packed (key, item) 64-bit array as scratch */
+static
+void sort_by_key(uint32_t *items, uint32_t n, const uint32_t *keys, uint64_t *scratch)
+{
+        uint32_t i;
+        for (i=0; i < n; i++) {
+                scratch[i] = (((uint64_t) keys[items[i]]) << 32) | items[i];
+        }
+        qsort(scratch, n, sizeof(uint64_t), uint64_compare);
+        for (i=0; i < n; i++) {
+                items[i] = (uint32_t) scratch[i];
+        }
+}
+
+
+/* Computes the new index of each entity by Reverse Cuthill-McKee
+   traversal of the term-entity bipartite graph. Each entity visits its
+   terms from the smallest to the largest, so that entities sharing
+   specific terms end up close together while the very large (root-like)
+   terms, which would otherwise pull in everything at once, are reached
+   last. Entities not mapped to any term are placed at the end. */
+static
+uint32_t *TermMappingDb_locality_order(TermMappingDb *mapping_db, uint32_t num_entities)
+{
+        uint32_t num_terms = mapping_db->num_sets;
+        uint32_t *degree = calloc_(num_entities + 1, sizeof(uint32_t));
+        uint32_t *term_size = malloc_((num_terms + 1) * sizeof(uint32_t));
+        uint32_t *term_order = malloc_((num_terms + 1) * sizeof(uint32_t));
+        TermOffset *ent_offsets = calloc_(num_entities + 1, sizeof(TermOffset));
+        uint32_t *ent_terms;
+        uint32_t *order = malloc_((num_entities + 1) * sizeof(uint32_t));
+        uint32_t *new_index = malloc_((num_entities + 1) * sizeof(uint32_t));
+        uint8_t *visited_terms = calloc_(num_terms + 1, sizeof(uint8_t));
+        uint8_t *assigned = calloc_(num_entities + 1, sizeof(uint8_t));
+        uint64_t *scratch = malloc_((max(num_terms, num_entities) + 1) * sizeof(uint64_t));
+        const uint32_t *hits;
+        uint32_t num_hits;
+        uint32_t head;
+        uint32_t tail;
+        uint32_t start;
+        uint32_t n;
+        uint32_t e;
+        uint32_t t;
+        uint32_t i;
+        TermOffset j;
+
+        /* Entity degrees and terms sorted by size */
+        for (t=0; t < num_terms; t++) {
+                num_hits = TermMappingDb_get_set(mapping_db, t, &hits);
+                term_size[t] = num_hits;
+                term_order[t] = t;
+                for (i=0; i < num_hits; i++) {
+                        degree[hits[i]]++;
+                }
+        }
+        sort_by_key(term_order, num_terms, term_size, scratch);
+
+        /* Transpose: for each entity, its terms in increasing size */
+        for (e=0; e < num_entities; e++) {
+                ent_offsets[e+1] = ent_offsets[e] + degree[e];
+        }
+        ent_terms = malloc_((ent_offsets[num_entities] + 1) * sizeof(uint32_t));
+        memset(degree, 0, num_entities * sizeof(uint32_t));
+        for (j=0; j < num_terms; j++) {
+                t = term_order[j];
+                num_hits = TermMappingDb_get_set(mapping_db, t, &hits);
+                for (i=0; i < num_hits; i++) {
+                        e = hits[i];
+                        ent_terms[ent_offsets[e] + degree[e]++] = t;
+                }
+        }
+
+        /* Start points in order of increasing degree */
+        for (e=0; e < num_entities; e++) {
+                new_index[e] = e;
+        }
+        sort_by_key(new_index, num_entities, degree, scratch);
+
+        /* Cuthill-McKee: the queue is the order array itself */
+        head = 0;
+        tail = 0;
+        for (start=0; start < num_entities; start++) {
+                e = new_index[start];
+                if (assigned[e] || degree[e] == 0) {
+                        continue;
+                }
+                assigned[e] = 1;
+                order[tail++] = e;
+                while (head < tail) {
+                        e = order[head++];
+                        for (j=ent_offsets[e]; j < ent_offsets[e+1]; j++) {
+                                t = ent_terms[j];
+                                if (visited_terms[t]) {
+                                        continue;
+                                }
+                                visited_terms[t] = 1;
+                                num_hits = TermMappingDb_get_set(mapping_db, t, &hits);
+                                for (n=tail, i=0; i < num_hits; i++) {
+                                        if (!assigned[hits[i]]) {
+                                                assigned[hits[i]] = 1;
+                                                order[tail++] = hits[i];
+                                        }
+                                }
+                                sort_by_key(order + n, tail - n, degree, scratch);
+                        }
+                }
+        }
+
+        /* Reverse the order of connected entities, then append the rest */
+        for (i=0; i < tail; i++) {
+                new_index[order[i]] = tail - 1 - i;
+        }
+        for (n=tail, e=0; e < num_entities; e++) {
+                if (!assigned[e]) {
+                        new_index[e] = n++;
+                }
+        }
+
+        free(degree);
+        free(term_size);
+        free(term_order);
+        free(ent_offsets);
+        free(ent_terms);
+        free(order);
+        free(visited_terms);
+        free(assigned);
+        free(scratch);
+        return new_index;
+}
+
+
+/* Rewrite all hits with new entity indices and sort each span, so that the
+   gathers in the scoring loops walk memory in increasing address order. */
+static
+void TermMappingDb_renumber_entities(TermMappingDb *mapping_db, const uint32_t *new_index)
+{
+        uint32_t t;
+        TermOffset i;
+        uint32_t *hits;
+        uint32_t num_hits;
+
+        for (i=0; i < mapping_db->num_hits; i++) {
+                mapping_db->hits[i] = new_index[mapping_db->hits[i]];
+        }
+        for (t=0; t < mapping_db->num_sets; t++) {
+                hits = mapping_db->hits + mapping_db->offsets[t];
+                num_hits = (uint32_t) (mapping_db->offsets[t+1] - mapping_db->offsets[t]);
+                qsort(hits, num_hits, sizeof(uint32_t), uint32_compare);
+        }
+}
+
+
+void TermMappingDb_reorder_entities(TermMappingDb *mapping_db, EntityDb *entity_db)
+{
+        uint32_t *new_index = TermMappingDb_locality_order(mapping_db,
+                                                           entity_db->num_entities);
+        TermMappingDb_renumber_entities(mapping_db, new_index);
+        entity_db->renumber(entity_db, new_index);
+        free(new_index);
+}
+
+
+
+/* Deduplication of identical entity sets */
+
+/* FNV-1a over the sorted hits of a set */
+static
+uint32_t hash_from_hits(const uint32_t *hits, uint32_t num_hits)
+{
+        uint32_t hash = 2166136261U ^ num_hits;
+        uint32_t i;
+        for (i=0; i < num_hits; i++) {
+                hash = (hash ^ hits[i]) * 16777619U;
+        }
+        return hash;
+}
+
+
+/* Detects terms with identical sets of hits (in any order) and keeps only
+   one copy of each set. Terms are matched by hashing their sorted hits and
+   comparing the candidates with equal hashes. The first term with a given
+   set keeps its hit order, so its printed output does not change. Must be
+   called after all mappings have been inserted. */
+void TermMappingDb_deduplicate(TermMappingDb *mapping_db)
+{
+        uint32_t num_terms = mapping_db->num_mappings;
+        TermOffset *offsets = mapping_db->offsets;
+        uint32_t *sorted_hits;
+        uint32_t *term2set;
+        TermOffset *new_offsets;
+        uint64_t *keys;
+        uint32_t num_sets;
+        uint32_t num_hits;
+        uint32_t group;
+        uint32_t hash;
+        uint32_t t;
+        uint32_t u;
+        uint32_t i;
+        uint32_t j;
+
+        if (mapping_db->term2set != NULL || num_terms < 2) {
+                return;
+        }
+
+        /* Hash sorted copies of all sets */
+        sorted_hits = malloc_((mapping_db->num_hits + 1) * sizeof(uint32_t));
+        memcpy(sorted_hits, mapping_db->hits, mapping_db->num_hits * sizeof(uint32_t));
+        keys = malloc_(num_terms * sizeof(uint64_t));
+        for (t=0; t < num_terms; t++) {
+                num_hits = (uint32_t) (offsets[t+1] - offsets[t]);
+                qsort(sorted_hits + offsets[t], num_hits, sizeof(uint32_t), uint32_compare);
+                hash = hash_from_hits(sorted_hits + offsets[t], num_hits);
+                keys[t] = (((uint64_t) hash) << 32) | t;
+        }
+        qsort(keys, num_terms, sizeof(uint64_t), uint64_compare);
+
+        /* Within each group of equal hashes (ordered by term index), map
+           every term to the first earlier term with the same hits */
+        term2set = malloc_(num_terms * sizeof(uint32_t));
+        for (t=0; t < num_terms; t++) {
+                term2set[t] = t;
+        }
+        for (group=0; group < num_terms; group=i) {
+                hash = (uint32_t) (keys[group] >> 32);
+                for (i=group+1; i < num_terms && (uint32_t) (keys[i] >> 32) == hash; i++) {
+                        t = (uint32_t) keys[i];
+                        num_hits = (uint32_t) (offsets[t+1] - offsets[t]);
+                        for (j=group; j < i; j++) {
+                                u = (uint32_t) keys[j];
+                                if (term2set[u] == u
+                                    && offsets[u+1] - offsets[u] == num_hits
+                                    && !memcmp(sorted_hits + offsets[u],
+                                               sorted_hits + offsets[t],
+                                               num_hits * sizeof(uint32_t))) {
+                                        term2set[t] = u;
+                                        break;
+                                }
+                        }
+                }
+        }
+        free(keys);
+        free(sorted_hits);
+
+        /* Count unique sets; nothing to do if there are no duplicates */
+        for (num_sets=0, t=0; t < num_terms; t++) {
+                num_sets += (term2set[t] == t);
+        }
+        if (num_sets == num_terms) {
+                free(term2set);
+                return;
+        }
+
+        /* Compact the hits in place, keeping only the first copy of each set.
+           A representative always precedes its duplicates, so its set index
+           is already known when a duplicate is reached. */
+        new_offsets = malloc_((num_sets + 1) * sizeof(TermOffset));
+        new_offsets[0] = 0;
+        for (num_sets=0, t=0; t < num_terms; t++) {
+                if (term2set[t] != t) {
+                        term2set[t] = term2set[term2set[t]];
+                        continue;
+                }
+                num_hits = (uint32_t) (offsets[t+1] - offsets[t]);
+                memmove(mapping_db->hits + new_offsets[num_sets],
+                        mapping_db->hits + offsets[t],
+                        num_hits * sizeof(uint32_t));
+                new_offsets[num_sets+1] = new_offsets[num_sets] + num_hits;
+                term2set[t] = num_sets++;
+        }
+
+        free(mapping_db->offsets);
+        mapping_db->offsets = new_offsets;
+        mapping_db->max_mappings = num_sets + 1;
+        mapping_db->num_hits = new_offsets[num_sets];
+        mapping_db->max_hits = mapping_db->num_hits + 1;
+        mapping_db->hits = realloc_(mapping_db->hits,
+                                    mapping_db->max_hits * sizeof(uint32_t));
+        mapping_db->term2set = term2set;
+        mapping_db->num_sets = num_sets;
+}
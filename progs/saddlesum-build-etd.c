@@ -0,0 +1,153 @@
+/*
+* ===========================================================================
+*
+*                            PUBLIC DOMAIN NOTICE
+*               National Center for Biotechnology Information
+*
+*  This software/database is a "United States Government Work" under the
+*  terms of the United States Copyright Act.  It was written as part of
+*  the author's official duties as a United States Government employee and
+*  thus cannot be copyrighted.  This software/database is freely available
+*  to the public for use. The National Library of Medicine and the U.S.
+*  Government have not placed any restriction on its use or reproduction.
+*
+*  Although all reasonable efforts have been taken to ensure the accuracy
+*  and reliability of the software and data, the NLM and the U.S.
+*  Government do not and cannot warrant the performance or results that
+*  may be obtained by using this software or data. The NLM and the U.S.
+*  Government disclaim all warranties, express or implied, including
+*  warranties of performance, merchantability or fitness for any particular
+*  purpose.
+*
+*  Please cite the author in any work or product based on this material.
+*
+* ===========================================================================
+*
+* Code author:  Aleksandar Stojmirovic
+*
+* Reference: A. Stojmirovic and Y-K Yu. Robust and accurate data enrichment
+*            statistics via distribution function of sum of weights.
+*            Bioinformatics, 26(21):2752-2759, 2010.
+*
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <stdint.h>
+#include "enrich.h"
+#include "miscutils.h"
+#include "help.h"
+
+#define MIN_ARGS 2
+#define FULL_VERSION VERSION " (qmbpmn-tools-" VERSION ")"
+
+#define option_err_msg(msg) fprintf(stderr, "%s: %s\nFor help type %s -h\n", \
+                                    argv[0], msg, argv[0]); \
+                            exit(EXIT_FAILURE)
+
+
+char help_msg[] = HELP_BUILD_ETD;
+
+
+static void get_namespace_and_file(char *arg, char **namespace, char **filename,
+				   char sepchar)
+{
+	*namespace = NULL;
+	*filename = arg;
+
+	for (; *arg; arg++) {
+		if (*arg == sepchar) {
+			*arg = '\0';
+			*namespace = *filename;
+			*filename = arg+1;
+			break;
+		}
+	}
+}
+
+
+int main(int argc, char **argv)
+{
+        /* Option parsing */
+        int c;
+        long int tmp_long;
+        char *tailptr;
+        int i;
+
+        /* Database arguments */
+        const char *db_name = NULL;
+        const char *gene_info_filename = NULL;
+        uint32_t tax_id = 0;
+        const char **namespaces;
+        const char **gmt_filenames;
+        char *namespace;
+        char *gmt_filename;
+        int num_files;
+
+	const char *etd_filename;
+
+        opterr = 0;
+        while ( (c = getopt(argc, argv, "Vhn:g:t:")) != -1) {
+                switch (c) {
+                case 'V':
+                        printf("%s: version %s\n", argv[0], FULL_VERSION);
+                        exit(EXIT_SUCCESS);
+                        break;
+                case 'h':
+                        printf("%s", help_msg);
+                        exit(EXIT_SUCCESS);
+                        break;
+                case 'n':
+                        db_name = optarg;
+                        break;
+                case 'g':
+                        gene_info_filename = optarg;
+                        break;
+                case 't':
+                        tmp_long = strtol(optarg, &tailptr, 10);
+                        if (tailptr == optarg || tmp_long < 1 || tmp_long > UINT32_MAX) {
+                                option_err_msg("Invalid argument for option -t.");
+                        }
+                        tax_id = tmp_long;
+                        break;
+                case '?':
+                        fprintf(stderr, "%s: Invalid option -- %c.\nFor help type %s -h.\n",
+                                argv[0], optopt, argv[0]);
+                        exit(EXIT_FAILURE);
+                        break;
+                default:
+                        option_err_msg("Invalid arguments.");
+                }
+        }
+        if (argc < optind + MIN_ARGS) {
+                option_err_msg("Insufficient arguments.");
+        }
+
+        etd_filename = argv[optind++];
+        if (db_name == NULL) {
+                db_name = etd_filename;
+        }
+
+        /* GMT databases (namespace is compulsory) */
+        num_files = argc - optind;
+        namespaces = malloc_(num_files * sizeof(char *));
+        gmt_filenames = malloc_(num_files * sizeof(char *));
+        for (i=0; optind < argc; optind++, i++) {
+		get_namespace_and_file(argv[optind], &namespace, &gmt_filename, ':');
+		if (namespace == NULL) {
+			option_err_msg("Specifying namespace is mandatory for all "
+				       "term databases.");
+		}
+                namespaces[i] = namespace;
+                gmt_filenames[i] = gmt_filename;
+        }
+
+        ETDTermDb_build(etd_filename, db_name, gene_info_filename, tax_id,
+                        namespaces, gmt_filenames, num_files);
+
+        free(namespaces);
+        free(gmt_filenames);
+	return EXIT_SUCCESS;
+}
@@ -65,11 +65,13 @@ int main(int argc, char **argv)
         OutputType output_type = TEXT;
         FILE *fp = stdout;
         uint8_t show_namespaces_only = 0;
+        uint8_t show_genes = 0;
+        const char *v2_filename = NULL;
 
 	const char *etd_filename;
 
         opterr = 0;
-        while ( (c = getopt(argc, argv, "VhNO:F:")) != -1) {
+        while ( (c = getopt(argc, argv, "VhNGC:O:F:")) != -1) {
                 switch (c) {
                 case 'V':
                         printf("%s: version %s\n", argv[0], FULL_VERSION);
@@ -82,6 +84,12 @@ int main(int argc, char **argv)
                 case 'N':
                         show_namespaces_only = 1;
                         break;
+                case 'G':
+                        show_genes = 1;
+                        break;
+                case 'C':
+                        v2_filename = optarg;
+                        break;
                 case 'O':
                         output_filename = optarg;
                         fp = fopen(output_filename, "w");
@@ -117,9 +125,15 @@ int main(int argc, char **argv)
 
         etd_filename = argv[optind];
 
-        if (show_namespaces_only) {
+        if (v2_filename != NULL) {
+                ETDTermDb_write_v2(etd_filename, v2_filename);
+        }
+        else if (show_namespaces_only) {
                 ETDTermDb_print_namespaces(etd_filename, fp, output_type);
         }
+        else if (show_genes) {
+                ETDTermDb_print_genes(etd_filename, fp, output_type);
+        }
         else {
                 ETDTermDb_print_info(etd_filename, fp, output_type);
         }
@@ -38,13 +38,19 @@
 #include <stdint.h>
 #include "enrich.h"
 #include "miscutils.h"
+#include "taskpool.h"
+#include "fsfile.h"
 #include "help.h"
 
 #define MAX_EXCLUDED 4
+#define TERM_ID_MAX_WIDTH 256
 #define MIN_ARGS 2
 #define STAT_OPTS 2
 #define TRANSFORM_OPTS 2
-#define OUTPUT_FMT_OPTS 2
+#define OUTPUT_FMT_OPTS 3
+#define MAX_BATCH_JOBS 64
+#define MANIFEST_OPTIONS "m:M:e:n:s:t:dr:w:x:i:aP:XC:T:F:WUN:"
+#define is_manifest_space(c) ((c) == ' ' || (c) == '\t' || (c) == '\r')
 #define FULL_VERSION VERSION " (qmbpmn-tools-" VERSION ")"
 
 #define option_err_msg(msg) fprintf(stderr, "%s: %s\nFor help type %s -h\n", \
@@ -54,6 +60,44 @@
 
 char help_msg[] = HELP_SADDLESUM;
 
+/* Read whitespace-separated term IDs from a file */
+static char **read_term_ids(const char *filename, int *num_term_ids)
+{
+        char buf[TERM_ID_MAX_WIDTH];
+        FSFile_proc_code_type retcode;
+        int max_term_ids = MAX_EXCLUDED;
+        char **term_ids = malloc_(max_term_ids * sizeof(char *));
+        InFile *in = InFile_open(filename);
+
+        if (in == NULL) {
+                fprintf(stderr, "Could not open term list file %s.\n", filename);
+                exit(EXIT_FAILURE);
+        }
+        *num_term_ids = 0;
+        do {
+                retcode = SSFile_next_field(in->fp, buf, TERM_ID_MAX_WIDTH);
+                if (retcode == TRUNCATED_FIELD) {
+                        fprintf(stderr, "Term ID too long in term list file %s.\n",
+                                filename);
+                        exit(EXIT_FAILURE);
+                }
+                if (buf[0] == '\0') {
+                        continue;
+                }
+                if (*num_term_ids >= max_term_ids) {
+                        max_term_ids *= 2;
+                        term_ids = realloc_(term_ids, max_term_ids * sizeof(char *));
+                }
+                term_ids[(*num_term_ids)++] = strdup_(buf);
+        } while (retcode != END_OF_FILE);
+        InFile_close(in);
+        if (*num_term_ids == 0) {
+                fprintf(stderr, "Term list file %s lists no terms.\n", filename);
+                exit(EXIT_FAILURE);
+        }
+        return term_ids;
+}
+
 static void get_namespace_and_file(char *arg, char **namespace, char **filename,
 				   char sepchar)
 {
@@ -70,59 +114,735 @@ static void get_namespace_and_file(char *arg, char **namespace, char **filename,
 	}
 }
 
-int main(int argc, char **argv)
+/* The term databases are loaded while the weights file is read */
+typedef struct _Startup_s {
+        const char *etd_filename;
+        const char **excluded_namespaces;
+        int num_excluded;
+        const char **gmt_namespaces;
+        const char **gmt_filenames;
+        int num_gmt_files;
+        uint8_t reorder_entities;
+        EntityDb *entity_db;
+        CVTermDb *term_db;
+        TermMappingDb *mapping_db;
+        const char *weights_filename;
+        uint8_t matrix;
+        const char **columns;
+        uint32_t num_columns;
+        EnrichWeights *weights;
+} Startup;
+
+typedef struct _StartupTask_s {
+        Startup *startup;
+        uint8_t read_weights;
+} StartupTask;
+
+static void Startup_load_databases(Startup *startup)
 {
-        /* Option parsing */
-        int c;
+        if (startup->etd_filename != NULL) {
+                ETD_enrichment_context(startup->etd_filename, &startup->entity_db,
+                                       &startup->term_db, &startup->mapping_db,
+                                       startup->excluded_namespaces,
+                                       startup->num_excluded);
+        }
+
+        /* GMT files are parsed concurrently */
+        GMT_enrichment_context_multi(startup->gmt_namespaces, startup->gmt_filenames,
+                                     startup->num_gmt_files, &startup->entity_db,
+                                     &startup->term_db, &startup->mapping_db);
+
+        /* Terms with identical entity sets are scored only once */
+        TermMappingDb_deduplicate(startup->mapping_db);
+
+        if (startup->reorder_entities) {
+                TermMappingDb_reorder_entities(startup->mapping_db, startup->entity_db);
+        }
+}
+
+static void StartupTask_run(void *task_)
+{
+        StartupTask *task = (StartupTask *) task_;
+        Startup *startup = task->startup;
+        if (task->read_weights && startup->matrix) {
+                startup->weights = EnrichWeights_read_matrix(startup->weights_filename,
+                                                             startup->columns,
+                                                             startup->num_columns);
+        }
+        else if (task->read_weights) {
+                startup->weights = EnrichWeights_read(startup->weights_filename);
+        }
+        else {
+                Startup_load_databases(startup);
+        }
+}
+
+/* Opens the output file, with %s in its name replaced by the weights
+   column if one is given */
+static FILE *open_output(const char *prog, const char *filename, const char *column)
+{
+        const char *subst = column != NULL ? strstr(filename, "%s") : NULL;
+        char *name = (char *) filename;
+        size_t n;
+        FILE *fp;
+
+        if (subst != NULL) {
+                n = subst - filename;
+                name = malloc_(strlen(filename) + strlen(column) + 1);
+                memcpy(name, filename, n);
+                strcpy(name + n, column);
+                strcat(name, subst + 2);
+        }
+        fp = fopen(name, "w");
+        if (fp == NULL) {
+                fprintf(stderr, "%s: Could not open output file %s.\n", prog, name);
+                exit(EXIT_FAILURE);
+        }
+        if (name != filename) {
+                free(name);
+        }
+        return fp;
+}
+
+static void print_results(EnrichContext *cntxt, FILE *fp, OutputType output_type,
+                          uint8_t long_table, uint8_t single_term,
+                          uint8_t print_warnings, uint8_t print_unknown_ids,
+                          EntityDb *entity_db, CVTermDb *term_db,
+                          TermMappingDb *mapping_db)
+{
+        if (long_table) {
+                EnrichResults_print_long(cntxt, fp);
+        }
+        else if (single_term) {
+                switch (output_type) {
+                case TEXT:
+                        EnrichResults_print_term_text(cntxt, fp, entity_db, mapping_db);
+                        break;
+                case TAB:
+                        EnrichResults_print_term_tabsep(cntxt, fp, entity_db, mapping_db);
+                        break;
+                }
+        }
+        else {
+                switch (output_type) {
+                case TEXT:
+                        EnrichResults_print_all_text(cntxt, fp, print_warnings,
+                                                     print_unknown_ids);
+                        break;
+                case TAB:
+                        EnrichResults_print_all_tabsep(cntxt, fp, term_db, mapping_db);
+                        break;
+                }
+        }
+}
+
+/* Options of one analysis. In batch mode, those on the command line are
+   the defaults for the analyses of the manifest. */
+typedef struct _Options_s {
+        /* Enrichment context arguments */
+        uint32_t min_term_size;
+        uint32_t max_term_size;
+        double Evalue_cutoff;
+        double effective_db_size;
+        EnrichStats statistics_type;
+        uint8_t discretized_weights;
+        TransformType transform_type;
+        CutoffType cutoff_type;
+        uint32_t rank_cutoff;
+        double weight_cutoff;
+        uint32_t use_all_weights;
+        const char *platform_map_filename;
+        uint32_t max_warnings;
+
+        /* Excluded namespaces and terms to consider (all if not given) */
+        const char **excluded_namespaces;
+        int num_excluded;
+        int max_excluded;
+        const char *term_list_filename;
+
+        /* Term to print instead of doing search */
+        const char *term_id;
+
+        /* Weights matrix (all columns unless selected) */
+        uint8_t matrix_input;
+        const char **columns;
+        uint32_t num_columns;
+        uint32_t max_columns;
+
+        /* Output arguments */
+        const char *output_filename;
+        OutputType output_type;
+        uint8_t long_table;
+        uint8_t print_warnings;
+        uint8_t print_unknown_ids;
+} Options;
+
+static void Options_init(Options *opts)
+{
+        memset(opts, 0, sizeof(Options));
+        opts->min_term_size = 3;
+        opts->Evalue_cutoff = 1e-02;
+        opts->effective_db_size = -1.0;
+        opts->statistics_type = SADDLESUM;
+        opts->transform_type = NO_TRANSFORM;
+        opts->cutoff_type = NONE;
+        opts->max_warnings = UINT32_MAX;
+        opts->max_excluded = MAX_EXCLUDED;
+        opts->excluded_namespaces = malloc_(MAX_EXCLUDED * sizeof(const char *));
+        opts->max_columns = MAX_EXCLUDED;
+        opts->columns = malloc_(MAX_EXCLUDED * sizeof(const char *));
+        opts->output_type = TEXT;
+}
+
+/* The copy has its own lists of excluded namespaces and columns */
+static void Options_copy(Options *dest, const Options *src)
+{
+        *dest = *src;
+        dest->excluded_namespaces = malloc_(src->max_excluded * sizeof(const char *));
+        memcpy(dest->excluded_namespaces, src->excluded_namespaces,
+               src->num_excluded * sizeof(const char *));
+        dest->columns = malloc_(src->max_columns * sizeof(const char *));
+        memcpy(dest->columns, src->columns, src->num_columns * sizeof(const char *));
+}
+
+static void Options_delete_lists(Options *opts)
+{
+        free(opts->excluded_namespaces);
+        free(opts->columns);
+}
+
+/* Sets the option c from its argument. Returns an error message if the
+   argument is invalid and NULL otherwise. */
+static const char *Options_set(Options *opts, int c, char *arg)
+{
+        const char *stats_types[STAT_OPTS] = {"wsum", "hgem"};
+        const char *transform_types[TRANSFORM_OPTS] = {"flip", "abs"};
+        const char *output_fmt_types[OUTPUT_FMT_OPTS] = {"txt", "tab", "long"};
         long int tmp_long;
         double tmp_dbl;
         char *tailptr;
-        const char *stats_types[STAT_OPTS] = {"wsum", "hgem"};
-        const char *transform_types[TRANSFORM_OPTS] = {"flip", "abs"};
-        const char *output_fmt_types[OUTPUT_FMT_OPTS] = {"txt", "tab"};
         int i;
 
-        /* Enrichment context arguments (set to defaults) */
-        const char *db_name = NULL;
-        uint32_t min_term_size = 3;
-        double Evalue_cutoff = 1e-02;
-        double effective_db_size = -1.0;
-        EnrichStats statistics_type = SADDLESUM;
-        uint8_t discretized_weights = 0;
-	TransformType transform_type = NO_TRANSFORM;
-        CutoffType cutoff_type = NONE;
-        uint32_t rank_cutoff = 0;
-        double weight_cutoff = 0.0;
-        uint32_t use_all_weights = 0;
+        switch (c) {
+        case 'm':
+                tmp_long = strtol(arg, &tailptr, 10);
+                if (tailptr == arg || tmp_long < 1 || tmp_long > UINT32_MAX) {
+                        return "Invalid argument for option -m.";
+                }
+                opts->min_term_size = tmp_long;
+                break;
+        case 'M':
+                tmp_long = strtol(arg, &tailptr, 10);
+                if (tailptr == arg || tmp_long < 1 || tmp_long > UINT32_MAX) {
+                        return "Invalid argument for option -M.";
+                }
+                opts->max_term_size = tmp_long;
+                break;
+        case 'e':
+                tmp_dbl = strtod(arg, &tailptr);
+                if (tailptr == arg || tmp_dbl < 0.0) {
+                        return "Invalid argument for option -e.";
+                }
+                opts->Evalue_cutoff = tmp_dbl;
+                break;
+        case 'n':
+                tmp_dbl = strtod(arg, &tailptr);
+                if (tailptr == arg || tmp_dbl < 0.0) {
+                        return "Invalid argument for option -n.";
+                }
+                opts->effective_db_size = tmp_dbl;
+                break;
+        case 's':
+                for (i=0; i < STAT_OPTS; i++) {
+                        if (!strcmp(arg, stats_types[i])) {
+                                opts->statistics_type = i;
+                                break;
+                        }
+                }
+                if (i >= STAT_OPTS) {
+                        return "Invalid argument for option -s.";
+                }
+                break;
+        case 't':
+                for (i=0; i < TRANSFORM_OPTS; i++) {
+                        if (!strcmp(arg, transform_types[i])) {
+                                opts->transform_type = i+1;
+                                break;
+                        }
+                }
+                if (i >= TRANSFORM_OPTS) {
+                        return "Invalid argument for option -t.";
+                }
+                break;
+        case 'd':
+                opts->discretized_weights = 1;
+                break;
+        case 'r':
+                tmp_long = strtol(arg, &tailptr, 10);
+                if (tailptr == arg || tmp_long < 1 || tmp_long > UINT32_MAX) {
+                        return "Invalid argument for option -r.";
+                }
+                if (opts->cutoff_type != NONE) {
+                        return "Cannot specify both -r and -w options.";
+                }
+                opts->cutoff_type = RANK;
+                opts->rank_cutoff = tmp_long;
+                break;
+        case 'w':
+                tmp_dbl = strtod(arg, &tailptr);
+                if (tailptr == arg || tmp_dbl < 0.0) {
+                        return "Invalid argument for option -w.";
+                }
+                if (opts->cutoff_type != NONE) {
+                        return "Cannot specify both -r and -w options.";
+                }
+                opts->cutoff_type = MIN_VALUE;
+                opts->weight_cutoff = tmp_dbl;
+                break;
+        case 'x':
+                if (opts->num_excluded >= opts->max_excluded) {
+                        opts->max_excluded *= 2;
+                        opts->excluded_namespaces = realloc_(opts->excluded_namespaces,
+                                                             opts->max_excluded
+                                                             * sizeof(const char *));
+                }
+                opts->excluded_namespaces[opts->num_excluded++] = arg;
+                break;
+        case 'i':
+                opts->term_list_filename = arg;
+                break;
+        case 'a':
+                opts->use_all_weights = 1;
+                break;
+        case 'P':
+                opts->platform_map_filename = arg;
+                break;
+        case 'X':
+                opts->matrix_input = 1;
+                break;
+        case 'C':
+                if (opts->num_columns >= opts->max_columns) {
+                        opts->max_columns *= 2;
+                        opts->columns = realloc_(opts->columns,
+                                                 opts->max_columns * sizeof(const char *));
+                }
+                opts->columns[opts->num_columns++] = arg;
+                break;
+        case 'T':
+                opts->term_id = arg;
+                break;
+        case 'O':
+                opts->output_filename = arg;
+                break;
+        case 'F':
+                for (i=0; i < OUTPUT_FMT_OPTS; i++) {
+                        if (!strcmp(arg, output_fmt_types[i])) {
+                                /* the long table is tab-delimited */
+                                opts->long_table = (i == TAB + 1);
+                                opts->output_type = opts->long_table ? TAB : i;
+                                break;
+                        }
+                }
+                if (i >= OUTPUT_FMT_OPTS) {
+                        return "Invalid argument for option -F.";
+                }
+                break;
+        case 'W':
+                opts->print_warnings = 1;
+                break;
+        case 'U':
+                opts->print_unknown_ids = 1;
+                break;
+        case 'N':
+                tmp_long = strtol(arg, &tailptr, 10);
+                if (tailptr == arg || tmp_long < 0 || tmp_long > UINT32_MAX) {
+                        return "Invalid argument for option -N.";
+                }
+                opts->max_warnings = tmp_long;
+                break;
+        default:
+                return "Invalid arguments.";
+        }
+        return NULL;
+}
+
+/* Returns an error message if the options do not go together */
+static const char *Options_check(const Options *opts)
+{
+        if (opts->max_term_size > 0 && opts->max_term_size < opts->min_term_size) {
+                return "Maximum term size (-M) is smaller than minimum (-m).";
+        }
+        if (opts->statistics_type == FISHER_EXACT && opts->cutoff_type == NONE) {
+                return "Must choose a cutoff using -r or -w when requesting"
+                        " Fisher's Exact test.\n";
+        }
+        if (opts->num_columns > 0 && !opts->matrix_input) {
+                return "Columns (-C) can only be selected from a weights"
+                        " matrix (-X).";
+        }
+        if (opts->long_table && (!opts->matrix_input || opts->term_id != NULL)) {
+                return "The long table format is only available for weights"
+                        " matrices (-X) without -T.";
+        }
+        return NULL;
+}
+
+static uint8_t Options_per_column_output(const Options *opts)
+{
+        return (opts->matrix_input && opts->output_filename != NULL
+                && strstr(opts->output_filename, "%s") != NULL);
+}
+
+/* The context of an analysis, restricted to the selected terms */
+static EnrichContext *Options_make_context(const Options *opts, const char *db_name,
+                                           CVTermDb *term_db)
+{
         EnrichContext *cntxt;
+        char **term_ids = NULL;
+        int num_term_ids = 0;
+        int i;
 
+        cntxt = EnrichContext_init(db_name, opts->min_term_size, opts->max_term_size,
+                                   opts->Evalue_cutoff, opts->effective_db_size,
+                                   opts->statistics_type, opts->transform_type,
+                                   opts->discretized_weights, opts->cutoff_type,
+                                   opts->rank_cutoff, opts->weight_cutoff,
+                                   opts->use_all_weights);
+        cntxt->platform_map_file = opts->platform_map_filename;
 
-        /* Output arguments */
-        const char *output_filename = NULL;
-        OutputType output_type = TEXT;
-        uint8_t print_warnings = 0;
-        uint8_t print_unknown_ids = 0;
+        /* Warnings are printed only with the full results */
+        cntxt->max_warnings = opts->max_warnings;
+        if (opts->term_id != NULL || (opts->output_type == TEXT && !opts->print_warnings
+                                      && !opts->print_unknown_ids)) {
+                cntxt->max_warnings = 0;
+        }
+
+        /* Excluded ETD namespaces were not loaded; -x also skips GMT namespaces */
+        if (opts->term_list_filename != NULL) {
+                term_ids = read_term_ids(opts->term_list_filename, &num_term_ids);
+        }
+        EnrichContext_select_terms(cntxt, term_db, opts->excluded_namespaces,
+                                   opts->num_excluded, term_ids, num_term_ids);
+        for (i=0; i < num_term_ids; i++) {
+                free(term_ids[i]);
+        }
+        free(term_ids);
+        return cntxt;
+}
+
+/* Scores the weights in cntxt and prints the results to fp, or to a file
+   for each column of a matrix if the output file name contains %s */
+static void analyze(const char *prog, const Options *opts, EnrichContext *cntxt,
+                    EnrichWeights *weights, FILE *fp, EntityDb *entity_db,
+                    CVTermDb *term_db, TermMappingDb *mapping_db)
+{
+        uint8_t per_column_output = Options_per_column_output(opts);
+        uint8_t single_term = (opts->term_id != NULL);
+        int term_index = -1;
+        EnrichMatrix *matrix = NULL;
+        EnrichContext **column_cntxts;
+        uint32_t pass_size;
+        uint32_t first;
+        uint32_t n;
+        uint32_t j;
+
+        if (opts->matrix_input) {
+                matrix = EnrichResults_set_matrix(cntxt, weights, entity_db, mapping_db);
+        }
+        else {
+                EnrichResults_set_weights(cntxt, weights, entity_db, mapping_db);
+                EnrichResults_process_weights(cntxt);
+        }
+
+        if (single_term) {
+                term_index = term_db->get_index_from_term_id(term_db,
+                                                             (char *) opts->term_id);
+                if (term_index < 0) {
+                        fprintf(stderr, "Could not retrieve term with ID %s.\n",
+                                opts->term_id);
+                        exit(EXIT_FAILURE);
+                }
+        }
+
+        if (!opts->matrix_input) {
+                if (single_term) {
+                        EnrichResults_calc_single_pvalue(cntxt, term_db, mapping_db,
+                                                         term_index);
+                }
+                else {
+                        EnrichResults_calc_pvalues(cntxt, term_db, mapping_db);
+                }
+                print_results(cntxt, fp, opts->output_type, 0, single_term,
+                              opts->print_warnings, opts->print_unknown_ids,
+                              entity_db, term_db, mapping_db);
+                return;
+        }
+
+        /* Columns are scored in passes of one block for each thread */
+        pass_size = SCORE_BLOCK_SIZE * num_worker_threads();
+        column_cntxts = malloc_(pass_size * sizeof(EnrichContext *));
+        if (opts->long_table) {
+                EnrichResults_print_long_heading(fp);
+        }
+        for (first=0; first < matrix->num_columns; first += n) {
+                n = matrix->num_columns - first;
+                if (n > pass_size) {
+                        n = pass_size;
+                }
+                for (j=0; j < n; j++) {
+                        column_cntxts[j] = EnrichMatrix_column_context(matrix, cntxt,
+                                                                       first + j);
+                        EnrichResults_process_weights(column_cntxts[j]);
+                }
+                if (!single_term) {
+                        EnrichResults_calc_pvalues_multi(column_cntxts, n, term_db,
+                                                         mapping_db);
+                }
+                for (j=0; j < n; j++) {
+                        if (single_term) {
+                                EnrichResults_calc_single_pvalue(column_cntxts[j],
+                                                                 term_db, mapping_db,
+                                                                 term_index);
+                        }
+                        if (per_column_output) {
+                                fp = open_output(prog, opts->output_filename,
+                                                 column_cntxts[j]->weights_column);
+                        }
+                        print_results(column_cntxts[j], fp, opts->output_type,
+                                      opts->long_table, single_term,
+                                      opts->print_warnings, opts->print_unknown_ids,
+                                      entity_db, term_db, mapping_db);
+                        if (per_column_output) {
+                                fclose(fp);
+                        }
+                        EnrichMatrix_delete_column_context(column_cntxts[j]);
+                }
+        }
+        free(column_cntxts);
+        EnrichMatrix_delete(matrix);
+}
+
+/* In batch mode, the weights files listed in a manifest are analyzed
+   against the same databases, loaded once. The analyses run at the same
+   time, each with its own context. */
+typedef struct _Batch_s {
+        const char *prog;
+        const char *db_name;
+        EntityDb *entity_db;
+        CVTermDb *term_db;
+        TermMappingDb *mapping_db;
+} Batch;
+
+typedef struct _BatchJob_s {
+        Batch *batch;
+        char *line;  /* holds the file names and option arguments */
+        const char *weights_filename;
+        Options opts;
+} BatchJob;
+
+/* Splits off the next field of a manifest line, as SSFile_split_field()
+   does, except that a field may be enclosed in single or double quotes */
+static char *split_manifest_field(char **cur, char *end)
+{
+        char *field = *cur;
+        char *p;
+        char quote;
+
+        while (field < end && is_manifest_space(*field)) {
+                field++;
+        }
+        if (field == end) {
+                *cur = NULL;
+                return NULL;
+        }
+        if (*field == '"' || *field == '\'') {
+                quote = *field++;
+                for (p=field; p < end && *p != quote; p++)
+                        ;
+        }
+        else {
+                for (p=field; p < end && !is_manifest_space(*p); p++)
+                        ;
+        }
+        *cur = (p < end) ? p + 1 : end;
+        *p = '\0';
+        while (*cur < end && is_manifest_space(**cur)) {
+                (*cur)++;
+        }
+        if (*cur == end) {
+                *cur = NULL;
+        }
+        return field;
+}
+
+static void manifest_error(const char *prog, const char *filename, uint32_t line_num,
+                           const char *msg)
+{
+        fprintf(stderr, "%s: Manifest %s, line %u: %s\n", prog, filename, line_num, msg);
+        exit(EXIT_FAILURE);
+}
+
+/* Reads the manifest, which has one analysis on each line: a weights file,
+   an output file and options that override those of the command line.
+   Empty lines and lines starting with # are skipped. */
+static BatchJob *read_manifest(const char *prog, const char *filename,
+                               const Options *defaults, Batch *batch,
+                               uint32_t *num_jobs)
+{
+        InFile *in = InFile_open(filename);
+        LineReader *reader;
+        uint32_t max_jobs = MAX_BATCH_JOBS;
+        BatchJob *jobs = malloc_(max_jobs * sizeof(BatchJob));
+        BatchJob *job;
+        int max_args = MAX_EXCLUDED;
+        char **args = malloc_(max_args * sizeof(char *));
+        int num_args;
+        uint32_t line_num = 0;
+        char *line;
+        size_t len;
+        char *cur;
+        char *end;
+        char *field;
+        const char *msg;
+        char optbuf[32];
+        int c;
+
+        if (in == NULL) {
+                fprintf(stderr, "Could not open manifest file %s.\n", filename);
+                exit(EXIT_FAILURE);
+        }
+        reader = LineReader_init(in->fp);
+        *num_jobs = 0;
+        while ((line = LineReader_next(reader, &len)) != NULL) {
+                line_num++;
+                field = line;
+                while (is_manifest_space(*field)) {
+                        field++;
+                }
+                if (*field == '\0' || *field == '#') {
+                        continue;
+                }
+                if (*num_jobs >= max_jobs) {
+                        max_jobs *= 2;
+                        jobs = realloc_(jobs, max_jobs * sizeof(BatchJob));
+                }
+                job = jobs + (*num_jobs)++;
+                job->batch = batch;
+
+                /* The fields are split in a copy kept with the job */
+                job->line = malloc_(len + 1);
+                memcpy(job->line, line, len + 1);
+                cur = job->line;
+                end = job->line + len;
+                job->weights_filename = split_manifest_field(&cur, end);
+                if (cur == NULL) {
+                        manifest_error(prog, filename, line_num, "No output file given.");
+                }
+                Options_copy(&job->opts, defaults);
+                job->opts.output_filename = split_manifest_field(&cur, end);
+
+                args[0] = (char *) prog;
+                num_args = 1;
+                while (cur != NULL) {
+                        if (num_args >= max_args) {
+                                max_args *= 2;
+                                args = realloc_(args, max_args * sizeof(char *));
+                        }
+                        args[num_args++] = split_manifest_field(&cur, end);
+                }
+                optind = 1;
+                while ( (c = getopt(num_args, args, MANIFEST_OPTIONS)) != -1) {
+                        if (c == '?') {
+                                sprintf(optbuf, "Invalid option -- %c.", optopt);
+                                manifest_error(prog, filename, line_num, optbuf);
+                        }
+                        msg = Options_set(&job->opts, c, optarg);
+                        if (msg != NULL) {
+                                manifest_error(prog, filename, line_num, msg);
+                        }
+                }
+                if (optind < num_args) {
+                        manifest_error(prog, filename, line_num,
+                                       "Options must follow the weights and output files.");
+                }
+                msg = Options_check(&job->opts);
+                if (msg != NULL) {
+                        manifest_error(prog, filename, line_num, msg);
+                }
+        }
+        LineReader_delete(reader);
+        InFile_close(in);
+        free(args);
+        return jobs;
+}
+
+static void BatchJob_run(void *job_)
+{
+        BatchJob *job = (BatchJob *) job_;
+        Batch *batch = job->batch;
+        const Options *opts = &job->opts;
+        EnrichWeights *weights;
+        EnrichContext *cntxt;
+        FILE *fp = NULL;
+
+        if (!Options_per_column_output(opts)) {
+                fp = open_output(batch->prog, opts->output_filename, NULL);
+        }
+        if (opts->matrix_input) {
+                weights = EnrichWeights_read_matrix(job->weights_filename, opts->columns,
+                                                    opts->num_columns);
+        }
+        else {
+                weights = EnrichWeights_read(job->weights_filename);
+        }
+        cntxt = Options_make_context(opts, batch->db_name, batch->term_db);
+        analyze(batch->prog, opts, cntxt, weights, fp, batch->entity_db, batch->term_db,
+                batch->mapping_db);
+        if (fp != NULL) {
+                fclose(fp);
+        }
+        EnrichContext_delete(cntxt);
+}
+
+int main(int argc, char **argv)
+{
+        /* Option parsing */
+        int c;
+        const char *msg;
+        Options opts;
+        uint8_t reorder_entities = 0;
+        const char *manifest_filename = NULL;
+        int i;
+
+        /* Output */
+        uint8_t per_column_output = 0;
         FILE *fp = stdout;
 
         /* Database and weights variables */
 	char *tdb_filename;
-	const char *weights_filename;
+	const char *weights_filename = NULL;
 	char *namespace;
+        const char **gmt_namespaces;
+        const char **gmt_filenames;
+        int num_gmt_files = 0;
 	EntityDb *entity_db = NULL;
 	CVTermDb *term_db = NULL;
 	TermMappingDb *mapping_db = NULL;
+        const char *db_name = NULL;
+        Startup startup;
+        StartupTask startup_tasks[2];
+        int max_startup_threads = 2;
+        EnrichContext *cntxt;
 
-        /* Excluded namespaces (ETD term_db only) */
-        int num_excluded = 0;
-        int max_excluded = MAX_EXCLUDED;
-        const char **excluded_namespaces = malloc_(MAX_EXCLUDED * sizeof(const char *));
-
-        /* Option to print specific term instead of doing search */
-        const char *term_id = NULL;
-        int term_index;
+        /* Batch mode */
+        Batch batch;
+        BatchJob *jobs = NULL;
+        uint32_t num_jobs = 0;
+        uint32_t k;
 
+        Options_init(&opts);
         opterr = 0;
-        while ( (c = getopt(argc, argv, "Vhm:e:n:s:t:dr:w:x:aT:O:F:WU")) != -1) {
+        while ( (c = getopt(argc, argv, "Vhm:M:e:n:s:t:dr:w:x:i:aLP:XC:T:O:F:WUN:B:")) != -1) {
                 switch (c) {
                 case 'V':
                         printf("%s: standalone SaddleSum, version %s\n", argv[0], FULL_VERSION);
@@ -132,113 +852,11 @@ int main(int argc, char **argv)
                         printf("%s", help_msg);
                         exit(EXIT_SUCCESS);
                         break;
-                case 'm':
-                        tmp_long = strtol(optarg, &tailptr, 10);
-                        if (tailptr == optarg || tmp_long < 1 || tmp_long > UINT32_MAX) {
-                                option_err_msg("Invalid argument for option -m.");
-                        }
-                        min_term_size = tmp_long;
-                        break;
-                case 'e':
-                        tmp_dbl = strtod(optarg, &tailptr);
-                        if (tailptr == optarg || tmp_dbl < 0.0) {
-                                option_err_msg("Invalid argument for option -e.");
-                        }
-                        Evalue_cutoff = tmp_dbl;
-                        break;
-                case 'n':
-                        tmp_dbl = strtod(optarg, &tailptr);
-                        if (tailptr == optarg || tmp_dbl < 0.0) {
-                                option_err_msg("Invalid argument for option -n.");
-                        }
-                        effective_db_size = tmp_dbl;
-                        break;
-                case 's':
-                        for (i=0; i < STAT_OPTS; i++) {
-                                if (!strcmp(optarg, stats_types[i])) {
-                                        statistics_type = i;
-                                        break;
-                                }
-                        }
-                        if (i >= STAT_OPTS) {
-                                option_err_msg("Invalid argument for option -s.");
-                        }
-                        break;
-                case 't':
-                        for (i=0; i < TRANSFORM_OPTS; i++) {
-                                if (!strcmp(optarg, transform_types[i])) {
-                                        transform_type = i+1;
-                                        break;
-                                }
-                        }
-                        if (i >= TRANSFORM_OPTS) {
-                                option_err_msg("Invalid argument for option -t.");
-                        }
+                case 'L':
+                        reorder_entities = 1;
                         break;
-                case 'd':
-                        discretized_weights = 1;
-                        break;
-                case 'r':
-                        tmp_long = strtol(optarg, &tailptr, 10);
-                        if (tailptr == optarg || tmp_long < 1 || tmp_long > UINT32_MAX) {
-                                option_err_msg("Invalid argument for option -r.");
-                        }
-                        if (cutoff_type != NONE) {
-                                option_err_msg("Cannot specify both -r and -w options.");
-                        }
-                        cutoff_type = RANK;
-                        rank_cutoff = tmp_long;
-                        break;
-                case 'w':
-                        tmp_dbl = strtod(optarg, &tailptr);
-                        if (tailptr == optarg || tmp_dbl < 0.0) {
-                                option_err_msg("Invalid argument for option -w.");
-                        }
-                        if (cutoff_type != NONE) {
-                                option_err_msg("Cannot specify both -r and -w options.");
-                        }
-                        cutoff_type = MIN_VALUE;
-                        weight_cutoff = tmp_dbl;
-                        break;
-                case 'x':
-                        if (num_excluded >= max_excluded) {
-                                max_excluded *= 2;
-                                excluded_namespaces = realloc_(excluded_namespaces,
-                                                               max_excluded * sizeof(const char *));
-                        }
-                        excluded_namespaces[num_excluded++] = optarg;
-                        break;
-                case 'a':
-                        use_all_weights = 1;
-                        break;
-                case 'T':
-                        term_id = optarg;
-                        break;
-                case 'O':
-                        output_filename = optarg;
-                        fp = fopen(output_filename, "w");
-                        if (fp == NULL) {
-                                fprintf(stderr, "%s: Could not open output file %s.\n",
-                                        argv[0], output_filename);
-                                exit(EXIT_FAILURE);
-                        }
-                        break;
-                case 'F':
-                        for (i=0; i < OUTPUT_FMT_OPTS; i++) {
-                                if (!strcmp(optarg, output_fmt_types[i])) {
-                                        output_type = i;
-                                        break;
-                                }
-                        }
-                        if (i >= OUTPUT_FMT_OPTS) {
-                                option_err_msg("Invalid argument for option -F.");
-                        }
-                        break;
-                case 'W':
-                        print_warnings = 1;
-                        break;
-                case 'U':
-                        print_unknown_ids = 1;
+                case 'B':
+                        manifest_filename = optarg;
                         break;
                 case '?':
                         fprintf(stderr, "%s: Invalid option -- %c.\nFor help type %s -h.\n",
@@ -246,31 +864,47 @@ int main(int argc, char **argv)
                         exit(EXIT_FAILURE);
                         break;
                 default:
-                        option_err_msg("Invalid arguments.");
+                        msg = Options_set(&opts, c, optarg);
+                        if (msg != NULL) {
+                                option_err_msg(msg);
+                        }
                 }
         }
-        if (argc < optind + MIN_ARGS) {
+        if (argc < optind + (manifest_filename == NULL ? MIN_ARGS : 1)) {
                 option_err_msg("Insufficient arguments.");
         }
-        if (statistics_type == FISHER_EXACT && cutoff_type == NONE) {
-                option_err_msg("Must choose a cutoff using -r or -w when requesting"
-                               " Fisher's Exact test.\n");
+        if (manifest_filename == NULL) {
+                msg = Options_check(&opts);
+                if (msg != NULL) {
+                        option_err_msg(msg);
+                }
+                if (opts.output_filename != NULL) {
+                        per_column_output = Options_per_column_output(&opts);
+                        if (!per_column_output) {
+                                fp = open_output(argv[0], opts.output_filename, NULL);
+                        }
+                }
+                weights_filename = argv[optind++];
+        }
+        else if (opts.output_filename != NULL) {
+                option_err_msg("Output files of a batch (-B) are given in its"
+                               " manifest.");
         }
 
-	/* Get weights */
-	weights_filename = argv[optind++];
+        gmt_namespaces = malloc_((argc - optind) * sizeof(const char *));
+        gmt_filenames = malloc_((argc - optind) * sizeof(const char *));
 
 	/* Get first database (namespace is optional) */
 	get_namespace_and_file(argv[optind++], &namespace, &tdb_filename, ':');
+        memset(&startup, 0, sizeof(Startup));
 	if (namespace == NULL) {
                 /* Assume first termdb file is ETD */
-                ETD_enrichment_context(tdb_filename, &entity_db, &term_db, &mapping_db,
-                                       excluded_namespaces, num_excluded);
-                db_name = ((ETDTermDb *)term_db)->db_name;
+                startup.etd_filename = tdb_filename;
 	}
         else {
                 /* Assume first termdb file is GMT */
-                GMT_enrichment_context(tdb_filename, namespace, &entity_db, &term_db, &mapping_db);
+                gmt_namespaces[num_gmt_files] = namespace;
+                gmt_filenames[num_gmt_files++] = tdb_filename;
         }
 
 	/* From second database, all termdbs are GMT and namespace is compulsory */
@@ -280,53 +914,84 @@ int main(int argc, char **argv)
 			option_err_msg("Specifying namespace is mandatory for second "
 				       "and subsequent term databases.");
 		}
-		GMT_enrichment_context(tdb_filename, namespace, &entity_db, &term_db, &mapping_db);
+                gmt_namespaces[num_gmt_files] = namespace;
+                gmt_filenames[num_gmt_files++] = tdb_filename;
 	}
 
+        /* The analyses of a batch are checked against their complete options
+           before the databases are loaded */
+        if (manifest_filename != NULL) {
+                jobs = read_manifest(argv[0], manifest_filename, &opts, &batch, &num_jobs);
+        }
 
-        cntxt = EnrichContext_init(db_name, min_term_size, Evalue_cutoff,
-                                   effective_db_size, statistics_type,
-				   transform_type, discretized_weights,
-				   cutoff_type, rank_cutoff, weight_cutoff,
-                                   use_all_weights);
-
-        EnrichResults_load_weights(cntxt, weights_filename, entity_db, mapping_db);
-
-        EnrichResults_process_weights(cntxt);
-
-        if (term_id != NULL) {
-                term_index = term_db->get_index_from_term_id(term_db, (char *) term_id);
-                if (term_index < 0) {
-                        fprintf(stderr, "Could not retrieve term with ID %s.\n",
-                                term_id);
-                        exit(EXIT_FAILURE);
+        /* Load the databases and read the weights at the same time, except
+           when both would come from the standard input */
+        startup.excluded_namespaces = opts.excluded_namespaces;
+        startup.num_excluded = opts.num_excluded;
+        startup.gmt_namespaces = gmt_namespaces;
+        startup.gmt_filenames = gmt_filenames;
+        startup.num_gmt_files = num_gmt_files;
+        startup.reorder_entities = reorder_entities;
+        startup.weights_filename = weights_filename;
+        startup.matrix = opts.matrix_input;
+        startup.columns = opts.columns;
+        startup.num_columns = opts.num_columns;
+        if (manifest_filename != NULL) {
+                Startup_load_databases(&startup);
+        }
+        else {
+                if (!strcmp(weights_filename, "-")) {
+                        if (startup.etd_filename != NULL
+                            && !strcmp(startup.etd_filename, "-")) {
+                                max_startup_threads = 1;
+                        }
+                        for (i=0; i < num_gmt_files; i++) {
+                                if (!strcmp(gmt_filenames[i], "-")) {
+                                        max_startup_threads = 1;
+                                }
+                        }
                 }
-                EnrichResults_calc_single_pvalue(cntxt, term_db, mapping_db, term_index);
-                switch (output_type) {
-                case TEXT:
-                        EnrichResults_print_term_text(cntxt, fp, entity_db, mapping_db);
-                        break;
-                case TAB:
-                        EnrichResults_print_term_tabsep(cntxt, fp, entity_db, mapping_db);
-                        break;
+                startup_tasks[0].startup = &startup;
+                startup_tasks[0].read_weights = 0;
+                startup_tasks[1].startup = &startup;
+                startup_tasks[1].read_weights = 1;
+                run_tasks(StartupTask_run, startup_tasks, sizeof(StartupTask), 2,
+                          max_startup_threads);
+        }
+        free(gmt_namespaces);
+        free(gmt_filenames);
+        entity_db = startup.entity_db;
+        term_db = startup.term_db;
+        mapping_db = startup.mapping_db;
+        if (startup.etd_filename != NULL) {
+                db_name = ((ETDTermDb *)term_db)->db_name;
+        }
+
+        if (manifest_filename != NULL) {
+                /* Terms are otherwise created as the analyses request them */
+                CVTermDb_make_all_terms(term_db);
+                batch.prog = argv[0];
+                batch.db_name = db_name;
+                batch.entity_db = entity_db;
+                batch.term_db = term_db;
+                batch.mapping_db = mapping_db;
+                run_tasks(BatchJob_run, jobs, sizeof(BatchJob), num_jobs,
+                          num_worker_threads());
+                for (k=0; k < num_jobs; k++) {
+                        Options_delete_lists(&jobs[k].opts);
+                        free(jobs[k].line);
                 }
+                free(jobs);
         }
         else {
-                EnrichResults_calc_pvalues(cntxt, term_db, mapping_db);
-                switch (output_type) {
-                case TEXT:
-                        EnrichResults_print_all_text(cntxt, fp, print_warnings,
-                                                     print_unknown_ids);
-                        break;
-                case TAB:
-                        EnrichResults_print_all_tabsep(cntxt, fp, term_db, mapping_db);
-                        break;
+                cntxt = Options_make_context(&opts, db_name, term_db);
+                analyze(argv[0], &opts, cntxt, startup.weights, fp, entity_db, term_db,
+                        mapping_db);
+                if (opts.output_filename != NULL && !per_column_output) {
+                        fclose(fp);
                 }
+                EnrichContext_delete(cntxt);
         }
-        if (output_filename != NULL) {
-                fclose(fp);
-        }
-	EnrichContext_delete(cntxt);
-        free(excluded_namespaces);
+        Options_delete_lists(&opts);
 	return EXIT_SUCCESS;
 }
@@ -43,8 +43,8 @@ import shutil
 from sphinx.application import Sphinx
 from qmbpmn.common.utils.filesys import makedirs2
 
-help_files = ['saddlesum-cli', 'saddlesum-show-etd']
-macro_names = ['HELP_SADDLESUM', 'HELP_SHOW_ETD']
+help_files = ['saddlesum-cli', 'saddlesum-show-etd', 'saddlesum-build-etd']
+macro_names = ['HELP_SADDLESUM', 'HELP_SHOW_ETD', 'HELP_BUILD_ETD']
 
 
 def generate_docs(srcdir):